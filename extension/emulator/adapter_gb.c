@@ -9,10 +9,16 @@
 #define ENABLE_SOUND 1
 #define ENABLE_LCD 1
 #define PEANUT_GB_HIGH_LCD_ACCURACY 0
+// Dither each line into the Playdate frame as the core draws it, instead of
+// keeping framebuffers in the core and converting them after each frame.
+#define PEANUT_GB_FRAMEBUFFER 0
 
 #include "emulator/gb/minigb_apu.h"
 #include "emulator/gb/peanut_gb.h"
 
+// Number of slices each frame is run in, with the buttons read before each.
+#define INPUT_SLICES_PER_FRAME 4
+
 typedef struct _GKGameBoyAdapter {
 	struct gb_s gb;
 	
@@ -20,6 +26,9 @@ typedef struct _GKGameBoyAdapter {
 	uint8_t* rom; // Memory for ROM file.
 	uint8_t* cart_ram; // Memory for save file.
 	char* save_file_name;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	char* profile_file_name; // Hot blocks saved next to the save file.
+#endif
 	SoundSource* sound_source;
 	PDMenuItem* scale_menu;
 	PDMenuItem* sound_menu;
@@ -40,13 +49,22 @@ static void free_menus(GKGameBoyAdapter* adapter);
 static void reset(GKGameBoyAdapter* adapter);
 static void save(GKGameBoyAdapter* adapter);
 static void load_save(const char* save_file_name, uint8_t** dest, const size_t len);
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+static void save_profile(GKGameBoyAdapter* adapter);
+static void load_profile(GKGameBoyAdapter* adapter);
+#endif
 static uint8_t read_rom_byte(struct gb_s* gb, const uint_fast32_t addr);
 static uint8_t read_ram_byte(struct gb_s* gb, const uint_fast32_t addr);
 static void write_ram_byte(struct gb_s* gb, const uint_fast32_t addr, const uint8_t val);
 static void error(struct gb_s* gb, const enum gb_error_e gb_err, const uint16_t val);
+#if PEANUT_GB_FRAMEBUFFER
 static void update_display_natural(GKGameBoyAdapter* adapter);
 static void update_display_doubled(GKGameBoyAdapter* adapter);
 static void update_display_fitted(GKGameBoyAdapter* adapter);
+#else
+static void init_dither_tables(void);
+static void draw_line(struct gb_s* gb, const uint8_t* pixels, const uint_fast8_t line);
+#endif
 
 #pragma mark -
 
@@ -58,11 +76,18 @@ GKGameBoyAdapter* GKGameBoyAdapterCreate(void) {
 	adapter->clear_next_frame = true;
 	adapter->selected_scale = 1;
 
+#if !PEANUT_GB_FRAMEBUFFER
+	init_dither_tables();
+#endif
+
 	return adapter;
 }
 
 void GKGameBoyAdapterDestroy(GKGameBoyAdapter* adapter) {
 	save(adapter);
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	save_profile(adapter);
+#endif
 	reset(adapter);
 	
 	playdate->sound->removeSource(adapter->sound_source);
@@ -85,6 +110,9 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 	
 	// Save and free resources if we have loaded a game previously.
 	save(adapter);
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	save_profile(adapter);
+#endif
 	reset(adapter);
 	
 	// Read ROM into memory.
@@ -116,6 +144,25 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 		strcpy(adapter->save_file_name + strlen(save_dir) + filename_length, extension);
 	}
 	
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	// Construct profile path: /saves/<filename>.prof
+	{
+		const char extension[] = ".prof";
+		int str_len = strlen(save_dir) + filename_length + strlen(extension) + 1;
+		adapter->profile_file_name = malloc(str_len);
+	
+		if(adapter->profile_file_name == NULL) {
+			reset(adapter);
+			return false;
+		}
+	
+		memset(adapter->profile_file_name, 0, str_len);
+		strcpy(adapter->profile_file_name, save_dir);
+		strcpy(adapter->profile_file_name + strlen(save_dir), filename);
+		strcpy(adapter->profile_file_name + strlen(save_dir) + filename_length, extension);
+	}
+#endif
+	
 	gb_ret = gb_init(&adapter->gb, &read_rom_byte, &read_ram_byte, &write_ram_byte, &error, adapter);
 	switch(gb_ret) {
 	case GB_INIT_NO_ERROR:
@@ -137,8 +184,20 @@ bool GKGameBoyAdapterLoad(GKGameBoyAdapter* adapter, const char* path) {
 	// Load save file.
 	load_save(adapter->save_file_name, &adapter->cart_ram, gb_get_save_size(&adapter->gb));
 
+	// Let the core read ROM and cart RAM directly instead of through callbacks.
+	gb_set_direct_memory(&adapter->gb, adapter->rom, adapter->cart_ram);
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	// Decode the blocks that were hot last time, so that they don't have to
+	// warm up again.
+	load_profile(adapter);
+#endif
+
 	// Initialize display.
 	gb_init_lcd(&adapter->gb, NULL);
+#if !PEANUT_GB_FRAMEBUFFER
+	gb_set_lcd_draw_line(&adapter->gb, draw_line);
+#endif
 	adapter->gb.direct.frame_skip = 1;
 	adapter->gb.direct.joypad = 255;
 	
@@ -168,16 +227,29 @@ void GKGameBoyAdapterUpdate(GKGameBoyAdapter* adapter, unsigned int dt) {
 	if(adapter->clear_next_frame) {
 		playdate->graphics->clear(kColorBlack);
 		adapter->clear_next_frame = false;
+#if !PEANUT_GB_FRAMEBUFFER
+		// Nothing is kept to redraw from, so draw this frame even if it
+		// would have been skipped, including lines that haven't changed.
+		adapter->gb.display.frame_skip_count = 1;
+#if PEANUT_GB_LINE_SIGNATURES
+		memset(adapter->gb.display.signatures, 0, sizeof(adapter->gb.display.signatures));
+#endif
+#endif
 	}
 	
 	playdate->graphics->setDrawMode(kDrawModeCopy);
 	adapter->current_frame = (uint32_t*)playdate->graphics->getFrame();
 	
-	update_joypad(adapter);
 	update_crank(adapter);
 	
-	gb_run_frame(&adapter->gb);
+	// Run the frame in slices, reading the buttons before each one so that
+	// the game sees the most recent input wherever in the frame it polls.
+	do {
+		update_joypad(adapter);
+		gb_run_cycles(&adapter->gb, LCD_FRAME_CYCLES / INPUT_SLICES_PER_FRAME);
+	} while(!adapter->gb.gb_frame);
 	
+#if PEANUT_GB_FRAMEBUFFER
 	if(force_update) {
 		memset(adapter->gb.display.changed_rows, 1, sizeof(adapter->gb.display.changed_rows));
 		adapter->gb.display.changed_row_count = LCD_HEIGHT;
@@ -194,6 +266,7 @@ void GKGameBoyAdapterUpdate(GKGameBoyAdapter* adapter, unsigned int dt) {
 			update_display_doubled(adapter);
 		}
 	}
+#endif
 	
 	// Tick the internal RTC every 1 second.
 	rtc_timer += dt;// target_speed_ms / fast_mode;
@@ -301,6 +374,13 @@ static void reset(GKGameBoyAdapter* adapter) {
 		free(adapter->save_file_name);
 		adapter->save_file_name = NULL;
 	}
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(adapter->profile_file_name != NULL) {
+		free(adapter->profile_file_name);
+		adapter->profile_file_name = NULL;
+	}
+#endif
 	
 	gb_reset(&adapter->gb);
 	
@@ -361,6 +441,44 @@ static void load_save(const char* save_file_name, uint8_t** dest, const size_t l
 	GKFileClose(f);
 }
 
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+static void save_profile(GKGameBoyAdapter* adapter) {
+	if(adapter->profile_file_name == NULL) {
+		return;
+	}
+	
+	uint8_t* profile = malloc(gb_get_profile_size(&adapter->gb));
+	if(profile == NULL) {
+		return;
+	}
+	
+	size_t profile_length = gb_save_profile(&adapter->gb, profile);
+	
+	GKFile* f;
+	if((f = GKFileOpen(adapter->profile_file_name, kGKFileWrite)) == NULL) {
+		GKLog("Gamekid: Unable to open profile at %s.", adapter->profile_file_name);
+		free(profile);
+		return;
+	}
+	GKFileWrite(profile, profile_length, f);
+	GKFileClose(f);
+	free(profile);
+}
+
+static void load_profile(GKGameBoyAdapter* adapter) {
+	size_t profile_length;
+	uint8_t* profile = GKReadFileContents(adapter->profile_file_name, &profile_length);
+	
+	// There is no profile until the game has been played once.
+	if(profile == NULL) {
+		return;
+	}
+	
+	gb_load_profile(&adapter->gb, profile, profile_length);
+	free(profile);
+}
+#endif
+
 #pragma mark -
 
 static uint8_t read_rom_byte(struct gb_s* gb, const uint_fast32_t addr) {
@@ -429,6 +547,7 @@ static const uint32_t GKDisplayPatterns[4][4][4] = {
 	}
 };
 
+#if PEANUT_GB_FRAMEBUFFER
 static inline uint32_t swap(uint32_t n) {
 #if TARGET_PLAYDATE
 		uint32_t result;
@@ -657,4 +776,119 @@ static void update_display_fitted(GKGameBoyAdapter* adapter) {
 		playdate->graphics->markUpdatedRows(line_one_sy, line_one_sy+1);
 	}
 	
-}
\ No newline at end of file
+}
+#else
+// Dithered 1-bit pixels for four Game Boy pixels, indexed by the row of the
+// pattern and their 2-bit colours with the leftmost in the top bits. Natural
+// scale gives four bits, the doubled scales eight.
+static uint8_t GKDitherNatural[4][256];
+static uint8_t GKDitherDoubled[4][256];
+
+static void init_dither_tables(void) {
+	for(uint32_t y = 0; y < 4; y++) {
+		for(uint32_t colours = 0; colours < 256; colours++) {
+			uint8_t natural = 0;
+			uint8_t doubled = 0;
+			
+			for(uint32_t i = 0; i < 4; i++) {
+				const uint32_t colour = (colours >> (6 - GKFastMult2(i))) & 3;
+				
+				natural |= GKDisplayPatterns[colour][y][i] << (3 - i);
+				doubled |= GKDisplayPatterns[colour][y][GKFastMod4(GKFastMult2(i))] << (7 - GKFastMult2(i));
+				doubled |= GKDisplayPatterns[colour][y][GKFastMod4(GKFastMult2(i) + 1)] << (6 - GKFastMult2(i));
+			}
+			
+			GKDitherNatural[y][colours] = natural;
+			GKDitherDoubled[y][colours] = doubled;
+		}
+	}
+}
+
+static inline uint32_t pack_colours(const uint8_t* pixels) {
+	return (pixels[0] & 3) << 6 | (pixels[1] & 3) << 4 | (pixels[2] & 3) << 2 | (pixels[3] & 3);
+}
+
+// Write a dithered row to the frame at screen row y, only marking it as
+// updated if it differs from what is already there.
+static void write_row(GKGameBoyAdapter* adapter, const uint32_t x, const uint32_t y, const uint8_t* row, const size_t len) {
+	uint8_t* const frame = (uint8_t*)adapter->current_frame + (LCD_ROWSIZE * y) + GKFastDiv8(x);
+	
+	if(memcmp(frame, row, len) == 0) {
+		return;
+	}
+	
+	memcpy(frame, row, len);
+	playdate->graphics->markUpdatedRows(y, y);
+}
+
+static void draw_line_natural(GKGameBoyAdapter* adapter, const uint8_t* pixels, const uint32_t line) {
+	const uint32_t start_x = 120;
+	const uint32_t start_y = 48;
+	const uint8_t* const dither = GKDitherNatural[GKFastMod4(line)];
+	uint8_t row[GKFastDiv8(LCD_WIDTH)];
+	
+	for(uint32_t x = 0; x < LCD_WIDTH; x += 8) {
+		row[GKFastDiv8(x)] = dither[pack_colours(&pixels[x])] << 4 | dither[pack_colours(&pixels[x + 4])];
+	}
+	
+	write_row(adapter, start_x, start_y + line, row, sizeof(row));
+}
+
+static void dither_doubled(uint8_t* row, const uint8_t* pixels, const uint32_t screen_y) {
+	const uint8_t* const dither = GKDitherDoubled[GKFastMod4(screen_y)];
+	
+	for(uint32_t x = 0; x < LCD_WIDTH; x += 4) {
+		row[GKFastDiv4(x)] = dither[pack_colours(&pixels[x])];
+	}
+}
+
+static void draw_line_doubled(GKGameBoyAdapter* adapter, const uint8_t* pixels, const uint32_t line) {
+	const uint32_t screen_x = GKFastDiv2(LCD_COLUMNS-GKFastMult2(LCD_WIDTH));
+	uint8_t row[GKFastDiv4(LCD_WIDTH)];
+	
+	if(line < 12 || line >= LCD_HEIGHT - 12) {
+		return;
+	}
+	
+	const uint32_t screen_y = GKFastMult2(line - 12);
+	
+	for(uint32_t y = screen_y; y <= screen_y + 1; y++) {
+		dither_doubled(row, pixels, y);
+		write_row(adapter, screen_x, y, row, sizeof(row));
+	}
+}
+
+static void draw_line_fitted(GKGameBoyAdapter* adapter, const uint8_t* pixels, const uint32_t line) {
+	const uint32_t screen_x = GKFastDiv2(LCD_COLUMNS-GKFastMult2(LCD_WIDTH));
+	const uint32_t double_line = GKFastMult2(line);
+	uint8_t row[GKFastDiv4(LCD_WIDTH)];
+	
+	// Screen Y is doubled then we remove every 6th line.
+	const uint32_t line_one_sy = double_line - double_line / 6;
+	
+	if(double_line % 6 != 5) {
+		dither_doubled(row, pixels, line_one_sy);
+		write_row(adapter, screen_x, line_one_sy, row, sizeof(row));
+	}
+	
+	if((double_line + 1) % 6 != 5) {
+		dither_doubled(row, pixels, line_one_sy + 1);
+		write_row(adapter, screen_x, line_one_sy + 1, row, sizeof(row));
+	}
+}
+
+// Called by the core with each line it draws.
+static void draw_line(struct gb_s* gb, const uint8_t* pixels, const uint_fast8_t line) {
+	GKGameBoyAdapter* const adapter = gb->direct.priv;
+	
+	if(adapter->selected_scale == 0) {
+		draw_line_natural(adapter, pixels, line);
+	}
+	else if(adapter->selected_scale == 1) {
+		draw_line_fitted(adapter, pixels, line);
+	}
+	else if(adapter->selected_scale == 2) {
+		draw_line_doubled(adapter, pixels, line);
+	}
+}
+#endif
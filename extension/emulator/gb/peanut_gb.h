@@ -33,6 +33,7 @@
 #define PEANUT_GB_H
 
 #include "version.all"	/* Version information */
+#include <stddef.h>	/* Required for offsetof */
 #include <stdlib.h>	/* Required for qsort */
 #include <stdint.h>	/* Required for int types */
 #include <string.h>	/* Required for memset */
@@ -57,6 +58,149 @@
 	#define PEANUT_GB_HIGH_LCD_ACCURACY 1
 #endif
 
+/**
+ * Keep the tile data in VRAM decoded into rows of 2-bit colours, updated as
+ * VRAM is written, so that drawing a line fetches one value per tile row
+ * instead of combining two bytes a pixel at a time. Writes to VRAM then go
+ * through __gb_write(). Adds 6 KiB to struct gb_s. Only used with ENABLE_LCD.
+ */
+#ifndef PEANUT_GB_TILE_CACHE
+#	define PEANUT_GB_TILE_CACHE 1
+#endif
+
+#if !ENABLE_LCD
+#	undef PEANUT_GB_TILE_CACHE
+#	define PEANUT_GB_TILE_CACHE 0
+#endif
+
+/**
+ * Draw lines into the front and back framebuffers in struct gb_s, and mark
+ * those that differ from the previous frame drawn in changed_rows, calling the
+ * lcd_line_changed callback given to gb_init_lcd() for each. Set to 0 to only
+ * pass each line drawn to the lcd_draw_line callback given to
+ * gb_set_lcd_draw_line() instead, so that the front-end can convert it
+ * straight into its own framebuffer, saving 46 KiB of struct gb_s. Only used
+ * with ENABLE_LCD.
+ */
+#ifndef PEANUT_GB_FRAMEBUFFER
+#	define PEANUT_GB_FRAMEBUFFER 1
+#endif
+
+/**
+ * Before drawing a line, compare the LCD registers, palettes and sprites it
+ * uses, and the frames in which its background map row and tiles last
+ * changed, with those of the line as last drawn, and skip drawing it if none
+ * changed. Static screens then cost almost nothing to draw. Requires the tile
+ * cache, which sees every write to VRAM. Disabled by default until the cost of
+ * the comparison on screens that do change has been measured on the device.
+ */
+#ifndef PEANUT_GB_LINE_SIGNATURES
+#	define PEANUT_GB_LINE_SIGNATURES 0
+#endif
+
+#if !PEANUT_GB_TILE_CACHE
+#	undef PEANUT_GB_LINE_SIGNATURES
+#	define PEANUT_GB_LINE_SIGNATURES 0
+#endif
+
+/**
+ * Dispatch opcodes through tables of label addresses (computed goto) instead
+ * of a switch statement. Requires a compiler supporting the "labels as values"
+ * extension, such as GCC or Clang.
+ */
+#ifndef PEANUT_GB_THREADED_DISPATCH
+#	define PEANUT_GB_THREADED_DISPATCH 0
+#endif
+
+/**
+ * Detect short loops that only poll LY, STAT or IF and advance the timers and
+ * the LCD straight to the next event that could end them. Observable timing
+ * is unchanged. Disabled by default until its speed up has been measured with
+ * real games on the device.
+ */
+#ifndef PEANUT_GB_IDLE_LOOP_SKIP
+#	define PEANUT_GB_IDLE_LOOP_SKIP 0
+#endif
+
+/**
+ * Detect common copy and fill loops, such as
+ * LD A, (HL+); LD (DE), A; INC DE; DEC BC; LD A, B; OR C; JR NZ, and run the
+ * iterations that complete before the next event at once with host memory
+ * copies and fills. Loops that access I/O registers, the MBC or memory behind
+ * the front-end callbacks are left to the interpreter. Observable timing is
+ * unchanged. Off by default until measured with real games on the device.
+ */
+#ifndef PEANUT_GB_BULK_LOOPS
+#	define PEANUT_GB_BULK_LOOPS 0
+#endif
+
+/**
+ * Record the operation and result of 8-bit arithmetic, logic, INC and DEC
+ * instructions instead of computing the Z, N, H and C flags, and only work the
+ * flags out when an instruction reads them. Most such flags are overwritten by
+ * the next of these instructions before anything reads them.
+ */
+#ifndef PEANUT_GB_LAZY_FLAGS
+#	define PEANUT_GB_LAZY_FLAGS 0
+#endif
+
+/**
+ * Number of blocks of decoded instructions to cache, or 0 to disable the
+ * cache. Must be a power of two. Each block holds the opcodes and operands of
+ * up to BLOCK_MAX_OPS instructions from ROM, WRAM or HRAM, up to and including
+ * the next branch, and adds 76 bytes to struct gb_s. The hottest blocks from
+ * ROM can be saved with gb_save_profile() and decoded again by
+ * gb_load_profile() when the ROM is next loaded.
+ */
+#ifndef PEANUT_GB_BLOCK_CACHE_SIZE
+#	define PEANUT_GB_BLOCK_CACHE_SIZE 0
+#endif
+
+/**
+ * Translate cached blocks that have been entered
+ * PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD times into threaded code: arrays of
+ * pointers to C handlers for each instruction, with their operands decoded.
+ * These run without the per-instruction interrupt, event and decode overhead
+ * of the interpreter. No machine code is generated for the target, so this
+ * works on any platform, including the Playdate. Instructions that cannot be
+ * translated, and blocks that an event could interrupt, are left to the
+ * interpreter, so observable timing is unchanged. Requires the block cache. The
+ * translations of up to PEANUT_GB_BLOCK_TRANSLATOR_BUFFER_SIZE instructions are
+ * kept, and all are discarded when it is full. The translator is in
+ * peanut_gb_rec.h, which must be next to this header when this is set.
+ */
+#ifndef PEANUT_GB_BLOCK_TRANSLATOR
+#	define PEANUT_GB_BLOCK_TRANSLATOR 0
+#endif
+#ifndef PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD
+#	define PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD 16
+#endif
+#ifndef PEANUT_GB_BLOCK_TRANSLATOR_BUFFER_SIZE
+#	define PEANUT_GB_BLOCK_TRANSLATOR_BUFFER_SIZE 4096
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR && !PEANUT_GB_BLOCK_CACHE_SIZE
+#	error "PEANUT_GB_BLOCK_TRANSLATOR requires PEANUT_GB_BLOCK_CACHE_SIZE"
+#endif
+
+/**
+ * Also compile translated blocks to native code on x86-64 hosts using the
+ * System V ABI, such as Linux, for headless testing. The front-end must
+ * provide executable memory with gb_set_translator_code(), otherwise blocks
+ * are only translated. The back end is in peanut_gb_rec_x64.h.
+ */
+#ifndef PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+#	define PEANUT_GB_BLOCK_TRANSLATOR_X86_64 0
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64 && !PEANUT_GB_BLOCK_TRANSLATOR
+#	error "PEANUT_GB_BLOCK_TRANSLATOR_X86_64 requires the block translator"
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64 && \
+		(!defined(__x86_64__) || defined(_WIN32))
+#	error "PEANUT_GB_BLOCK_TRANSLATOR_X86_64 requires an x86-64 SysV host"
+#endif
+
 /* Interrupt masks */
 #define VBLANK_INTR	0x01
 #define LCDC_INTR	0x02
@@ -91,6 +235,10 @@
 #define CRAM_BANK_SIZE  0x2000
 #define VRAM_BANK_SIZE  0x2000
 
+/* The address space is mapped in 16 pages of 4 KiB. */
+#define MAP_PAGE_SIZE   0x1000
+#define MAP_PAGE_COUNT  0x10
+
 /* DIV Register is incremented at rate of 16384Hz.
  * 4194304 / 16384 = 256 clock cycles for one increment. */
 #define DIV_CYCLES          256
@@ -133,6 +281,7 @@
 #define LCD_MODE_2_CYCLES   204
 #define LCD_MODE_3_CYCLES   284
 #define LCD_VERT_LINES      154
+#define LCD_FRAME_CYCLES    (LCD_LINE_CYCLES * LCD_VERT_LINES)
 #define LCD_WIDTH           160
 #define LCD_HEIGHT          144
 
@@ -143,6 +292,11 @@
 #define VRAM_BMAP_2         (0x9C00 - VRAM_ADDR)
 #define VRAM_TILES_3        (0x8000 - VRAM_ADDR + VRAM_BANK_SIZE)
 #define VRAM_TILES_4        (0x8800 - VRAM_ADDR + VRAM_BANK_SIZE)
+/* Rows of tile data, each stored in two bytes. */
+#define VRAM_TILE_ROWS      (VRAM_BMAP_1 / 2)
+/* Tiles of 16 bytes, and rows of 32 tiles in both background maps. */
+#define VRAM_TILE_COUNT     (VRAM_BMAP_1 / 0x10)
+#define VRAM_MAP_ROWS       ((VRAM_SIZE - VRAM_BMAP_1) / 0x20)
 
 /* Interrupt jump addresses */
 #define VBLANK_INTR_ADDR    0x0040
@@ -167,6 +321,182 @@
 
 #define PEANUT_GB_ARRAYSIZE(array)    (sizeof(array)/sizeof(array[0]))
 
+/* Opcode handler labels, shared by the switch and threaded dispatchers. */
+#if PEANUT_GB_THREADED_DISPATCH
+#	define PGB_OPCODE(op)		op_##op:
+#	define PGB_OPCODE_INVALID	op_invalid:
+#	define PGB_OPCODE_DONE		goto op_done
+#else
+#	define PGB_OPCODE(op)		case op:
+#	define PGB_OPCODE_INVALID	default:
+#	define PGB_OPCODE_DONE		break
+#endif
+
+/* Fetch the next operand byte of the current instruction, from the decoded
+ * block if the instruction was fetched from the block cache. */
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+#	define PGB_FETCH()	(imm != NULL ? (reg.pc++, *imm++) : \
+				 __gb_read(gb, reg.pc++))
+#else
+#	define PGB_FETCH()	__gb_read(gb, reg.pc++)
+#endif
+
+/* Set the flags after an 8-bit ADD, ADC, SUB, SBC or CP, given the XOR of
+ * the operands and the untruncated result, after INC or DEC, given the
+ * result, and after AND, OR or XOR, given the result. */
+#if PEANUT_GB_LAZY_FLAGS
+/* Instruction that last set the flags, if they have not been worked out. C is
+ * kept in reg.f_c up to PGB_LF_DEC, and in bit 8 of the result after. */
+#	define PGB_LF_NONE	0
+#	define PGB_LF_INC	1
+#	define PGB_LF_DEC	2
+#	define PGB_LF_ADD	3
+#	define PGB_LF_SUB	4
+#	define PGB_LF_AND	5
+#	define PGB_LF_OR	6
+
+#	define PGB_FLAGS_LAZY(op, x, res)				\
+	do {							\
+		reg.lf_op = (op);				\
+		reg.lf_x = (x);					\
+		reg.lf_res = (res);				\
+	} while(0)
+#	define PGB_FLAGS_ADD(x, res)	PGB_FLAGS_LAZY(PGB_LF_ADD, x, res)
+#	define PGB_FLAGS_SUB(x, res)	PGB_FLAGS_LAZY(PGB_LF_SUB, x, res)
+#	define PGB_FLAGS_AND(res)	PGB_FLAGS_LAZY(PGB_LF_AND, 0, res)
+#	define PGB_FLAGS_OR(res)	PGB_FLAGS_LAZY(PGB_LF_OR, 0, res)
+#	define PGB_FLAGS_INC(res)					\
+	do {							\
+		reg.f_c = PGB_FLAG_C();				\
+		PGB_FLAGS_LAZY(PGB_LF_INC, 0, res);		\
+	} while(0)
+#	define PGB_FLAGS_DEC(res)					\
+	do {							\
+		reg.f_c = PGB_FLAG_C();				\
+		PGB_FLAGS_LAZY(PGB_LF_DEC, 0, res);		\
+	} while(0)
+
+/* Read the Z or C flag without working out the others. */
+#	define PGB_FLAG_Z()	(reg.lf_op == PGB_LF_NONE ? reg.f_z :	\
+				 (reg.lf_res & 0xFF) == 0x00)
+#	define PGB_FLAG_C()	(reg.lf_op <= PGB_LF_DEC ? reg.f_c :	\
+				 (reg.lf_res >> 8) & 0x01)
+
+/* Work the flags out before an instruction that uses or partly sets them. */
+#	define PGB_FLAGS_SYNC()						\
+	do {								\
+		if(reg.lf_op == PGB_LF_NONE)				\
+			break;						\
+									\
+		reg.f_z = ((reg.lf_res & 0xFF) == 0x00);		\
+									\
+		switch(reg.lf_op)					\
+		{							\
+		case PGB_LF_INC:					\
+			reg.f_n = 0;					\
+			reg.f_h = ((reg.lf_res & 0x0F) == 0x00);	\
+			break;						\
+									\
+		case PGB_LF_DEC:					\
+			reg.f_n = 1;					\
+			reg.f_h = ((reg.lf_res & 0x0F) == 0x0F);	\
+			break;						\
+									\
+		case PGB_LF_ADD:					\
+		case PGB_LF_SUB:					\
+			reg.f_n = (reg.lf_op == PGB_LF_SUB);		\
+			reg.f_h = ((reg.lf_x ^ reg.lf_res) >> 4) & 0x01; \
+			reg.f_c = (reg.lf_res >> 8) & 0x01;		\
+			break;						\
+									\
+		default:						\
+			reg.f_n = 0;					\
+			reg.f_h = (reg.lf_op == PGB_LF_AND);		\
+			reg.f_c = 0;					\
+			break;						\
+		}							\
+									\
+		reg.lf_op = PGB_LF_NONE;				\
+	} while(0)
+
+/* Drop the recorded instruction before one that sets all of the flags. */
+#	define PGB_FLAGS_WRITE()	(reg.lf_op = PGB_LF_NONE)
+#else
+#	define PGB_FLAGS_ADD(x, res)					\
+	do {							\
+		reg.f_z = (((res) & 0xFF) == 0x00);		\
+		reg.f_n = 0;					\
+		reg.f_h = ((x) ^ (res)) & 0x10 ? 1 : 0;		\
+		reg.f_c = ((res) & 0xFF00) ? 1 : 0;		\
+	} while(0)
+#	define PGB_FLAGS_SUB(x, res)					\
+	do {							\
+		reg.f_z = (((res) & 0xFF) == 0x00);		\
+		reg.f_n = 1;					\
+		reg.f_h = ((x) ^ (res)) & 0x10 ? 1 : 0;		\
+		reg.f_c = ((res) & 0xFF00) ? 1 : 0;		\
+	} while(0)
+#	define PGB_FLAGS_AND(res)					\
+	do {							\
+		reg.f_z = ((res) == 0x00);			\
+		reg.f_n = 0;					\
+		reg.f_h = 1;					\
+		reg.f_c = 0;					\
+	} while(0)
+#	define PGB_FLAGS_OR(res)					\
+	do {							\
+		reg.f_z = ((res) == 0x00);			\
+		reg.f_n = 0;					\
+		reg.f_h = 0;					\
+		reg.f_c = 0;					\
+	} while(0)
+#	define PGB_FLAGS_INC(res)					\
+	do {							\
+		reg.f_z = ((res) == 0x00);			\
+		reg.f_n = 0;					\
+		reg.f_h = (((res) & 0x0F) == 0x00);		\
+	} while(0)
+#	define PGB_FLAGS_DEC(res)					\
+	do {							\
+		reg.f_z = ((res) == 0x00);			\
+		reg.f_n = 1;					\
+		reg.f_h = (((res) & 0x0F) == 0x0F);		\
+	} while(0)
+#	define PGB_FLAG_Z()		reg.f_z
+#	define PGB_FLAG_C()		reg.f_c
+#	define PGB_FLAGS_SYNC()		do {} while(0)
+#	define PGB_FLAGS_WRITE()	do {} while(0)
+#endif
+
+/* Write the registers kept in locals by __gb_step_cpu() back to the emulator
+ * context before calling functions that use them, and reload them after. */
+#define PGB_SAVE_REGS()						\
+	do {							\
+		PGB_FLAGS_SYNC();				\
+		gb->cpu_reg.a = reg.a;				\
+		gb->cpu_reg.f_bits.z = reg.f_z;			\
+		gb->cpu_reg.f_bits.n = reg.f_n;			\
+		gb->cpu_reg.f_bits.h = reg.f_h;			\
+		gb->cpu_reg.f_bits.c = reg.f_c;			\
+		gb->cpu_reg.sp = reg.sp;			\
+		gb->cpu_reg.pc = reg.pc;			\
+	} while(0)
+#define PGB_LOAD_AF()						\
+	do {							\
+		reg.a = gb->cpu_reg.a;				\
+		reg.f_z = gb->cpu_reg.f_bits.z;			\
+		reg.f_n = gb->cpu_reg.f_bits.n;			\
+		reg.f_h = gb->cpu_reg.f_bits.h;			\
+		reg.f_c = gb->cpu_reg.f_bits.c;			\
+		PGB_FLAGS_WRITE();				\
+	} while(0)
+#define PGB_LOAD_REGS()						\
+	do {							\
+		PGB_LOAD_AF();					\
+		reg.sp = gb->cpu_reg.sp;			\
+		reg.pc = gb->cpu_reg.pc;			\
+	} while(0)
+
 struct cpu_registers_s
 {
 	/* Combine A and F registers. */
@@ -228,12 +558,120 @@ struct cpu_registers_s
 
 struct count_s
 {
-	uint_fast16_t lcd_count;	/* LCD Timing */
+	uint_fast16_t lcd_count;	/* LCD Timing, or frame timing when off */
 	uint_fast16_t div_count;	/* Divider Register Counter */
 	uint_fast16_t tima_count;	/* Timer Counter */
 	uint_fast16_t serial_count;	/* Serial Counter */
+
+	/* Cycles executed since the counters above were last updated, and the
+	 * number of those cycles at which the next event is due. */
+	uint_fast32_t cycles;
+	uint_fast32_t event_cycles;
+
+	/* Cycles run so far and cycles requested in the current call to
+	 * gb_run_cycles(). */
+	uint_fast32_t run_cycles;
+	uint_fast32_t run_target;
 };
 
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+#define BLOCK_MAX_OPS	16
+/* Set in the tag of blocks decoded from WRAM or HRAM. */
+#define BLOCK_TAG_RAM	0x80000000
+/* WRAM and HRAM are tracked in pages of 256 bytes, each with its own write
+ * generation. Blocks decoded from RAM never cross a page. HRAM is the last
+ * page. */
+#define BLOCK_RAM_PAGE_SIZE	0x100
+#define BLOCK_HRAM_PAGE		(WRAM_SIZE / BLOCK_RAM_PAGE_SIZE)
+#define BLOCK_RAM_PAGES		(BLOCK_HRAM_PAGE + 1)
+/* Blocks from ROM entered at least this many times are saved in profiles. */
+#define BLOCK_PROFILE_MIN_RUNS	16
+
+/* Profile saved by gb_save_profile(): a header of "PGBP", the version and
+ * the header and global checksums of the ROM, then the number of entries
+ * and each entry's ROM bank, address and times entered. All values are
+ * little endian. */
+#define PROFILE_VERSION		1
+#define PROFILE_HEADER_SIZE	10
+#define PROFILE_ENTRY_SIZE	6
+
+/* Instruction decoded by the block cache. */
+struct gb_block_op_s
+{
+	uint8_t opcode;
+	uint8_t length;
+	uint8_t imm[2];
+};
+
+/* Run of decoded instructions, ending at a branch. */
+struct gb_block_s
+{
+	/* ROM bank the block was decoded from, or BLOCK_TAG_RAM combined with
+	 * the write generation of the RAM page it was decoded from. */
+	uint32_t tag;
+	uint16_t addr;
+	uint8_t count;
+	struct gb_block_op_s ops[BLOCK_MAX_OPS];
+	/* Times the block was entered, saturating. */
+	uint16_t runs;
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	/* Times the block was entered before it was translated. */
+	uint8_t heat;
+	/* Number of leading instructions translated, the index of the first
+	 * in the translation buffer, and the most cycles that all but the
+	 * last of them can take. */
+	uint8_t rec_count;
+	uint16_t rec_first;
+	uint16_t rec_cycles;
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	/* Native code of the translated instructions, or NULL. */
+	const uint8_t *rec_native;
+#endif
+};
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+struct gb_s;
+
+/* Instruction translated by the block translator. */
+struct gb_rec_op_s
+{
+	/* Executes the instruction, with the PC already pointing past it.
+	 * Returns nonzero if the rest of the block must not be run. */
+	uint_fast8_t (*exec)(struct gb_s *gb, const struct gb_rec_op_s *op);
+	uint16_t next_pc;
+	/* Operand, or absolute branch target. */
+	uint16_t imm;
+	uint8_t opcode;
+	/* Cycles, not including the extra cycles of taken branches. */
+	uint8_t cycles;
+	/* Offsets of the registers used in struct cpu_registers_s, or the
+	 * flag mask and expected flags of conditional branches. */
+	uint8_t dst;
+	uint8_t src;
+};
+#endif
+
+#if PEANUT_GB_LINE_SIGNATURES
+/* Inputs of a line as it was drawn. */
+struct gb_line_signature_s
+{
+	/* Frame the line was drawn in, or 0 if it must be drawn again. */
+	uint32_t frame;
+	uint8_t LCDC;
+	uint8_t SCX;
+	uint8_t SCY;
+	/* WX, or 0xFF if the window was not drawn on the line. */
+	uint8_t WX;
+	uint8_t window_line;
+	uint8_t BGP;
+	uint8_t OBP0;
+	uint8_t OBP1;
+};
+#endif
+
 struct gb_registers_s
 {
 	/* TODO: Sort variables in address order. */
@@ -295,6 +733,9 @@ struct gb_registers_s
 	* LCD_PALETTE_ALL == 0b11 --> NOT POSSIBLE
 	*/
 	#define LCD_PALETTE_ALL 0x30
+	/* Set in sprite pixels from the pixel tables that are not transparent.
+	 * Never written to the framebuffer. */
+	#define LCD_PIXEL_OPAQUE 0x80
 #endif
 
 /**
@@ -378,10 +819,16 @@ struct gb_s
 	void (*gb_serial_tx)(struct gb_s*, const uint8_t tx);
 	enum gb_serial_rx_ret_e (*gb_serial_rx)(struct gb_s*, uint8_t* rx);
 
+	/* Not bitfields, as they are read for every instruction. */
+	uint8_t gb_halt;
+	uint8_t gb_ime;
+	/* Interrupts both requested and enabled while the IME is set or the
+	 * CPU is halted, otherwise 0. Kept up to date by __gb_update_intr()
+	 * whenever IF, IE, the IME or HALT change. */
+	uint8_t intr_pending;
+
 	struct
 	{
-		unsigned gb_halt	: 1;
-		unsigned gb_ime		: 1;
 		unsigned gb_bios_enable : 1;
 		unsigned gb_frame	: 1; /* New frame drawn. */
 
@@ -409,6 +856,16 @@ struct gb_s
 	uint8_t enable_cart_ram;
 	/* Cartridge ROM/RAM mode select. */
 	uint8_t cart_mode_select;
+
+	/* Handlers for the MBC type, chosen by gb_init(): writes to the MBC
+	 * registers, and cart RAM accesses that are not mapped for direct
+	 * access. */
+	void (*mbc_write)(struct gb_s*, const uint_fast16_t addr,
+			  const uint8_t val);
+	uint8_t (*mbc_cart_ram_read)(struct gb_s*, const uint_fast16_t addr);
+	void (*mbc_cart_ram_write)(struct gb_s*, const uint_fast16_t addr,
+				   const uint8_t val);
+
 	union
 	{
 		struct
@@ -422,10 +879,108 @@ struct gb_s
 		uint8_t cart_rtc[5];
 	};
 
+	/* Optional direct pointers to the ROM and cart RAM. Set with
+	 * gb_set_direct_memory(). */
+	const uint8_t *rom_data;
+	uint8_t *cart_ram_data;
+
+	/* Selected switchable ROM bank and cart RAM bank, only recomputed when
+	 * an MBC register is written. The pointers are NULL when the bank
+	 * must be accessed through the callbacks instead. */
+	uint_fast32_t rom_bank_offset;
+	const uint8_t *rom_bank_data;
+	uint8_t *cart_ram_bank_data;
+
+	/* Host pointer to each page of the address space, or NULL when
+	 * accesses to that page must be handled by __gb_read() or
+	 * __gb_write(). Bank pages are updated when an MBC register is
+	 * written. */
+	struct
+	{
+		const uint8_t *read[MAP_PAGE_COUNT];
+		uint8_t *write[MAP_PAGE_COUNT];
+	} memory_map;
+
+	/* Host pointer to each I/O register and HRAM byte at 0xFF00-0xFFFF
+	 * that is plain storage, or NULL when accesses to it must go through
+	 * its handler in io_read_handlers or io_write_handlers. */
+	struct
+	{
+		const uint8_t *read[0x100];
+		uint8_t *write[0x100];
+	} io_map;
+
 	struct cpu_registers_s cpu_reg;
 	struct gb_registers_s gb_reg;
 	struct count_s counter;
 
+	/* Clock cycles skipped by the idle loop detector during the current or
+	 * last frame, and since reset. */
+	struct
+	{
+		uint_fast32_t frame_cycles;
+		uint_fast32_t total_cycles;
+	} idle_stats;
+
+	/* Iterations of copy and fill loops run at once during the current
+	 * or last frame, and since reset. */
+	struct
+	{
+		uint_fast32_t frame_iterations;
+		uint_fast32_t total_iterations;
+	} bulk_stats;
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	struct
+	{
+		struct gb_block_s blocks[PEANUT_GB_BLOCK_CACHE_SIZE];
+
+		/* Next instruction of the block being executed, or NULL. */
+		const struct gb_block_op_s *next;
+		const struct gb_block_op_s *end;
+		uint16_t next_pc;
+
+		/* Bit per page of WRAM, and whether HRAM, that blocks are
+		 * cached from. A write to such a page invalidates only the
+		 * blocks decoded from it, by giving the page a new write
+		 * generation. ram_generation is the latest generation given
+		 * to any page. */
+		uint32_t wram_code;
+		uint8_t hram_code;
+		uint_fast32_t ram_generation;
+		uint_fast32_t page_generation[BLOCK_RAM_PAGES];
+
+		/* Block lookups, and RAM pages invalidated by writes, since
+		 * reset. */
+		uint_fast32_t hits;
+		uint_fast32_t misses;
+		uint_fast32_t invalidations;
+	} block_cache;
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	struct
+	{
+		struct gb_rec_op_s ops[PEANUT_GB_BLOCK_TRANSLATOR_BUFFER_SIZE];
+		uint_fast16_t used;
+
+		/* Blocks translated, translated blocks run and times the
+		 * buffer was flushed since reset. */
+		uint_fast32_t blocks;
+		uint_fast32_t runs;
+		uint_fast32_t flushes;
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+		/* Executable memory given by gb_set_translator_code(), and
+		 * blocks compiled to it since reset. */
+		uint8_t *code;
+		size_t code_size;
+		size_t code_used;
+		uint_fast32_t native_blocks;
+#endif
+	} translator;
+#endif
+
 	/* TODO: Allow implementation to allocate WRAM, VRAM and Frame Buffer. */
 	uint8_t wram[WRAM_SIZE];
 	uint8_t vram[VRAM_SIZE];
@@ -434,6 +989,18 @@ struct gb_s
 
 	struct
 	{
+		/**
+		 * Notify the front-end that a line of the framebuffer it
+		 * draws from differs from the previous frame drawn. Only
+		 * called with PEANUT_GB_FRAMEBUFFER.
+		 *
+		 * \param gb_s		emulator context
+		 * \param line		Line that changed, between 0-143.
+		 */
+		void (*lcd_line_changed)(struct gb_s *gb,
+				const uint_fast8_t line);
+
+#if !PEANUT_GB_FRAMEBUFFER
 		/**
 		 * Draw line on screen.
 		 *
@@ -452,14 +1019,36 @@ struct gb_s
 		 * 			games.
 		 * \param line		Line to draw pixels on. This is
 		 * guaranteed to be between 0-144 inclusive.
+		 *
+		 * Called for every line drawn. pixels are only valid during
+		 * the call.
 		 */
-		void (*lcd_line_changed)(struct gb_s *gb,
+		void (*lcd_draw_line)(struct gb_s *gb,
+				const uint8_t *pixels,
 				const uint_fast8_t line);
+#endif
 
 		/* Palettes */
 		uint8_t bg_palette[4];
 		uint8_t sp_palette[8];
 
+#if ENABLE_LCD
+		/* Four pixels of a tile row, indexed by their 2-bit colours
+		 * with the leftmost in the top bits, as the bytes written to
+		 * the framebuffer from left to right. One table for the
+		 * background and window, and one for each sprite palette. */
+		uint32_t bg_pixels[256];
+		uint32_t sp_pixels[2][256];
+
+		/* Sprites drawn on each line, highest priority first, as found
+		 * for the sprite height by __gb_find_line_sprites(). Found
+		 * again before drawing once OAM or the height changes. */
+		uint8_t line_sprites[LCD_HEIGHT][MAX_SPRITES_LINE];
+		uint8_t line_sprite_count[LCD_HEIGHT];
+		uint8_t line_sprite_height;
+		uint8_t oam_changed;
+#endif
+
 		uint8_t window_clear;
 		uint8_t WY;
 
@@ -469,11 +1058,40 @@ struct gb_s
 		
 		/* Playdate custom implementation */
 		unsigned back_fb_enabled : 1;
+		/* Screen blanked since the LCD was switched off. */
+		unsigned lcd_off_blanked : 1;
 		
+#if PEANUT_GB_TILE_CACHE
+		/* Each row of tile data in VRAM as 2-bit colours, with the
+		 * leftmost pixel in the top two bits. */
+		uint16_t tile_rows[VRAM_TILE_ROWS];
+#endif
+
+#if PEANUT_GB_LINE_SIGNATURES
+		/* Advanced at every VBLANK, starting from 1. */
+		uint32_t frame;
+		/* Frame in which each tile, each row of the background maps
+		 * and the sprites on each line last changed. */
+		uint32_t tile_changed[VRAM_TILE_COUNT];
+		uint32_t map_row_changed[VRAM_MAP_ROWS];
+		uint32_t sprites_changed[LCD_HEIGHT];
+		/* OAM as the sprites on each line were last found from. */
+		uint8_t oam_found[OAM_SIZE];
+		/* Each line as last drawn into each framebuffer, or passed to
+		 * the front-end. */
+		struct gb_line_signature_s
+			signatures[PEANUT_GB_FRAMEBUFFER ? 2 : 1][LCD_HEIGHT];
+		/* Lines drawn and skipped since gb_init_lcd(). */
+		uint_fast32_t lines_drawn;
+		uint_fast32_t lines_skipped;
+#endif
+
+#if PEANUT_GB_FRAMEBUFFER
 		uint8_t front_fb[LCD_HEIGHT][LCD_WIDTH];
 		uint8_t back_fb[LCD_HEIGHT][LCD_WIDTH];
 		uint32_t changed_rows[LCD_HEIGHT];
 		uint32_t changed_row_count;
+#endif
 	} display;
 
 	/**
@@ -491,6 +1109,11 @@ struct gb_s
 		unsigned interlace : 1;
 		unsigned frame_skip : 1;
 		unsigned sound_enabled : 1;
+#if PEANUT_GB_BLOCK_TRANSLATOR
+		/* Set by gb_init(). Clear to only interpret, for example to
+		 * check the translator against the interpreter. */
+		unsigned translate : 1;
+#endif
 
 		union
 		{
@@ -563,211 +1186,341 @@ void gb_set_rtc(struct gb_s *gb, const struct tm * const time)
 }
 
 /**
- * Internal function used to read bytes.
+ * Internal function used to update the pending interrupts after IF, IE, the
+ * IME or HALT change.
  */
-uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr)
+void __gb_update_intr(struct gb_s *gb)
 {
-	switch(addr >> 12)
-	{
-	case 0x0:
-
-	/* TODO: BIOS support. */
-	case 0x1:
-	case 0x2:
-	case 0x3:
-		return gb->gb_rom_read(gb, addr);
-
-	case 0x4:
-	case 0x5:
-	case 0x6:
-	case 0x7:
-		if(gb->mbc == 1 && gb->cart_mode_select)
-			return gb->gb_rom_read(gb,
-					       addr + ((gb->selected_rom_bank & 0x1F) - 1) * ROM_BANK_SIZE);
-		else
-			return gb->gb_rom_read(gb, addr + (gb->selected_rom_bank - 1) * ROM_BANK_SIZE);
+	gb->intr_pending = (gb->gb_ime || gb->gb_halt) ?
+			   gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR : 0;
+}
 
-	case 0x8:
-	case 0x9:
-		return gb->vram[addr - VRAM_ADDR];
+/**
+ * Internal function used to request an interrupt.
+ */
+void __gb_request_intr(struct gb_s *gb, const uint8_t intr)
+{
+	gb->gb_reg.IF |= intr;
+	__gb_update_intr(gb);
+}
 
-	case 0xA:
-	case 0xB:
-		if(gb->cart_ram && gb->enable_cart_ram)
-		{
-			if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
-				return gb->cart_rtc[gb->cart_ram_bank - 0x08];
-			else if((gb->cart_mode_select || gb->mbc != 1) &&
-					gb->cart_ram_bank < gb->num_ram_banks)
-			{
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR +
-							    (gb->cart_ram_bank * CRAM_BANK_SIZE));
-			}
-			else
-				return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR);
-		}
+/**
+ * Internal function used to update the switchable ROM bank after a write to
+ * an MBC register.
+ */
+void __gb_select_rom_bank(struct gb_s *gb)
+{
+	uint_fast16_t rom_bank = gb->selected_rom_bank;
 
-		return 0xFF;
+	if(gb->mbc == 1 && gb->cart_mode_select)
+		rom_bank &= 0x1F;
 
-	case 0xC:
-		return gb->wram[addr - WRAM_0_ADDR];
+	gb->rom_bank_offset = rom_bank * ROM_BANK_SIZE;
+	gb->rom_bank_data = gb->rom_data ?
+		gb->rom_data + gb->rom_bank_offset : NULL;
 
-	case 0xD:
-		return gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE];
+	for(uint_fast8_t i = 0; i < ROM_BANK_SIZE / MAP_PAGE_SIZE; i++)
+	{
+		gb->memory_map.read[(ROM_N_ADDR >> 12) + i] = gb->rom_bank_data ?
+			gb->rom_bank_data + i * MAP_PAGE_SIZE : NULL;
+	}
 
-	case 0xE:
-		return gb->wram[addr - ECHO_ADDR];
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	/* Stop executing a block decoded from the previous bank. */
+	gb->block_cache.next = NULL;
+#endif
+}
 
-	case 0xF:
-		if(addr < OAM_ADDR)
-			return gb->wram[addr - ECHO_ADDR];
+/**
+ * Internal function used to update the cart RAM bank after a write to an MBC
+ * register.
+ */
+void __gb_select_cart_ram_bank(struct gb_s *gb)
+{
+	uint8_t *cart_ram_write = NULL;
 
-		if(addr < UNUSED_ADDR)
-			return gb->oam[addr - OAM_ADDR];
+	gb->cart_ram_bank_data = NULL;
 
-		/* Unusable memory area. Reading from this area returns 0.*/
-		if(addr < IO_ADDR)
-			return 0xFF;
+	/* The RTC registers of MBC3 are always accessed through the slow
+	 * path. */
+	if(gb->cart_ram_data && gb->cart_ram && gb->enable_cart_ram &&
+			!(gb->mbc == 3 && gb->cart_ram_bank >= 0x08))
+	{
+		if((gb->cart_mode_select || gb->mbc != 1) &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			gb->cart_ram_bank_data = gb->cart_ram_data +
+					gb->cart_ram_bank * CRAM_BANK_SIZE;
+		else
+			gb->cart_ram_bank_data = gb->cart_ram_data;
+
+		/* Writes select their bank differently from reads. */
+		if(gb->cart_mode_select &&
+				gb->cart_ram_bank < gb->num_ram_banks)
+			cart_ram_write = gb->cart_ram_data +
+					 gb->cart_ram_bank * CRAM_BANK_SIZE;
+		else if(gb->num_ram_banks)
+			cart_ram_write = gb->cart_ram_data;
+	}
 
-		/* HRAM */
-		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
-			return gb->hram[addr - IO_ADDR];
+	for(uint_fast8_t i = 0; i < CRAM_BANK_SIZE / MAP_PAGE_SIZE; i++)
+	{
+		gb->memory_map.read[(CART_RAM_ADDR >> 12) + i] =
+			gb->cart_ram_bank_data ?
+			gb->cart_ram_bank_data + i * MAP_PAGE_SIZE : NULL;
+		gb->memory_map.write[(CART_RAM_ADDR >> 12) + i] =
+			cart_ram_write ? cart_ram_write + i * MAP_PAGE_SIZE : NULL;
+	}
+}
 
-		/* APU registers. */
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
-		{
-			if(gb->direct.sound_enabled) {
-				return audio_read(addr);
-			}
-			else {
-				static const uint8_t ortab[] = {
-					0x80, 0x3f, 0x00, 0xff, 0xbf,
-					0xff, 0x3f, 0x00, 0xff, 0xbf,
-					0x7f, 0xff, 0x9f, 0xff, 0xbf,
-					0xff, 0xff, 0x00, 0x00, 0xbf,
-					0x00, 0x00, 0x70,
-					0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-					0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-					0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-				};
-				return gb->hram[addr - IO_ADDR] | ortab[addr - IO_ADDR];
-			}
-		}
+/**
+ * Internal function used to map WRAM and echo RAM for writes. Each bank is
+ * left to the slow path while blocks decoded from it are cached, so that
+ * writes can invalidate them.
+ */
+void __gb_map_wram_writes(struct gb_s *gb)
+{
+	uint8_t *wram_0 = gb->wram;
+	uint8_t *wram_1 = gb->wram + WRAM_BANK_SIZE;
 
-		/* IO and Interrupts. */
-		switch(addr & 0xFF)
-		{
-		/* IO Registers */
-		case 0x00:
-			return 0xC0 | gb->gb_reg.P1;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(gb->block_cache.wram_code & 0x0000FFFF)
+		wram_0 = NULL;
 
-		case 0x01:
-			return gb->gb_reg.SB;
+	if(gb->block_cache.wram_code & 0xFFFF0000)
+		wram_1 = NULL;
+#endif
 
-		case 0x02:
-			return gb->gb_reg.SC;
+	gb->memory_map.write[WRAM_0_ADDR >> 12] = wram_0;
+	gb->memory_map.write[WRAM_1_ADDR >> 12] = wram_1;
+	gb->memory_map.write[ECHO_ADDR >> 12] = wram_0;
+}
 
-		/* Timer Registers */
-		case 0x04:
-			return gb->gb_reg.DIV;
+/**
+ * Internal function used to build the whole memory map.
+ */
+void __gb_update_memory_map(struct gb_s *gb)
+{
+	/* ROM pages are read only, writes go to the MBC. */
+	for(uint_fast8_t i = 0; i < ROM_BANK_SIZE / MAP_PAGE_SIZE; i++)
+	{
+		gb->memory_map.read[(ROM_0_ADDR >> 12) + i] = gb->rom_data ?
+			gb->rom_data + i * MAP_PAGE_SIZE : NULL;
+	}
 
-		case 0x05:
-			return gb->gb_reg.TIMA;
+	for(uint_fast8_t i = ROM_0_ADDR >> 12; i < VRAM_ADDR >> 12; i++)
+		gb->memory_map.write[i] = NULL;
 
-		case 0x06:
-			return gb->gb_reg.TMA;
+	__gb_select_rom_bank(gb);
+	__gb_select_cart_ram_bank(gb);
 
-		case 0x07:
-			return gb->gb_reg.TAC;
+	/* VRAM, WRAM and echo RAM never change mapping. Echo RAM above
+	 * 0xFE00 shares a page with OAM and I/O, so 0xF000-0xFFFF is always
+	 * accessed through the slow path. Writes to VRAM must update the tile
+	 * cache if there is one. */
+	for(uint_fast8_t i = 0; i < VRAM_SIZE / MAP_PAGE_SIZE; i++)
+	{
+		gb->memory_map.read[(VRAM_ADDR >> 12) + i] =
+			gb->vram + i * MAP_PAGE_SIZE;
+		gb->memory_map.write[(VRAM_ADDR >> 12) + i] =
+			PEANUT_GB_TILE_CACHE ? NULL :
+			gb->vram + i * MAP_PAGE_SIZE;
+	}
 
-		/* Interrupt Flag Register */
-		case 0x0F:
-			return gb->gb_reg.IF;
+	gb->memory_map.read[WRAM_0_ADDR >> 12] = gb->wram;
+	gb->memory_map.read[WRAM_1_ADDR >> 12] = gb->wram + WRAM_BANK_SIZE;
+	gb->memory_map.read[ECHO_ADDR >> 12] = gb->wram;
+	__gb_map_wram_writes(gb);
+	gb->memory_map.read[0xF] = gb->memory_map.write[0xF] = NULL;
+}
 
-		/* LCD Registers */
-		case 0x40:
-			return gb->gb_reg.LCDC;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+/**
+ * Internal function used to invalidate the blocks decoded from the given page
+ * of WRAM, or from HRAM if page is BLOCK_HRAM_PAGE.
+ */
+void __gb_block_invalidate_ram(struct gb_s *gb, const uint_fast8_t page)
+{
+	gb->block_cache.ram_generation =
+		(gb->block_cache.ram_generation + 1) & ~BLOCK_TAG_RAM;
 
-		case 0x41:
-			return (gb->gb_reg.STAT & STAT_USER_BITS) |
-			       (gb->gb_reg.LCDC & LCDC_ENABLE ? gb->lcd_mode : LCD_VBLANK);
+	/* Old blocks could match again once the generation wraps. */
+	if(gb->block_cache.ram_generation == 0)
+	{
+		for(uint_fast16_t i = 0; i < PEANUT_GB_BLOCK_CACHE_SIZE; i++)
+		{
+			if(gb->block_cache.blocks[i].tag & BLOCK_TAG_RAM)
+				gb->block_cache.blocks[i].count = 0;
+		}
 
-		case 0x42:
-			return gb->gb_reg.SCY;
+		memset(gb->block_cache.page_generation, 0,
+		       sizeof(gb->block_cache.page_generation));
+		gb->block_cache.ram_generation = 1;
+	}
 
-		case 0x43:
-			return gb->gb_reg.SCX;
+	gb->block_cache.page_generation[page] =
+		gb->block_cache.ram_generation;
+	gb->block_cache.next = NULL;
+	gb->block_cache.invalidations++;
 
-		case 0x44:
-			return gb->gb_reg.LY;
+	if(page == BLOCK_HRAM_PAGE)
+	{
+		gb->block_cache.hram_code = 0;
+		return;
+	}
 
-		case 0x45:
-			return gb->gb_reg.LYC;
+	gb->block_cache.wram_code &= ~((uint32_t)1 << page);
+	__gb_map_wram_writes(gb);
+}
+#endif
 
-		/* DMA Register */
-		case 0x46:
-			return gb->gb_reg.DMA;
+/* Number of the highest priority interrupt, the lowest bit set, for each
+ * combination of pending interrupts. */
+static const uint8_t intr_priority[ANY_INTR + 1] =
+{
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
 
-		/* DMG Palette Registers */
-		case 0x47:
-			return gb->gb_reg.BGP;
+/* Clock cycles per TIMA increment for each TAC input clock select. */
+static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
 
-		case 0x48:
-			return gb->gb_reg.OBP0;
+/**
+ * Internal function used to find the number of clock cycles until the next
+ * LCD mode change, TIMA overflow, serial transfer or end of run event. Adding
+ * fewer cycles than this to the counters cannot change any observable state
+ * other than DIV and TIMA. Always returns at least 1.
+ */
+uint_fast32_t __gb_cycles_to_event(struct gb_s *gb)
+{
+	/* End of the current call to gb_run_cycles(). Otherwise nothing may
+	 * happen while the LCD, timer and serial are all off, so limit
+	 * skipping to a frame at a time. */
+	uint_fast32_t cycles =
+		gb->counter.run_cycles < gb->counter.run_target ?
+		gb->counter.run_target - gb->counter.run_cycles :
+		LCD_FRAME_CYCLES;
+	uint_fast32_t n;
 
-		case 0x49:
-			return gb->gb_reg.OBP1;
+	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
+	{
+		/* End of the current frame with the LCD off. */
+		n = LCD_FRAME_CYCLES - gb->counter.lcd_count;
+		cycles = MIN(cycles, n);
+	}
+	else
+	{
+		/* End of the current line. */
+		n = LCD_LINE_CYCLES + 1 - gb->counter.lcd_count;
+		cycles = MIN(cycles, n);
 
-		/* Window Position Registers */
-		case 0x4A:
-			return gb->gb_reg.WY;
+		if(gb->lcd_mode == LCD_HBLANK)
+		{
+			n = gb->counter.lcd_count >= LCD_MODE_2_CYCLES ? 1 :
+				LCD_MODE_2_CYCLES - gb->counter.lcd_count;
+			cycles = MIN(cycles, n);
+		}
+		else if(gb->lcd_mode == LCD_SEARCH_OAM)
+		{
+			n = gb->counter.lcd_count >= LCD_MODE_3_CYCLES ? 1 :
+				LCD_MODE_3_CYCLES - gb->counter.lcd_count;
+			cycles = MIN(cycles, n);
+		}
+	}
 
-		case 0x4B:
-			return gb->gb_reg.WX;
+	if(gb->gb_reg.tac_enable)
+	{
+		/* TIMA overflow. */
+		n = (0x100 - gb->gb_reg.TIMA) *
+		    TAC_CYCLES[gb->gb_reg.tac_rate] - gb->counter.tima_count;
+		cycles = MIN(cycles, n);
+	}
 
-		/* Interrupt Enable Register */
-		case 0xFF:
-			return gb->gb_reg.IE;
+	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
+	{
+		/* A new transfer is started in the next step. */
+		if(gb->counter.serial_count == 0)
+			return 1;
 
-		/* Unused registers return 1 */
-		default:
-			return 0xFF;
-		}
+		n = SERIAL_CYCLES - gb->counter.serial_count;
+		cycles = MIN(cycles, n);
 	}
 
-	(gb->gb_error)(gb, GB_INVALID_READ, addr);
-	return 0xFF;
+	return cycles;
 }
 
 /**
- * Internal function used to write bytes.
+ * Internal function used to advance the timers and the LCD by fewer cycles
+ * than returned by __gb_cycles_to_event(), without processing any events.
  */
-void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
+void __gb_skip_cycles(struct gb_s *gb, const uint_fast32_t cycles)
 {
-	switch(addr >> 12)
-	{
-	case 0x0:
-	case 0x1:
-		if(gb->mbc == 2 && addr & 0x10)
-			return;
-		else if(gb->mbc > 0 && gb->cart_ram)
-			gb->enable_cart_ram = ((val & 0x0F) == 0x0A);
+	gb->counter.div_count += cycles;
+	gb->gb_reg.DIV += gb->counter.div_count / DIV_CYCLES;
+	gb->counter.div_count %= DIV_CYCLES;
 
-		return;
+	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
+		gb->counter.serial_count += cycles;
 
-	case 0x2:
-		if(gb->mbc == 5)
+	if(gb->gb_reg.tac_enable)
+	{
+		gb->counter.tima_count += cycles;
+		gb->gb_reg.TIMA += gb->counter.tima_count /
+				   TAC_CYCLES[gb->gb_reg.tac_rate];
+		gb->counter.tima_count %= TAC_CYCLES[gb->gb_reg.tac_rate];
+	}
+
+	gb->counter.lcd_count += cycles;
+}
+
+/**
+ * Internal function used to bring DIV, TIMA and the other counters up to date
+ * with the cycles executed since they were last updated. The next event stays
+ * due at the same time.
+ */
+void __gb_sync_counters(struct gb_s *gb)
+{
+	__gb_skip_cycles(gb, gb->counter.cycles);
+	gb->counter.event_cycles -= gb->counter.cycles;
+	gb->counter.run_cycles += gb->counter.cycles;
+	gb->counter.cycles = 0;
+}
+
+/**
+ * Internal function used to handle a write to the MBC registers at
+ * 0x0000-0x7FFF. The MBC type is a constant in each instance below, so that
+ * branches on it are resolved at compile time.
+ */
+static inline void __gb_mbc_write(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val, const uint8_t mbc)
+{
+	switch(addr >> 12)
+	{
+	case 0x0:
+	case 0x1:
+		if(mbc == 2 && addr & 0x10)
+			return;
+		else if(mbc > 0 && gb->cart_ram)
+		{
+			gb->enable_cart_ram = ((val & 0x0F) == 0x0A);
+			__gb_select_cart_ram_bank(gb);
+		}
+
+		return;
+
+	case 0x2:
+		if(mbc == 5)
 		{
 			gb->selected_rom_bank = (gb->selected_rom_bank & 0x100) | val;
 			gb->selected_rom_bank =
 				gb->selected_rom_bank & gb->num_rom_banks_mask;
+			__gb_select_rom_bank(gb);
 			return;
 		}
 
 	/* Intentional fall through. */
 
 	case 0x3:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			//selected_rom_bank = val & 0x7;
 			gb->selected_rom_bank = (val & 0x1F) | (gb->selected_rom_bank & 0x60);
@@ -775,2878 +1528,4251 @@ void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
 			if((gb->selected_rom_bank & 0x1F) == 0x00)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 2 && addr & 0x10)
+		else if(mbc == 2 && addr & 0x10)
 		{
 			gb->selected_rom_bank = val & 0x0F;
 
 			if(!gb->selected_rom_bank)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 		{
 			gb->selected_rom_bank = val & 0x7F;
 
 			if(!gb->selected_rom_bank)
 				gb->selected_rom_bank++;
 		}
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->selected_rom_bank = (val & 0x01) << 8 | (gb->selected_rom_bank & 0xFF);
 
 		gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+		__gb_select_rom_bank(gb);
 		return;
 
 	case 0x4:
 	case 0x5:
-		if(gb->mbc == 1)
+		if(mbc == 1)
 		{
 			gb->cart_ram_bank = (val & 3);
 			gb->selected_rom_bank = ((val & 3) << 5) | (gb->selected_rom_bank & 0x1F);
 			gb->selected_rom_bank = gb->selected_rom_bank & gb->num_rom_banks_mask;
+			__gb_select_rom_bank(gb);
 		}
-		else if(gb->mbc == 3)
+		else if(mbc == 3)
 			gb->cart_ram_bank = val;
-		else if(gb->mbc == 5)
+		else if(mbc == 5)
 			gb->cart_ram_bank = (val & 0x0F);
 
+		__gb_select_cart_ram_bank(gb);
 		return;
 
 	case 0x6:
 	case 0x7:
 		gb->cart_mode_select = (val & 1);
+		__gb_select_rom_bank(gb);
+		__gb_select_cart_ram_bank(gb);
 		return;
+	}
+}
 
-	case 0x8:
-	case 0x9:
-		gb->vram[addr - VRAM_ADDR] = val;
-		return;
-
-	case 0xA:
-	case 0xB:
-		if(gb->cart_ram && gb->enable_cart_ram)
+/**
+ * Internal function used to read cart RAM or the RTC registers when they are
+ * not mapped for direct access.
+ */
+static inline uint8_t __gb_mbc_cart_ram_read(struct gb_s *gb,
+		const uint_fast16_t addr, const uint8_t mbc)
+{
+	if(gb->cart_ram && gb->enable_cart_ram)
+	{
+		if(mbc == 3 && gb->cart_ram_bank >= 0x08)
+			return gb->cart_rtc[gb->cart_ram_bank - 0x08];
+		else if((gb->cart_mode_select || mbc != 1) &&
+				gb->cart_ram_bank < gb->num_ram_banks)
 		{
-			if(gb->mbc == 3 && gb->cart_ram_bank >= 0x08)
-				gb->cart_rtc[gb->cart_ram_bank - 0x08] = val;
-			else if(gb->cart_mode_select &&
-					gb->cart_ram_bank < gb->num_ram_banks)
-			{
-				gb->gb_cart_ram_write(gb,
-						      addr - CART_RAM_ADDR + (gb->cart_ram_bank * CRAM_BANK_SIZE), val);
-			}
-			else if(gb->num_ram_banks)
-				gb->gb_cart_ram_write(gb, addr - CART_RAM_ADDR, val);
+			return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR +
+						    (gb->cart_ram_bank * CRAM_BANK_SIZE));
 		}
+		else
+			return gb->gb_cart_ram_read(gb, addr - CART_RAM_ADDR);
+	}
 
-		return;
-
-	case 0xC:
-		gb->wram[addr - WRAM_0_ADDR] = val;
-		return;
-
-	case 0xD:
-		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
-		return;
-
-	case 0xE:
-		gb->wram[addr - ECHO_ADDR] = val;
-		return;
-
-	case 0xF:
-		if(addr < OAM_ADDR)
-		{
-			gb->wram[addr - ECHO_ADDR] = val;
-			return;
-		}
+	return 0xFF;
+}
 
-		if(addr < UNUSED_ADDR)
+/**
+ * Internal function used to write cart RAM or the RTC registers when they are
+ * not mapped for direct access.
+ */
+static inline void __gb_mbc_cart_ram_write(struct gb_s *gb,
+		const uint_fast16_t addr, const uint8_t val, const uint8_t mbc)
+{
+	if(gb->cart_ram && gb->enable_cart_ram)
+	{
+		if(mbc == 3 && gb->cart_ram_bank >= 0x08)
+			gb->cart_rtc[gb->cart_ram_bank - 0x08] = val;
+		else if(gb->cart_mode_select &&
+				gb->cart_ram_bank < gb->num_ram_banks)
 		{
-			gb->oam[addr - OAM_ADDR] = val;
-			return;
+			gb->gb_cart_ram_write(gb,
+					      addr - CART_RAM_ADDR + (gb->cart_ram_bank * CRAM_BANK_SIZE), val);
 		}
+		else if(gb->num_ram_banks)
+			gb->gb_cart_ram_write(gb, addr - CART_RAM_ADDR, val);
+	}
+}
 
-		/* Unusable memory area. */
-		if(addr < IO_ADDR)
-			return;
+/* Instantiate the MBC handlers for one MBC type. Reads from the ROM and cart
+ * RAM banks are not specialized, as they do not depend on the MBC type once
+ * a bank is selected: they go through the memory map or rom_bank_offset,
+ * which the write handlers update on each bank switch, and cart RAM reads
+ * that are not mapped go through the handlers below. */
+#define PGB_MBC_HANDLERS(n)						\
+	void __gb_mbc##n##_write(struct gb_s *gb,			\
+			const uint_fast16_t addr, const uint8_t val)	\
+	{								\
+		__gb_mbc_write(gb, addr, val, n);			\
+	}								\
+	uint8_t __gb_mbc##n##_cart_ram_read(struct gb_s *gb,		\
+			const uint_fast16_t addr)			\
+	{								\
+		return __gb_mbc_cart_ram_read(gb, addr, n);		\
+	}								\
+	void __gb_mbc##n##_cart_ram_write(struct gb_s *gb,		\
+			const uint_fast16_t addr, const uint8_t val)	\
+	{								\
+		__gb_mbc_cart_ram_write(gb, addr, val, n);		\
+	}
 
-		if(HRAM_ADDR <= addr && addr < INTR_EN_ADDR)
-		{
-			gb->hram[addr - IO_ADDR] = val;
-			return;
-		}
+PGB_MBC_HANDLERS(0)
+PGB_MBC_HANDLERS(1)
+PGB_MBC_HANDLERS(2)
+PGB_MBC_HANDLERS(3)
+PGB_MBC_HANDLERS(5)
+#undef PGB_MBC_HANDLERS
 
-		if((addr >= 0xFF10) && (addr <= 0xFF3F))
-		{
-			if(gb->direct.sound_enabled) {
-				audio_write(addr, val);
-			}
-			else {
-				gb->hram[addr - IO_ADDR] = val;
-			}
-			return;
-		}
+uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr);
 
-		/* IO and Interrupts. */
-		switch(addr & 0xFF)
-		{
-		/* Joypad */
-		case 0x00:
-			/* Only bits 5 and 4 are R/W.
-			 * The lower bits are overwritten later, and the two most
-			 * significant bits are unused. */
-			gb->gb_reg.P1 = val;
+/**
+ * Internal functions used to read the I/O registers at 0xFF00+reg that are
+ * not plain storage.
+ */
+uint8_t __gb_io_read_P1(struct gb_s *gb, const uint8_t reg)
+{
+	(void)reg;
+	return 0xC0 | gb->gb_reg.P1;
+}
 
-			/* Direction keys selected */
-			if((gb->gb_reg.P1 & 0b010000) == 0)
-				gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
-			/* Button keys selected */
-			else
-				gb->gb_reg.P1 |= (gb->direct.joypad & 0x0F);
+uint8_t __gb_io_read_DIV(struct gb_s *gb, const uint8_t reg)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	return gb->gb_reg.DIV;
+}
 
-			return;
+uint8_t __gb_io_read_TIMA(struct gb_s *gb, const uint8_t reg)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	return gb->gb_reg.TIMA;
+}
 
-		/* Serial */
-		case 0x01:
-			gb->gb_reg.SB = val;
-			return;
+uint8_t __gb_io_read_STAT(struct gb_s *gb, const uint8_t reg)
+{
+	(void)reg;
+	return (gb->gb_reg.STAT & STAT_USER_BITS) |
+	       (gb->gb_reg.LCDC & LCDC_ENABLE ? gb->lcd_mode : LCD_VBLANK);
+}
 
-		case 0x02:
-			gb->gb_reg.SC = val;
-			return;
+uint8_t __gb_io_read_APU(struct gb_s *gb, const uint8_t reg)
+{
+	/* Bits that read as 1 in each register from NR10 (0xFF10) on. */
+	static const uint8_t ortab[] = {
+		0x80, 0x3f, 0x00, 0xff, 0xbf,
+		0xff, 0x3f, 0x00, 0xff, 0xbf,
+		0x7f, 0xff, 0x9f, 0xff, 0xbf,
+		0xff, 0xff, 0x00, 0x00, 0xbf,
+		0x00, 0x00, 0x70,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
 
-		/* Timer Registers */
-		case 0x04:
-			gb->gb_reg.DIV = 0x00;
-			return;
+	if(gb->direct.sound_enabled)
+		return audio_read(IO_ADDR | reg);
 
-		case 0x05:
-			gb->gb_reg.TIMA = val;
-			return;
+	return gb->hram[reg] | ortab[reg - 0x10];
+}
 
-		case 0x06:
-			gb->gb_reg.TMA = val;
-			return;
+/**
+ * Internal functions used to write the I/O registers at 0xFF00+reg that are
+ * not plain storage.
+ */
+void __gb_io_write_P1(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	/* Only bits 5 and 4 are R/W.
+	 * The lower bits are overwritten later, and the two most
+	 * significant bits are unused. */
+	gb->gb_reg.P1 = val;
+
+	/* Direction keys selected */
+	if((gb->gb_reg.P1 & 0b010000) == 0)
+		gb->gb_reg.P1 |= (gb->direct.joypad >> 4);
+	/* Button keys selected */
+	else
+		gb->gb_reg.P1 |= (gb->direct.joypad & 0x0F);
+}
 
-		case 0x07:
-			gb->gb_reg.TAC = val;
-			return;
+/* Writes to registers that affect when the next event is due bring the
+ * counters up to date first, and have the events of this step processed
+ * normally afterwards. */
+void __gb_io_write_SC(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	gb->counter.event_cycles = 0;
+	gb->gb_reg.SC = val;
+}
 
-		/* Interrupt Flag Register */
-		case 0x0F:
-			gb->gb_reg.IF = (val | 0b11100000);
-			return;
+void __gb_io_write_DIV(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	(void)val;
+	__gb_sync_counters(gb);
+	gb->gb_reg.DIV = 0x00;
+}
 
-		/* LCD Registers */
-		case 0x40:
-			if(((gb->gb_reg.LCDC & LCDC_ENABLE) == 0) &&
-				(val & LCDC_ENABLE))
-			{
-				gb->counter.lcd_count = 0;
-				gb->lcd_blank = 1;
-			}
+void __gb_io_write_TIMA(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	gb->counter.event_cycles = 0;
+	gb->gb_reg.TIMA = val;
+}
 
-			gb->gb_reg.LCDC = val;
+void __gb_io_write_TAC(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	gb->counter.event_cycles = 0;
+	gb->gb_reg.TAC = val;
+}
 
-			/* LY fixed to 0 when LCD turned off. */
-			if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
-			{
-				/* Do not turn off LCD outside of VBLANK. This may
-				 * happen due to poor timing in this emulator. */
-				if(gb->lcd_mode != LCD_VBLANK)
-				{
-					gb->gb_reg.LCDC |= LCDC_ENABLE;
-					return;
-				}
+void __gb_io_write_IF(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.IF = (val | 0b11100000);
+	__gb_update_intr(gb);
+}
 
-				gb->gb_reg.STAT = (gb->gb_reg.STAT & ~0x03) | LCD_VBLANK;
-				gb->gb_reg.LY = 0;
-				gb->counter.lcd_count = 0;
-			}
+void __gb_io_write_IE(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.IE = val;
+	__gb_update_intr(gb);
+}
 
-			return;
+void __gb_io_write_APU(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	if(gb->direct.sound_enabled)
+		audio_write(IO_ADDR | reg, val);
+	else
+		gb->hram[reg] = val;
+}
 
-		case 0x41:
-			gb->gb_reg.STAT = (val & 0b01111000);
-			return;
+void __gb_io_write_LCDC(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	__gb_sync_counters(gb);
+	gb->counter.event_cycles = 0;
 
-		case 0x42:
-			gb->gb_reg.SCY = val;
-			return;
+	if(((gb->gb_reg.LCDC & LCDC_ENABLE) == 0) &&
+		(val & LCDC_ENABLE))
+	{
+		gb->counter.lcd_count = 0;
+		gb->lcd_blank = 1;
+		gb->display.lcd_off_blanked = 0;
+	}
 
-		case 0x43:
-			gb->gb_reg.SCX = val;
-			return;
+	gb->gb_reg.LCDC = val;
 
-		/* LY (0xFF44) is read only. */
-		case 0x45:
-			gb->gb_reg.LYC = val;
+	/* LY fixed to 0 when LCD turned off. */
+	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
+	{
+		/* Do not turn off LCD outside of VBLANK. This may
+		 * happen due to poor timing in this emulator. */
+		if(gb->lcd_mode != LCD_VBLANK)
+		{
+			gb->gb_reg.LCDC |= LCDC_ENABLE;
 			return;
+		}
 
-		/* DMA Register */
-		case 0x46:
-			gb->gb_reg.DMA = (val % 0xF1);
+		gb->gb_reg.STAT = (gb->gb_reg.STAT & ~0x03) | LCD_VBLANK;
+		gb->gb_reg.LY = 0;
+		gb->counter.lcd_count = 0;
+	}
+}
 
-			for(uint8_t i = 0; i < OAM_SIZE; i++)
-				gb->oam[i] = __gb_read(gb, (gb->gb_reg.DMA << 8) + i);
+void __gb_io_write_STAT(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.STAT = (val & 0b01111000);
+}
 
-			return;
+void __gb_io_write_DMA(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	const uint_fast16_t src = (val % 0xF1) << 8;
+	const uint8_t *page = gb->memory_map.read[src >> 12];
 
-		/* DMG Palette Registers */
-		case 0x47:
-			gb->gb_reg.BGP = val;
-			gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
-			gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
-			gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
-			gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
-			return;
+	gb->gb_reg.DMA = (val % 0xF1);
 
-		case 0x48:
-			gb->gb_reg.OBP0 = val;
-			gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
-			gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
-			gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
-			gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
+	/* The source never crosses a page, so copy it at once if the page is
+	 * mapped. Most games copy the same sprites in most frames. */
+	if(page != NULL)
+	{
+		if(memcmp(gb->oam, page + (src & (MAP_PAGE_SIZE - 1)),
+				OAM_SIZE) == 0)
 			return;
 
-		case 0x49:
-			gb->gb_reg.OBP1 = val;
-			gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
-			gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
-			gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
-			gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
-			return;
+		memcpy(gb->oam, page + (src & (MAP_PAGE_SIZE - 1)), OAM_SIZE);
+#if ENABLE_LCD
+		gb->display.oam_changed = 1;
+#endif
+		return;
+	}
 
-		/* Window Position Registers */
-		case 0x4A:
-			gb->gb_reg.WY = val;
-			return;
+#if ENABLE_LCD
+	gb->display.oam_changed = 1;
+#endif
 
-		case 0x4B:
-			gb->gb_reg.WX = val;
-			return;
+	for(uint8_t i = 0; i < OAM_SIZE; i++)
+		gb->oam[i] = __gb_read(gb, src + i);
+}
 
-		/* Turn off boot ROM */
-		case 0x50:
-			gb->gb_bios_enable = 0;
-			return;
+#if ENABLE_LCD
+/**
+ * Internal function used to fill a pixel table with the framebuffer bytes of
+ * every four pixels of a tile row, given the byte of each colour.
+ */
+void __gb_build_pixel_table(uint32_t table[256], const uint8_t colours[4])
+{
+	for(uint_fast16_t i = 0; i < 256; i++)
+	{
+		const uint8_t pixels[4] =
+		{
+			colours[i >> 6], colours[(i >> 4) & 0x03],
+			colours[(i >> 2) & 0x03], colours[i & 0x03]
+		};
 
-		/* Interrupt Enable Register */
-		case 0xFF:
-			gb->gb_reg.IE = val;
-			return;
-		}
+		memcpy(&table[i], pixels, sizeof(pixels));
 	}
-
-	(gb->gb_error)(gb, GB_INVALID_WRITE, addr);
 }
 
-uint8_t __gb_execute_cb(struct gb_s *gb)
+/**
+ * Internal function used to rebuild the pixel table of a sprite palette.
+ */
+void __gb_build_sp_pixels(struct gb_s *gb, const uint_fast8_t palette)
 {
-	uint8_t inst_cycles;
-	uint8_t cbop = __gb_read(gb, gb->cpu_reg.pc++);
-	uint8_t r = (cbop & 0x7);
-	uint8_t b = (cbop >> 3) & 0x7;
-	uint8_t d = (cbop >> 3) & 0x1;
-	uint8_t val;
-	uint8_t writeback = 1;
+	uint8_t colours[4];
 
-	inst_cycles = 8;
-	/* Add an additional 8 cycles to these sets of instructions. */
-	switch(cbop & 0xC7)
+	for(uint_fast8_t c = 0; c < 4; c++)
 	{
-	case 0x06:
-	case 0x86:
-    	case 0xC6:
-		inst_cycles += 8;
-    	break;
-    	case 0x46:
-		inst_cycles += 4;
-    	break;
+		colours[c] = gb->display.sp_palette[palette * 4 + c] |
+			     (palette ? LCD_PALETTE_OBJ : 0) |
+			     (c ? LCD_PIXEL_OPAQUE : 0);
 	}
 
-	switch(r)
+	__gb_build_pixel_table(gb->display.sp_pixels[palette], colours);
+}
+#endif
+
+/* DMG Palette Registers */
+void __gb_io_write_BGP(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.BGP = val;
+	gb->display.bg_palette[0] = (gb->gb_reg.BGP & 0x03);
+	gb->display.bg_palette[1] = (gb->gb_reg.BGP >> 2) & 0x03;
+	gb->display.bg_palette[2] = (gb->gb_reg.BGP >> 4) & 0x03;
+	gb->display.bg_palette[3] = (gb->gb_reg.BGP >> 6) & 0x03;
+
+#if ENABLE_LCD
 	{
-	case 0:
-		val = gb->cpu_reg.b;
-		break;
+		uint8_t colours[4];
 
-	case 1:
-		val = gb->cpu_reg.c;
-		break;
+		for(uint_fast8_t c = 0; c < 4; c++)
+			colours[c] = gb->display.bg_palette[c] | LCD_PALETTE_BG;
 
-	case 2:
-		val = gb->cpu_reg.d;
-		break;
+		__gb_build_pixel_table(gb->display.bg_pixels, colours);
+	}
+#endif
+}
 
-	case 3:
-		val = gb->cpu_reg.e;
-		break;
+void __gb_io_write_OBP0(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.OBP0 = val;
+	gb->display.sp_palette[0] = (gb->gb_reg.OBP0 & 0x03);
+	gb->display.sp_palette[1] = (gb->gb_reg.OBP0 >> 2) & 0x03;
+	gb->display.sp_palette[2] = (gb->gb_reg.OBP0 >> 4) & 0x03;
+	gb->display.sp_palette[3] = (gb->gb_reg.OBP0 >> 6) & 0x03;
+#if ENABLE_LCD
+	__gb_build_sp_pixels(gb, 0);
+#endif
+}
 
-	case 4:
-		val = gb->cpu_reg.h;
-		break;
+void __gb_io_write_OBP1(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	gb->gb_reg.OBP1 = val;
+	gb->display.sp_palette[4] = (gb->gb_reg.OBP1 & 0x03);
+	gb->display.sp_palette[5] = (gb->gb_reg.OBP1 >> 2) & 0x03;
+	gb->display.sp_palette[6] = (gb->gb_reg.OBP1 >> 4) & 0x03;
+	gb->display.sp_palette[7] = (gb->gb_reg.OBP1 >> 6) & 0x03;
+#if ENABLE_LCD
+	__gb_build_sp_pixels(gb, 1);
+#endif
+}
 
-	case 5:
-		val = gb->cpu_reg.l;
-		break;
+/* Turn off boot ROM */
+void __gb_io_write_BOOT(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	(void)reg;
+	(void)val;
+	gb->gb_bios_enable = 0;
+}
 
-	case 6:
-		val = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+/* Handlers of the I/O registers at 0xFF00-0xFFFF that are not plain storage,
+ * indexed by the low byte of the address. Registers without a handler are
+ * accessed through gb->io_map, or are unused. */
+#define R(name)	__gb_io_read_##name
+static uint8_t (*const io_read_handlers[0x100])(struct gb_s *, const uint8_t) =
+{
+	/* *INDENT-OFF* */
+	/* 0       1       2       3       4       5       6       7       8       9       A       B       C       D       E       F	*/
+	R(P1),  0,      0,      0,      R(DIV), R(TIMA),0,      0,      0,      0,      0,      0,      0,      0,      0,      0,	/* 0x00 */
+	R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU),	/* 0x10 */
+	R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU),	/* 0x20 */
+	R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU), R(APU),	/* 0x30 */
+	0,      R(STAT),0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,	/* 0x40 */
+	/* 0x50-0xFF: unused registers, HRAM and IE. */
+	/* *INDENT-ON* */
+};
+#undef R
 
-	/* Only values 0-7 are possible here, so we make the final case
-	 * default to satisfy -Wmaybe-uninitialized warning. */
-	default:
-		val = gb->cpu_reg.a;
-		break;
-	}
+#define W(name)	__gb_io_write_##name
+static void (*const io_write_handlers[0x100])(struct gb_s *, const uint8_t,
+		const uint8_t) =
+{
+	/* *INDENT-OFF* */
+	/* 0       1       2       3       4       5       6       7       8       9       A       B       C       D       E       F	*/
+	W(P1),  0,      W(SC),  0,      W(DIV), W(TIMA),0,      W(TAC), 0,      0,      0,      0,      0,      0,      0,      W(IF),	/* 0x00 */
+	W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU),	/* 0x10 */
+	W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU),	/* 0x20 */
+	W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU), W(APU),	/* 0x30 */
+	W(LCDC),W(STAT),0,      0,      0,      0,      W(DMA), W(BGP), W(OBP0),W(OBP1),0,      0,      0,      0,      0,      0,	/* 0x40 */
+	W(BOOT),0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,	/* 0x50 */
+	/* 0x60-0xFE: unused registers and HRAM. */
+	[0xFF] = W(IE)
+	/* *INDENT-ON* */
+};
+#undef W
+
+/**
+ * Internal function used to build the I/O register map. Unused registers
+ * read as 0xFF, and writes to them are reported as invalid.
+ */
+void __gb_update_io_map(struct gb_s *gb)
+{
+	static const uint8_t unused = 0xFF;
 
-	/* TODO: Find out WTF this is doing. */
-	switch(cbop >> 6)
+	for(uint_fast16_t i = 0; i < 0x100; i++)
 	{
-	case 0x0:
-		cbop = (cbop >> 4) & 0x3;
+		gb->io_map.read[i] = io_read_handlers[i] ? NULL : &unused;
+		gb->io_map.write[i] = NULL;
+	}
 
-		switch(cbop)
-		{
-		case 0x0: /* RdC R */
-		case 0x1: /* Rd R */
-			if(d) /* RRC R / RR R */
-			{
-				uint8_t temp = val;
-				val = (val >> 1);
-				val |= cbop ? (gb->cpu_reg.f_bits.c << 7) : (temp << 7);
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-				gb->cpu_reg.f_bits.c = (temp & 0x01);
-			}
-			else /* RLC R / RL R */
-			{
-				uint8_t temp = val;
-				val = (val << 1);
-				val |= cbop ? gb->cpu_reg.f_bits.c : (temp >> 7);
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-				gb->cpu_reg.f_bits.c = (temp >> 7);
-			}
+	for(uint_fast16_t i = HRAM_ADDR - IO_ADDR; i < INTR_EN_ADDR - IO_ADDR; i++)
+		gb->io_map.read[i] = gb->io_map.write[i] = &gb->hram[i];
+
+	/* Plain storage registers. LY (0xFF44) is read only, and the others
+	 * only read here have write handlers. */
+	gb->io_map.read[0x01] = gb->io_map.write[0x01] = &gb->gb_reg.SB;
+	gb->io_map.read[0x02] = &gb->gb_reg.SC;
+	gb->io_map.read[0x06] = gb->io_map.write[0x06] = &gb->gb_reg.TMA;
+	gb->io_map.read[0x07] = &gb->gb_reg.TAC;
+	gb->io_map.read[0x0F] = &gb->gb_reg.IF;
+	gb->io_map.read[0x40] = &gb->gb_reg.LCDC;
+	gb->io_map.read[0x42] = gb->io_map.write[0x42] = &gb->gb_reg.SCY;
+	gb->io_map.read[0x43] = gb->io_map.write[0x43] = &gb->gb_reg.SCX;
+	gb->io_map.read[0x44] = &gb->gb_reg.LY;
+	gb->io_map.read[0x45] = gb->io_map.write[0x45] = &gb->gb_reg.LYC;
+	gb->io_map.read[0x46] = &gb->gb_reg.DMA;
+	gb->io_map.read[0x47] = &gb->gb_reg.BGP;
+	gb->io_map.read[0x48] = &gb->gb_reg.OBP0;
+	gb->io_map.read[0x49] = &gb->gb_reg.OBP1;
+	gb->io_map.read[0x4A] = gb->io_map.write[0x4A] = &gb->gb_reg.WY;
+	gb->io_map.read[0x4B] = gb->io_map.write[0x4B] = &gb->gb_reg.WX;
+	gb->io_map.read[0xFF] = &gb->gb_reg.IE;
+}
 
-			break;
-
-		case 0x2:
-			if(d) /* SRA R */
-			{
-				gb->cpu_reg.f_bits.c = val & 0x01;
-				val = (val >> 1) | (val & 0x80);
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-			}
-			else /* SLA R */
-			{
-				gb->cpu_reg.f_bits.c = (val >> 7);
-				val = val << 1;
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-			}
-
-			break;
-
-		case 0x3:
-			if(d) /* SRL R */
-			{
-				gb->cpu_reg.f_bits.c = val & 0x01;
-				val = val >> 1;
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-			}
-			else /* SWAP R */
-			{
-				uint8_t temp = (val >> 4) & 0x0F;
-				temp |= (val << 4) & 0xF0;
-				val = temp;
-				gb->cpu_reg.f_bits.z = (val == 0x00);
-				gb->cpu_reg.f_bits.n = 0;
-				gb->cpu_reg.f_bits.h = 0;
-				gb->cpu_reg.f_bits.c = 0;
-			}
+/**
+ * Internal function used to read the I/O register or HRAM byte at
+ * 0xFF00+reg.
+ */
+uint8_t __gb_read_io(struct gb_s *gb, const uint8_t reg)
+{
+	const uint8_t *p = gb->io_map.read[reg];
 
-			break;
-		}
+	if(p != NULL)
+		return *p;
 
-		break;
+	return io_read_handlers[reg](gb, reg);
+}
 
-	case 0x1: /* BIT B, R */
-		gb->cpu_reg.f_bits.z = !((val >> b) & 0x1);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		writeback = 0;
-		break;
+/**
+ * Internal function used to write the I/O register or HRAM byte at
+ * 0xFF00+reg.
+ */
+void __gb_write_io(struct gb_s *gb, const uint8_t reg, const uint8_t val)
+{
+	uint8_t *p = gb->io_map.write[reg];
 
-	case 0x2: /* RES B, R */
-		val &= (0xFE << b) | (0xFF >> (8 - b));
-		break;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(gb->block_cache.hram_code && reg >= HRAM_ADDR - IO_ADDR &&
+			reg < INTR_EN_ADDR - IO_ADDR)
+		__gb_block_invalidate_ram(gb, BLOCK_HRAM_PAGE);
+#endif
 
-	case 0x3: /* SET B, R */
-		val |= (0x1 << b);
-		break;
+	if(p != NULL)
+	{
+		*p = val;
+		return;
 	}
 
-	if(writeback)
+	if(io_write_handlers[reg] != NULL)
 	{
-		switch(r)
-		{
-		case 0:
-			gb->cpu_reg.b = val;
-			break;
-
-		case 1:
-			gb->cpu_reg.c = val;
-			break;
-
-		case 2:
-			gb->cpu_reg.d = val;
-			break;
-
-		case 3:
-			gb->cpu_reg.e = val;
-			break;
-
-		case 4:
-			gb->cpu_reg.h = val;
-			break;
-
-		case 5:
-			gb->cpu_reg.l = val;
-			break;
-
-		case 6:
-			__gb_write(gb, gb->cpu_reg.hl, val);
-			break;
-
-		case 7:
-			gb->cpu_reg.a = val;
-			break;
-		}
+		io_write_handlers[reg](gb, reg, val);
+		return;
 	}
-	return inst_cycles;
+
+	(gb->gb_error)(gb, GB_INVALID_WRITE, IO_ADDR | reg);
 }
 
 #if ENABLE_LCD
-struct sprite_data {
-	uint8_t sprite_number;
-	uint8_t x;
-};
-
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-static int compare_sprites(const void *in1, const void *in2)
+/**
+ * Internal function used to combine the two bytes of a row of tile data into
+ * 2-bit colours, with the leftmost pixel in the top two bits.
+ */
+uint_fast16_t __gb_decode_tile_row(const uint8_t t1, const uint8_t t2)
 {
-	const struct sprite_data *sd1 = in1, *sd2 = in2;
-	int x_res = (int)sd1->x - (int)sd2->x;
-	if(x_res != 0)
-		return x_res;
+	uint_fast16_t lo = t1, hi = t2;
+
+	/* Move bit n of each byte to bit 2n. */
+	lo = (lo | (lo << 4)) & 0x0F0F;
+	lo = (lo | (lo << 2)) & 0x3333;
+	lo = (lo | (lo << 1)) & 0x5555;
+	hi = (hi | (hi << 4)) & 0x0F0F;
+	hi = (hi | (hi << 2)) & 0x3333;
+	hi = (hi | (hi << 1)) & 0x5555;
 
-	return (int)sd1->sprite_number - (int)sd2->sprite_number;
+	return lo | (hi << 1);
 }
 #endif
 
-void __gb_draw_line(struct gb_s *gb)
+#if PEANUT_GB_TILE_CACHE
+/**
+ * Internal function used to decode the rows of tile data in len bytes of VRAM
+ * from offset after they are written.
+ */
+void __gb_tile_cache_update(struct gb_s *gb, const uint_fast16_t offset,
+		const uint_fast16_t len)
 {
-	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
-		return;
+	const uint_fast16_t end = MIN(offset + len, VRAM_BMAP_1);
 
-	/* If interlaced mode is activated, check if we need to draw the current
-	 * line. */
-	if(gb->direct.interlace)
+	for(uint_fast16_t i = offset & ~1u; i < end; i += 2)
 	{
-		if((gb->display.interlace_count == 0
-				&& (gb->gb_reg.LY & 1) == 0)
-				|| (gb->display.interlace_count == 1
-				    && (gb->gb_reg.LY & 1) == 1))
-		{
-			/* Compensate for missing window draw if required. */
-			if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
-					&& gb->gb_reg.LY >= gb->display.WY
-					&& gb->gb_reg.WX <= 166)
-				gb->display.window_clear++;
-
-			return;
-		}
+		gb->display.tile_rows[i / 2] =
+			__gb_decode_tile_row(gb->vram[i], gb->vram[i + 1]);
 	}
-	
-	uint8_t* front_pixels = &gb->display.front_fb[gb->gb_reg.LY][0];
-	uint8_t* back_pixels = &gb->display.back_fb[gb->gb_reg.LY][0];
-	uint8_t* pixels = gb->display.back_fb_enabled ? back_pixels : front_pixels;
-	uint8_t pixel = 0;
+}
 
-	/* If background is enabled, draw it. */
-	if(gb->gb_reg.LCDC & LCDC_BG_ENABLE)
-	{
-		/* Calculate current background line to draw. Constant because
-		 * this function draws only this one line each time it is
-		 * called. */
-		const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+/**
+ * Internal function used to update the tile cache, and the frames in which
+ * the tiles and background map rows last changed, after len bytes of VRAM from
+ * offset are written.
+ */
+void __gb_vram_written(struct gb_s *gb, const uint_fast16_t offset,
+		const uint_fast16_t len)
+{
+	if(offset < VRAM_BMAP_1)
+		__gb_tile_cache_update(gb, offset, len);
 
-		/* Get selected background map address for first tile
-		 * corresponding to current line.
-		 * 0x20 (32) is the width of a background tile, and the bit
-		 * shift is to calculate the address. */
-		const uint16_t bg_map =
-			((gb->gb_reg.LCDC & LCDC_BG_MAP) ?
-			 VRAM_BMAP_2 : VRAM_BMAP_1)
-			+ (bg_y >> 3) * 0x20;
+#if PEANUT_GB_LINE_SIGNATURES
+	const uint_fast16_t last = offset + len - 1;
 
-		/* The displays (what the player sees) X coordinate, drawn right
-		 * to left. */
-		uint8_t disp_x = LCD_WIDTH - 1;
+	for(uint_fast16_t i = offset / 0x10;
+			i <= last / 0x10 && i < VRAM_TILE_COUNT; i++)
+		gb->display.tile_changed[i] = gb->display.frame;
 
-		/* The X coordinate to begin drawing the background at. */
-		uint8_t bg_x = disp_x + gb->gb_reg.SCX;
+	if(last < VRAM_BMAP_1)
+		return;
 
-		/* Get tile index for current background tile. */
-		uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
-		/* Y coordinate of tile pixel to draw. */
-		const uint8_t py = (bg_y & 0x07);
-		/* X coordinate of tile pixel to draw. */
-		uint8_t px = 7 - (bg_x & 0x07);
+	for(uint_fast16_t i = offset < VRAM_BMAP_1 ?
+			0 : (offset - VRAM_BMAP_1) / 0x20;
+			i <= (last - VRAM_BMAP_1) / 0x20 && i < VRAM_MAP_ROWS; i++)
+		gb->display.map_row_changed[i] = gb->display.frame;
+#endif
+}
+#endif
 
-		uint16_t tile;
+/**
+ * Internal function used to read bytes.
+ */
+uint8_t __gb_read(struct gb_s *gb, const uint_fast16_t addr)
+{
+	const uint8_t *page = gb->memory_map.read[addr >> 12];
 
-		/* Select addressing mode. */
-		if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+	if(page != NULL)
+		return page[addr & (MAP_PAGE_SIZE - 1)];
 
-		tile += 2 * py;
+	switch(addr >> 12)
+	{
+	case 0x0:
 
-		/* fetch first tile */
-		uint8_t t1 = gb->vram[tile] >> px;
-		uint8_t t2 = gb->vram[tile + 1] >> px;
+	/* TODO: BIOS support. */
+	case 0x1:
+	case 0x2:
+	case 0x3:
+		return gb->gb_rom_read(gb, addr);
 
-		for(; disp_x != 0xFF; disp_x--)
-		{
-			if(px == 8)
-			{
-				/* fetch next tile */
-				px = 0;
-				bg_x = disp_x + gb->gb_reg.SCX;
-				idx = gb->vram[bg_map + (bg_x >> 3)];
-
-				if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		return gb->gb_rom_read(gb,
+				       gb->rom_bank_offset + (addr - ROM_N_ADDR));
 
-			/* copy background */
-			uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixel = gb->display.bg_palette[c];
-			pixel |= LCD_PALETTE_BG;
-			pixels[disp_x] = pixel;
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
-		}
-	}
+	case 0x8:
+	case 0x9:
+		return gb->vram[addr - VRAM_ADDR];
 
-	/* draw window */
-	if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
-			&& gb->gb_reg.LY >= gb->display.WY
-			&& gb->gb_reg.WX <= 166)
-	{
-		/* Calculate Window Map Address. */
-		uint16_t win_line = (gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ?
-				    VRAM_BMAP_2 : VRAM_BMAP_1;
-		win_line += (gb->display.window_clear >> 3) * 0x20;
+	case 0xA:
+	case 0xB:
+		return gb->mbc_cart_ram_read(gb, addr);
 
-		uint8_t disp_x = LCD_WIDTH - 1;
-		uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
+	case 0xC:
+		return gb->wram[addr - WRAM_0_ADDR];
 
-		// look up tile
-		uint8_t py = gb->display.window_clear & 0x07;
-		uint8_t px = 7 - (win_x & 0x07);
-		uint8_t idx = gb->vram[win_line + (win_x >> 3)];
+	case 0xD:
+		return gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE];
 
-		uint16_t tile;
+	case 0xE:
+		return gb->wram[addr - ECHO_ADDR];
 
-		if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-			tile = VRAM_TILES_1 + idx * 0x10;
-		else
-			tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+	case 0xF:
+		/* I/O registers and HRAM. */
+		if(addr >= IO_ADDR)
+			return __gb_read_io(gb, addr & 0xFF);
 
-		tile += 2 * py;
+		if(addr < OAM_ADDR)
+			return gb->wram[addr - ECHO_ADDR];
 
-		// fetch first tile
-		uint8_t t1 = gb->vram[tile] >> px;
-		uint8_t t2 = gb->vram[tile + 1] >> px;
+		if(addr < UNUSED_ADDR)
+			return gb->oam[addr - OAM_ADDR];
 
-		// loop & copy window
-		uint8_t end = (gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7) - 1;
+		/* Unusable memory area. Reading from this area returns 0.*/
+		return 0xFF;
+	}
 
-		for(; disp_x != end; disp_x--)
-		{
-			if(px == 8)
-			{
-				// fetch next tile
-				px = 0;
-				win_x = disp_x - gb->gb_reg.WX + 7;
-				idx = gb->vram[win_line + (win_x >> 3)];
-
-				if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
-					tile = VRAM_TILES_1 + idx * 0x10;
-				else
-					tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
-
-				tile += 2 * py;
-				t1 = gb->vram[tile];
-				t2 = gb->vram[tile + 1];
-			}
+	(gb->gb_error)(gb, GB_INVALID_READ, addr);
+	return 0xFF;
+}
 
-			// copy window
-			uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-			pixel = gb->display.bg_palette[c];
-			pixel |= LCD_PALETTE_BG;
-			pixels[disp_x] = pixel;
-			t1 = t1 >> 1;
-			t2 = t2 >> 1;
-			px++;
-		}
+/**
+ * Internal function used to write bytes.
+ */
+void __gb_write(struct gb_s *gb, const uint_fast16_t addr, const uint8_t val)
+{
+	uint8_t *page = gb->memory_map.write[addr >> 12];
 
-		gb->display.window_clear++; // advance window line
+	if(page != NULL)
+	{
+		page[addr & (MAP_PAGE_SIZE - 1)] = val;
+		return;
 	}
 
-	// draw sprites
-	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(addr >= WRAM_0_ADDR && addr < OAM_ADDR)
 	{
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		uint8_t number_of_sprites = 0;
-		struct sprite_data sprites_to_render[NUM_SPRITES];
-
-		/* Record number of sprites on the line being rendered, limited
-		 * to the maximum number sprites that the Game Boy is able to
-		 * render on each line (10 sprites). */
-		for(uint8_t sprite_number = 0;
-				sprite_number < PEANUT_GB_ARRAYSIZE(sprites_to_render);
-				sprite_number++)
-		{
-			/* Sprite Y position. */
-			uint8_t OY = gb->oam[4 * sprite_number + 0];
-			/* Sprite X position. */
-			uint8_t OX = gb->oam[4 * sprite_number + 1];
-
-			/* If sprite isn't on this line, continue. */
-			if (gb->gb_reg.LY +
-				(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY
-					|| gb->gb_reg.LY + 16 < OY)
-				continue;
+		/* Echo RAM is WRAM, so both share the page numbers. */
+		const uint_fast8_t ram_page =
+			(addr & (WRAM_SIZE - 1)) / BLOCK_RAM_PAGE_SIZE;
 
+		if(gb->block_cache.wram_code & ((uint32_t)1 << ram_page))
+			__gb_block_invalidate_ram(gb, ram_page);
+	}
+#endif
 
-			sprites_to_render[number_of_sprites].sprite_number = sprite_number;
-			sprites_to_render[number_of_sprites].x = OX;
-			number_of_sprites++;
-		}
+	switch(addr >> 12)
+	{
+	case 0x0:
+	case 0x1:
+	case 0x2:
+	case 0x3:
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		gb->mbc_write(gb, addr, val);
+		return;
 
-		/* If maximum number of sprites reached, prioritise X
-		 * coordinate and object location in OAM. */
-		qsort(&sprites_to_render[0], number_of_sprites,
-				sizeof(sprites_to_render[0]), compare_sprites);
-		if(number_of_sprites > MAX_SPRITES_LINE)
-			number_of_sprites = MAX_SPRITES_LINE;
-#endif
+	case 0x8:
+	case 0x9:
+#if PEANUT_GB_TILE_CACHE
+		if(gb->vram[addr - VRAM_ADDR] == val)
+			return;
 
-		/* Render each sprite, from low priority to high priority. */
-#if PEANUT_GB_HIGH_LCD_ACCURACY
-		/* Render the top ten prioritised sprites on this scanline. */
-		for(uint8_t sprite_number = number_of_sprites - 1;
-				sprite_number != 0xFF;
-				sprite_number--)
-		{
-			uint8_t s = sprites_to_render[sprite_number].sprite_number;
+		gb->vram[addr - VRAM_ADDR] = val;
+		__gb_vram_written(gb, addr - VRAM_ADDR, 1);
 #else
-		for (uint8_t sprite_number = NUM_SPRITES - 1;
-			sprite_number != 0xFF;
-			sprite_number--)
-		{
-			uint8_t s = sprite_number;
+		gb->vram[addr - VRAM_ADDR] = val;
 #endif
-			/* Sprite Y position. */
-			uint8_t OY = gb->oam[4 * s + 0];
-			/* Sprite X position. */
-			uint8_t OX = gb->oam[4 * s + 1];
-			/* Sprite Tile/Pattern Number. */
-			uint8_t OT = gb->oam[4 * s + 2]
-				     & (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
-			/* Additional attributes. */
-			uint8_t OF = gb->oam[4 * s + 3];
+		return;
 
-#if !PEANUT_GB_HIGH_LCD_ACCURACY
-			/* If sprite isn't on this line, continue. */
-			if(gb->gb_reg.LY +
-					(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
-					gb->gb_reg.LY + 16 < OY)
-				continue;
-#endif
+	case 0xA:
+	case 0xB:
+		gb->mbc_cart_ram_write(gb, addr, val);
+		return;
 
-			/* Continue if sprite not visible. */
-			if(OX == 0 || OX >= 168)
-				continue;
+	case 0xC:
+		gb->wram[addr - WRAM_0_ADDR] = val;
+		return;
 
-			// y flip
-			uint8_t py = gb->gb_reg.LY - OY + 16;
+	case 0xD:
+		gb->wram[addr - WRAM_1_ADDR + WRAM_BANK_SIZE] = val;
+		return;
 
-			if(OF & OBJ_FLIP_Y)
-				py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
-
-			// fetch the tile
-			uint8_t t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
-			uint8_t t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
-
-			// handle x flip
-			uint8_t dir, start, end, shift;
+	case 0xE:
+		gb->wram[addr - ECHO_ADDR] = val;
+		return;
 
-			if(OF & OBJ_FLIP_X)
-			{
-				dir = 1;
-				start = (OX < 8 ? 0 : OX - 8);
-				end = MIN(OX, LCD_WIDTH);
-				shift = 8 - OX + start;
-			}
-			else
-			{
-				dir = -1;
-				start = MIN(OX, LCD_WIDTH) - 1;
-				end = (OX < 8 ? 0 : OX - 8) - 1;
-				shift = OX - (start + 1);
-			}
+	case 0xF:
+		/* I/O registers and HRAM. */
+		if(addr >= IO_ADDR)
+		{
+			__gb_write_io(gb, addr & 0xFF, val);
+			return;
+		}
 
-			// copy tile
-			t1 >>= shift;
-			t2 >>= shift;
+		if(addr < OAM_ADDR)
+		{
+			gb->wram[addr - ECHO_ADDR] = val;
+			return;
+		}
 
-			for(uint8_t disp_x = start; disp_x != end; disp_x += dir)
-			{
-				uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
-				// check transparency / sprite overlap / background overlap
-#if 0
-
-				if(c
-						//	&& OX <= fx[disp_x]
-						&& !((OF & OBJ_PRIORITY)
-						     && ((pixels[disp_x] & 0x3)
-							 && fx[disp_x] == 0xFE)))
-#else
-				if(c && !(OF & OBJ_PRIORITY
-						&& pixels[disp_x] & 0x3))
+		if(addr < UNUSED_ADDR)
+		{
+#if ENABLE_LCD
+			if(gb->oam[addr - OAM_ADDR] != val)
+				gb->display.oam_changed = 1;
 #endif
-				{
-					/* Set pixel colour. */
-					pixel = (OF & OBJ_PALETTE)
-							 ? gb->display.sp_palette[c + 4]
-							 : gb->display.sp_palette[c];
-					/* Set pixel palette (OBJ0 or OBJ1). */
-					pixel |= (OF & OBJ_PALETTE);
-					/* Deselect BG palette. */
-					pixel &= ~LCD_PALETTE_BG;
-					pixels[disp_x] = pixel;
-				}
-
-				t1 = t1 >> 1;
-				t2 = t2 >> 1;
-			}
+			gb->oam[addr - OAM_ADDR] = val;
+			return;
 		}
-	}
 
-	/* If LCD not initialised by front-end, don't render anything. */
-	if(memcmp(front_pixels, back_pixels, LCD_WIDTH) != 0) {
-		gb->display.changed_rows[gb->gb_reg.LY] = 1;
-		gb->display.changed_row_count++;
+		/* Unusable memory area. */
+		return;
 	}
+
+	(gb->gb_error)(gb, GB_INVALID_WRITE, addr);
 }
-#endif
 
-/**
- * Internal function used to step the CPU.
- */
-void __gb_step_cpu(struct gb_s *gb)
+uint8_t __gb_execute_cb(struct gb_s *gb, const uint8_t cbop)
 {
-	uint8_t opcode, inst_cycles;
-	static const uint8_t op_cycles[0x100] =
-	{
-		/* *INDENT-OFF* */
-		/*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F	*/
-		4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,	/* 0x00 */
-		4,12, 8, 8, 4, 4, 8, 4,12, 8, 8, 8, 4, 4, 8, 4,	/* 0x10 */
-		8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x20 */
-		8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x30 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x40 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x50 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x60 */
-		8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x70 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x80 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x90 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xA0 */
-		4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xB0 */
-		8,12,12,16,12,16, 8,16, 8,16,12, 8,12,24, 8,16,	/* 0xC0 */
-		8,12,12, 0,12,16, 8,16, 8,16,12, 0,12, 0, 8,16,	/* 0xD0 */
-		12,12,8, 0, 0,16, 8,16,16, 4,16, 0, 0, 0, 8,16,	/* 0xE0 */
-		12,12,8, 4, 0,16, 8,16,12, 8,16, 4, 0, 0, 8,16	/* 0xF0 */
-		/* *INDENT-ON* */
+	uint8_t inst_cycles;
+	uint8_t r = (cbop & 0x7);
+	uint8_t b = (cbop >> 3) & 0x7;
+	uint8_t val;
+	uint8_t writeback = 1;
+#if PEANUT_GB_THREADED_DISPATCH
+	/* Indexed by bits 7-3 of the CB opcode. */
+	static const void *const cb_table[0x20] =
+	{
+		&&cb_0x00, &&cb_0x01, &&cb_0x02, &&cb_0x03,
+		&&cb_0x04, &&cb_0x05, &&cb_0x06, &&cb_0x07,
+		&&cb_bit, &&cb_bit, &&cb_bit, &&cb_bit,
+		&&cb_bit, &&cb_bit, &&cb_bit, &&cb_bit,
+		&&cb_res, &&cb_res, &&cb_res, &&cb_res,
+		&&cb_res, &&cb_res, &&cb_res, &&cb_res,
+		&&cb_set, &&cb_set, &&cb_set, &&cb_set,
+		&&cb_set, &&cb_set, &&cb_set, &&cb_set
 	};
+#	define PGB_CB_OPCODE(op)	cb_##op:
+#	define PGB_CB_BIT		cb_bit:
+#	define PGB_CB_RES		cb_res:
+#	define PGB_CB_SET		cb_set:
+#	define PGB_CB_DONE		goto cb_done
+#else
+#	define PGB_CB_OPCODE(op)	case op:
+#	define PGB_CB_BIT		case 0x08: case 0x09: case 0x0A: case 0x0B: \
+					case 0x0C: case 0x0D: case 0x0E: case 0x0F:
+#	define PGB_CB_RES		case 0x10: case 0x11: case 0x12: case 0x13: \
+					case 0x14: case 0x15: case 0x16: case 0x17:
+#	define PGB_CB_SET		default:
+#	define PGB_CB_DONE		break
+#endif
 
-	/* Handle interrupts */
-	if((gb->gb_ime || gb->gb_halt) &&
-			(gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR))
+	inst_cycles = 8;
+	/* Add an additional 8 cycles to these sets of instructions. */
+	switch(cbop & 0xC7)
 	{
-		gb->gb_halt = 0;
-
-		if(gb->gb_ime)
-		{
-			/* Disable interrupts */
-			gb->gb_ime = 0;
-
-			/* Push Program Counter */
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-
-			/* Call interrupt handler if required. */
-			if(gb->gb_reg.IF & gb->gb_reg.IE & VBLANK_INTR)
-			{
-				gb->cpu_reg.pc = VBLANK_INTR_ADDR;
-				gb->gb_reg.IF ^= VBLANK_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & LCDC_INTR)
-			{
-				gb->cpu_reg.pc = LCDC_INTR_ADDR;
-				gb->gb_reg.IF ^= LCDC_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & TIMER_INTR)
-			{
-				gb->cpu_reg.pc = TIMER_INTR_ADDR;
-				gb->gb_reg.IF ^= TIMER_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & SERIAL_INTR)
-			{
-				gb->cpu_reg.pc = SERIAL_INTR_ADDR;
-				gb->gb_reg.IF ^= SERIAL_INTR;
-			}
-			else if(gb->gb_reg.IF & gb->gb_reg.IE & CONTROL_INTR)
-			{
-				gb->cpu_reg.pc = CONTROL_INTR_ADDR;
-				gb->gb_reg.IF ^= CONTROL_INTR;
-			}
-		}
+	case 0x06:
+	case 0x86:
+    	case 0xC6:
+		inst_cycles += 8;
+    	break;
+    	case 0x46:
+		inst_cycles += 4;
+    	break;
 	}
 
-	/* Obtain opcode */
-	opcode = (gb->gb_halt ? 0x00 : __gb_read(gb, gb->cpu_reg.pc++));
-	inst_cycles = op_cycles[opcode];
-
-	/* Execute opcode */
-	switch(opcode)
+	switch(r)
 	{
-	case 0x00: /* NOP */
+	case 0:
+		val = gb->cpu_reg.b;
 		break;
 
-	case 0x01: /* LD BC, imm */
-		gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.pc++);
+	case 1:
+		val = gb->cpu_reg.c;
 		break;
 
-	case 0x02: /* LD (BC), A */
-		__gb_write(gb, gb->cpu_reg.bc, gb->cpu_reg.a);
+	case 2:
+		val = gb->cpu_reg.d;
 		break;
 
-	case 0x03: /* INC BC */
-		gb->cpu_reg.bc++;
+	case 3:
+		val = gb->cpu_reg.e;
 		break;
 
-	case 0x04: /* INC B */
-		gb->cpu_reg.b++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.b == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.b & 0x0F) == 0x00);
+	case 4:
+		val = gb->cpu_reg.h;
 		break;
 
-	case 0x05: /* DEC B */
-		gb->cpu_reg.b--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.b == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.b & 0x0F) == 0x0F);
+	case 5:
+		val = gb->cpu_reg.l;
 		break;
 
-	case 0x06: /* LD B, imm */
-		gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.pc++);
+	case 6:
+		val = __gb_read(gb, gb->cpu_reg.hl);
 		break;
 
-	case 0x07: /* RLCA */
-		gb->cpu_reg.a = (gb->cpu_reg.a << 1) | (gb->cpu_reg.a >> 7);
-		gb->cpu_reg.f_bits.z = 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = (gb->cpu_reg.a & 0x01);
+	/* Only values 0-7 are possible here, so we make the final case
+	 * default to satisfy -Wmaybe-uninitialized warning. */
+	default:
+		val = gb->cpu_reg.a;
 		break;
+	}
 
-	case 0x08: /* LD (imm), SP */
+	/* Operation is selected by bits 7-3 of the CB opcode. */
+#if PEANUT_GB_THREADED_DISPATCH
+	goto *cb_table[cbop >> 3];
+#else
+	switch(cbop >> 3)
 	{
-		uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-		temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-		__gb_write(gb, temp++, gb->cpu_reg.sp & 0xFF);
-		__gb_write(gb, temp, gb->cpu_reg.sp >> 8);
-		break;
+#endif
+	PGB_CB_OPCODE(0x00) /* RLC R */
+	{
+		uint8_t temp = val;
+		val = (val << 1) | (temp >> 7);
+		gb->cpu_reg.f_bits.z = (val == 0x00);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = (temp >> 7);
+		PGB_CB_DONE;
 	}
 
-	case 0x09: /* ADD HL, BC */
+	PGB_CB_OPCODE(0x01) /* RRC R */
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.bc;
+		uint8_t temp = val;
+		val = (val >> 1) | (temp << 7);
+		gb->cpu_reg.f_bits.z = (val == 0x00);
 		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.bc) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
-		gb->cpu_reg.hl = (temp & 0x0000FFFF);
-		break;
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = (temp & 0x01);
+		PGB_CB_DONE;
 	}
 
-	case 0x0A: /* LD A, (BC) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.bc);
-		break;
+	PGB_CB_OPCODE(0x02) /* RL R */
+	{
+		uint8_t temp = val;
+		val = (val << 1) | gb->cpu_reg.f_bits.c;
+		gb->cpu_reg.f_bits.z = (val == 0x00);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = (temp >> 7);
+		PGB_CB_DONE;
+	}
 
-	case 0x0B: /* DEC BC */
-		gb->cpu_reg.bc--;
-		break;
+	PGB_CB_OPCODE(0x03) /* RR R */
+	{
+		uint8_t temp = val;
+		val = (val >> 1) | (gb->cpu_reg.f_bits.c << 7);
+		gb->cpu_reg.f_bits.z = (val == 0x00);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = (temp & 0x01);
+		PGB_CB_DONE;
+	}
 
-	case 0x0C: /* INC C */
-		gb->cpu_reg.c++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.c == 0x00);
+	PGB_CB_OPCODE(0x04) /* SLA R */
+		gb->cpu_reg.f_bits.c = (val >> 7);
+		val = val << 1;
+		gb->cpu_reg.f_bits.z = (val == 0x00);
 		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.c & 0x0F) == 0x00);
-		break;
+		gb->cpu_reg.f_bits.h = 0;
+		PGB_CB_DONE;
 
-	case 0x0D: /* DEC C */
-		gb->cpu_reg.c--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.c == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.c & 0x0F) == 0x0F);
-		break;
+	PGB_CB_OPCODE(0x05) /* SRA R */
+		gb->cpu_reg.f_bits.c = val & 0x01;
+		val = (val >> 1) | (val & 0x80);
+		gb->cpu_reg.f_bits.z = (val == 0x00);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 0;
+		PGB_CB_DONE;
 
-	case 0x0E: /* LD C, imm */
-		gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+	PGB_CB_OPCODE(0x06) /* SWAP R */
+		val = (val >> 4) | (val << 4);
+		gb->cpu_reg.f_bits.z = (val == 0x00);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = 0;
+		PGB_CB_DONE;
 
-	case 0x0F: /* RRCA */
-		gb->cpu_reg.f_bits.c = gb->cpu_reg.a & 0x01;
-		gb->cpu_reg.a = (gb->cpu_reg.a >> 1) | (gb->cpu_reg.a << 7);
-		gb->cpu_reg.f_bits.z = 0;
+	PGB_CB_OPCODE(0x07) /* SRL R */
+		gb->cpu_reg.f_bits.c = val & 0x01;
+		val = val >> 1;
+		gb->cpu_reg.f_bits.z = (val == 0x00);
 		gb->cpu_reg.f_bits.n = 0;
 		gb->cpu_reg.f_bits.h = 0;
-		break;
+		PGB_CB_DONE;
 
-	case 0x10: /* STOP */
-		//gb->gb_halt = 1;
-		break;
+	PGB_CB_BIT /* BIT B, R */
+		gb->cpu_reg.f_bits.z = !((val >> b) & 0x1);
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 1;
+		writeback = 0;
+		PGB_CB_DONE;
 
-	case 0x11: /* LD DE, imm */
-		gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+	PGB_CB_RES /* RES B, R */
+		val &= (0xFE << b) | (0xFF >> (8 - b));
+		PGB_CB_DONE;
 
-	case 0x12: /* LD (DE), A */
-		__gb_write(gb, gb->cpu_reg.de, gb->cpu_reg.a);
-		break;
+	PGB_CB_SET /* SET B, R */
+		val |= (0x1 << b);
+		PGB_CB_DONE;
+#if !PEANUT_GB_THREADED_DISPATCH
+	}
+#else
+cb_done:
+#endif
 
-	case 0x13: /* INC DE */
-		gb->cpu_reg.de++;
-		break;
+#undef PGB_CB_OPCODE
+#undef PGB_CB_BIT
+#undef PGB_CB_RES
+#undef PGB_CB_SET
+#undef PGB_CB_DONE
 
-	case 0x14: /* INC D */
-		gb->cpu_reg.d++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.d == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.d & 0x0F) == 0x00);
-		break;
+	if(writeback)
+	{
+		switch(r)
+		{
+		case 0:
+			gb->cpu_reg.b = val;
+			break;
 
-	case 0x15: /* DEC D */
-		gb->cpu_reg.d--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.d == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.d & 0x0F) == 0x0F);
-		break;
+		case 1:
+			gb->cpu_reg.c = val;
+			break;
 
-	case 0x16: /* LD D, imm */
-		gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+		case 2:
+			gb->cpu_reg.d = val;
+			break;
 
-	case 0x17: /* RLA */
-	{
-		uint8_t temp = gb->cpu_reg.a;
-		gb->cpu_reg.a = (gb->cpu_reg.a << 1) | gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = (temp >> 7) & 0x01;
-		break;
-	}
+		case 3:
+			gb->cpu_reg.e = val;
+			break;
 
-	case 0x18: /* JR imm */
-	{
-		int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.pc += temp;
-		break;
-	}
+		case 4:
+			gb->cpu_reg.h = val;
+			break;
 
-	case 0x19: /* ADD HL, DE */
-	{
-		uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.de;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(temp ^ gb->cpu_reg.hl ^ gb->cpu_reg.de) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
-		gb->cpu_reg.hl = (temp & 0x0000FFFF);
-		break;
-	}
+		case 5:
+			gb->cpu_reg.l = val;
+			break;
 
-	case 0x1A: /* LD A, (DE) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.de);
-		break;
+		case 6:
+			__gb_write(gb, gb->cpu_reg.hl, val);
+			break;
 
-	case 0x1B: /* DEC DE */
-		gb->cpu_reg.de--;
-		break;
+		case 7:
+			gb->cpu_reg.a = val;
+			break;
+		}
+	}
+	return inst_cycles;
+}
 
-	case 0x1C: /* INC E */
-		gb->cpu_reg.e++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.e == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.e & 0x0F) == 0x00);
-		break;
+#if ENABLE_LCD
+#if PEANUT_GB_LINE_SIGNATURES
+/**
+ * Internal function used to record that the sprites on the lines covered by a
+ * sprite at the given Y position and height have changed.
+ */
+void __gb_sprite_lines_changed(struct gb_s *gb, const uint8_t OY,
+		const uint8_t height)
+{
+	const int top = OY - 16;
 
-	case 0x1D: /* DEC E */
-		gb->cpu_reg.e--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.e == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.e & 0x0F) == 0x0F);
-		break;
+	for(int line = top < 0 ? 0 : top;
+			line < top + height && line < LCD_HEIGHT; line++)
+		gb->display.sprites_changed[line] = gb->display.frame;
+}
+#endif
 
-	case 0x1E: /* LD E, imm */
-		gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+/**
+ * Internal function used to find the sprites drawn on each line, limited to
+ * the maximum number of sprites that the Game Boy is able to render on each
+ * line (10 sprites).
+ */
+void __gb_find_line_sprites(struct gb_s *gb)
+{
+	const uint8_t height = gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 16 : 8;
 
-	case 0x1F: /* RRA */
+#if PEANUT_GB_LINE_SIGNATURES
+	/* The sprites have changed on the lines that a changed sprite was or
+	 * is now on. */
+	for(uint8_t s = 0; s < NUM_SPRITES; s++)
 	{
-		uint8_t temp = gb->cpu_reg.a;
-		gb->cpu_reg.a = gb->cpu_reg.a >> 1 | (gb->cpu_reg.f_bits.c << 7);
-		gb->cpu_reg.f_bits.z = 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = temp & 0x1;
-		break;
+		if(height == gb->display.line_sprite_height &&
+				memcmp(&gb->oam[4 * s],
+				       &gb->display.oam_found[4 * s], 4) == 0)
+			continue;
+
+		__gb_sprite_lines_changed(gb, gb->display.oam_found[4 * s],
+					  gb->display.line_sprite_height);
+		__gb_sprite_lines_changed(gb, gb->oam[4 * s], height);
 	}
 
-	case 0x20: /* JP NZ, imm */
-		if(!gb->cpu_reg.f_bits.z)
-		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-			gb->cpu_reg.pc += temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc++;
+	memcpy(gb->display.oam_found, gb->oam, OAM_SIZE);
+#endif
 
-		break;
+	memset(gb->display.line_sprite_count, 0,
+	       sizeof(gb->display.line_sprite_count));
 
-	case 0x21: /* LD HL, imm */
-		gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+	for(uint8_t s = 0; s < NUM_SPRITES; s++)
+	{
+		/* Sprite Y position, 16 lines above the screen. */
+		const int top = gb->oam[4 * s + 0] - 16;
+		/* Sprite X position. */
+		const uint8_t OX = gb->oam[4 * s + 1];
 
-	case 0x22: /* LDI (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
-		gb->cpu_reg.hl++;
-		break;
+		for(int line = top < 0 ? 0 : top;
+				line < top + height && line < LCD_HEIGHT; line++)
+		{
+			uint8_t *sprites = gb->display.line_sprites[line];
+			uint8_t count = gb->display.line_sprite_count[line];
+			uint8_t i = count;
 
-	case 0x23: /* INC HL */
-		gb->cpu_reg.hl++;
-		break;
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+			/* Prioritise X coordinate, then object location in
+			 * OAM, keeping the top ten. */
+			while(i > 0 && gb->oam[4 * sprites[i - 1] + 1] > OX)
+				i--;
+#else
+			(void)OX;
+#endif
 
-	case 0x24: /* INC H */
-		gb->cpu_reg.h++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.h == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.h & 0x0F) == 0x00);
-		break;
+			/* Otherwise only the first ten in OAM are drawn. */
+			if(i == MAX_SPRITES_LINE)
+				continue;
 
-	case 0x25: /* DEC H */
-		gb->cpu_reg.h--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.h == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.h & 0x0F) == 0x0F);
-		break;
+			if(count == MAX_SPRITES_LINE)
+				count--;
 
-	case 0x26: /* LD H, imm */
-		gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+			memmove(&sprites[i + 1], &sprites[i], count - i);
+			sprites[i] = s;
+			gb->display.line_sprite_count[line] = count + 1;
+		}
+	}
 
-	case 0x27: /* DAA */
-	{
-		uint16_t a = gb->cpu_reg.a;
+	gb->display.line_sprite_height = height;
+	gb->display.oam_changed = 0;
+}
 
-		if(gb->cpu_reg.f_bits.n)
+/* Tile rows of 2-bit colours in each byte mirrored, for sprites flipped
+ * horizontally. */
+static const uint8_t tile_row_flip[256] =
+{
+	0x00, 0x40, 0x80, 0xC0, 0x10, 0x50, 0x90, 0xD0, 0x20, 0x60, 0xA0, 0xE0, 0x30, 0x70, 0xB0, 0xF0,
+	0x04, 0x44, 0x84, 0xC4, 0x14, 0x54, 0x94, 0xD4, 0x24, 0x64, 0xA4, 0xE4, 0x34, 0x74, 0xB4, 0xF4,
+	0x08, 0x48, 0x88, 0xC8, 0x18, 0x58, 0x98, 0xD8, 0x28, 0x68, 0xA8, 0xE8, 0x38, 0x78, 0xB8, 0xF8,
+	0x0C, 0x4C, 0x8C, 0xCC, 0x1C, 0x5C, 0x9C, 0xDC, 0x2C, 0x6C, 0xAC, 0xEC, 0x3C, 0x7C, 0xBC, 0xFC,
+	0x01, 0x41, 0x81, 0xC1, 0x11, 0x51, 0x91, 0xD1, 0x21, 0x61, 0xA1, 0xE1, 0x31, 0x71, 0xB1, 0xF1,
+	0x05, 0x45, 0x85, 0xC5, 0x15, 0x55, 0x95, 0xD5, 0x25, 0x65, 0xA5, 0xE5, 0x35, 0x75, 0xB5, 0xF5,
+	0x09, 0x49, 0x89, 0xC9, 0x19, 0x59, 0x99, 0xD9, 0x29, 0x69, 0xA9, 0xE9, 0x39, 0x79, 0xB9, 0xF9,
+	0x0D, 0x4D, 0x8D, 0xCD, 0x1D, 0x5D, 0x9D, 0xDD, 0x2D, 0x6D, 0xAD, 0xED, 0x3D, 0x7D, 0xBD, 0xFD,
+	0x02, 0x42, 0x82, 0xC2, 0x12, 0x52, 0x92, 0xD2, 0x22, 0x62, 0xA2, 0xE2, 0x32, 0x72, 0xB2, 0xF2,
+	0x06, 0x46, 0x86, 0xC6, 0x16, 0x56, 0x96, 0xD6, 0x26, 0x66, 0xA6, 0xE6, 0x36, 0x76, 0xB6, 0xF6,
+	0x0A, 0x4A, 0x8A, 0xCA, 0x1A, 0x5A, 0x9A, 0xDA, 0x2A, 0x6A, 0xAA, 0xEA, 0x3A, 0x7A, 0xBA, 0xFA,
+	0x0E, 0x4E, 0x8E, 0xCE, 0x1E, 0x5E, 0x9E, 0xDE, 0x2E, 0x6E, 0xAE, 0xEE, 0x3E, 0x7E, 0xBE, 0xFE,
+	0x03, 0x43, 0x83, 0xC3, 0x13, 0x53, 0x93, 0xD3, 0x23, 0x63, 0xA3, 0xE3, 0x33, 0x73, 0xB3, 0xF3,
+	0x07, 0x47, 0x87, 0xC7, 0x17, 0x57, 0x97, 0xD7, 0x27, 0x67, 0xA7, 0xE7, 0x37, 0x77, 0xB7, 0xF7,
+	0x0B, 0x4B, 0x8B, 0xCB, 0x1B, 0x5B, 0x9B, 0xDB, 0x2B, 0x6B, 0xAB, 0xEB, 0x3B, 0x7B, 0xBB, 0xFB,
+	0x0F, 0x4F, 0x8F, 0xCF, 0x1F, 0x5F, 0x9F, 0xDF, 0x2F, 0x6F, 0xAF, 0xEF, 0x3F, 0x7F, 0xBF, 0xFF
+};
+
+/**
+ * Internal function used to fetch the row of tile data at the given offset in
+ * VRAM as 2-bit colours, with the leftmost pixel in the top two bits.
+ */
+uint_fast16_t __gb_tile_row(const struct gb_s *gb, const uint_fast16_t tile)
+{
+#if PEANUT_GB_TILE_CACHE
+	return gb->display.tile_rows[tile / 2];
+#else
+	return __gb_decode_tile_row(gb->vram[tile], gb->vram[tile + 1]);
+#endif
+}
+
+/**
+ * Internal function used to find the offset in VRAM of the background or
+ * window tile with the given index.
+ */
+uint_fast16_t __gb_bg_tile(const struct gb_s *gb, const uint8_t idx)
+{
+	if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+		return VRAM_TILES_1 + idx * 0x10;
+
+	return VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+}
+
+/**
+ * Internal function used to write the eight pixels of a tile row to dst,
+ * looking up four at a time in a pixel table.
+ */
+void __gb_draw_tile_row(uint8_t *dst, const uint32_t table[256],
+		const uint_fast16_t row)
+{
+	const uint32_t left = table[row >> 8];
+	const uint32_t right = table[row & 0xFF];
+
+	memcpy(dst, &left, sizeof(left));
+	memcpy(dst + 4, &right, sizeof(right));
+}
+
+/**
+ * Internal function used to draw four sprite pixels from the pixel table over
+ * four framebuffer pixels. Transparent pixels are skipped, as are all pixels
+ * over a background colour other than 0 if behind_bg is set.
+ */
+uint32_t __gb_merge_sprite_pixels(const uint32_t dst, const uint32_t sprite,
+		const uint_fast8_t behind_bg)
+{
+	/* Each byte of the mask is 0xFF where the sprite is drawn. */
+	uint32_t mask = ((sprite >> 7) & 0x01010101) * 0xFF;
+
+	if(behind_bg)
+	{
+		const uint32_t colour = dst & 0x03030303;
+		mask &= ~(((colour | (colour >> 1)) & 0x01010101) * 0xFF);
+	}
+
+	return (dst & ~mask) | (sprite & mask & ~(LCD_PIXEL_OPAQUE * 0x01010101u));
+}
+
+#if PEANUT_GB_FRAMEBUFFER
+/**
+ * Internal function used to mark the current line as changed if it differs
+ * between the framebuffers, and pass it to the front-end.
+ */
+void __gb_compare_line(struct gb_s *gb)
+{
+	const uint8_t *front_pixels = gb->display.front_fb[gb->gb_reg.LY];
+	const uint8_t *back_pixels = gb->display.back_fb[gb->gb_reg.LY];
+
+	/* If LCD not initialised by front-end, don't render anything. */
+	if(memcmp(front_pixels, back_pixels, LCD_WIDTH) != 0) {
+		gb->display.changed_rows[gb->gb_reg.LY] = 1;
+		gb->display.changed_row_count++;
+
+		if(gb->display.lcd_line_changed != NULL)
+			gb->display.lcd_line_changed(gb, gb->gb_reg.LY);
+	}
+}
+#endif
+
+#if PEANUT_GB_LINE_SIGNATURES
+/**
+ * Internal function used to fill in the signature of the current line.
+ */
+void __gb_line_signature(const struct gb_s *gb,
+		struct gb_line_signature_s *signature)
+{
+	const uint8_t window = gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
+			&& gb->gb_reg.LY >= gb->display.WY
+			&& gb->gb_reg.WX <= 166;
+
+	signature->frame = gb->display.frame;
+	signature->LCDC = gb->gb_reg.LCDC;
+	signature->SCX = gb->gb_reg.SCX;
+	signature->SCY = gb->gb_reg.SCY;
+	signature->WX = window ? gb->gb_reg.WX : 0xFF;
+	signature->window_line = window ? gb->display.window_clear : 0;
+	signature->BGP = gb->gb_reg.BGP;
+	signature->OBP0 = gb->gb_reg.OBP0;
+	signature->OBP1 = gb->gb_reg.OBP1;
+
+#if PEANUT_GB_FRAMEBUFFER
+	/* Lines without the background keep what was drawn in the framebuffer
+	 * before, so are always drawn again. */
+	if((gb->gb_reg.LCDC & LCDC_BG_ENABLE) == 0)
+		signature->frame = 0;
+#endif
+}
+
+/**
+ * Internal function used to check whether the current line, with the given
+ * signature, would be drawn the same as the line drawn with another.
+ */
+uint_fast8_t __gb_line_unchanged(const struct gb_s *gb,
+		const struct gb_line_signature_s *signature,
+		const struct gb_line_signature_s *drawn)
+{
+	const uint32_t frame = drawn->frame;
+
+	if(frame == 0 || signature->frame == 0 ||
+			signature->LCDC != drawn->LCDC ||
+			signature->SCX != drawn->SCX ||
+			signature->SCY != drawn->SCY ||
+			signature->WX != drawn->WX ||
+			signature->window_line != drawn->window_line ||
+			signature->BGP != drawn->BGP ||
+			signature->OBP0 != drawn->OBP0 ||
+			signature->OBP1 != drawn->OBP1)
+		return 0;
+
+	/* Anything changed in the frame the line was drawn in may have changed
+	 * after it was drawn. */
+	if(signature->LCDC & LCDC_BG_ENABLE)
+	{
+		const uint8_t bg_y = gb->gb_reg.LY + signature->SCY;
+		const uint16_t bg_map =
+			((signature->LCDC & LCDC_BG_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1)
+			+ (bg_y >> 3) * 0x20;
+
+		if(gb->display.map_row_changed[(bg_map - VRAM_BMAP_1) / 0x20]
+				>= frame)
+			return 0;
+
+		for(uint_fast8_t i = 0; i < (LCD_WIDTH + 8) / 8; i++)
 		{
-			if(gb->cpu_reg.f_bits.h)
-				a = (a - 0x06) & 0xFF;
+			const uint8_t idx = gb->vram[bg_map +
+				(((signature->SCX >> 3) + i) & 0x1F)];
 
-			if(gb->cpu_reg.f_bits.c)
-				a -= 0x60;
+			if(gb->display.tile_changed[__gb_bg_tile(gb, idx) / 0x10]
+					>= frame)
+				return 0;
 		}
-		else
+	}
+
+	if(signature->WX != 0xFF)
+	{
+		const uint16_t win_line =
+			((signature->LCDC & LCDC_WINDOW_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1)
+			+ (signature->window_line >> 3) * 0x20;
+		const uint8_t start = signature->WX < 7 ? 0 : signature->WX - 7;
+		const uint8_t skip = start + 7 - signature->WX;
+
+		if(gb->display.map_row_changed[(win_line - VRAM_BMAP_1) / 0x20]
+				>= frame)
+			return 0;
+
+		for(uint_fast8_t i = 0; i * 8 < skip + LCD_WIDTH - start; i++)
 		{
-			if(gb->cpu_reg.f_bits.h || (a & 0x0F) > 9)
-				a += 0x06;
+			const uint8_t idx = gb->vram[win_line + i];
 
-			if(gb->cpu_reg.f_bits.c || a > 0x9F)
-				a += 0x60;
+			if(gb->display.tile_changed[__gb_bg_tile(gb, idx) / 0x10]
+					>= frame)
+				return 0;
 		}
+	}
 
-		if((a & 0x100) == 0x100)
-			gb->cpu_reg.f_bits.c = 1;
+	if(signature->LCDC & LCDC_OBJ_ENABLE)
+	{
+		const uint8_t *sprites = gb->display.line_sprites[gb->gb_reg.LY];
 
-		gb->cpu_reg.a = a;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0);
-		gb->cpu_reg.f_bits.h = 0;
+		if(gb->display.sprites_changed[gb->gb_reg.LY] >= frame)
+			return 0;
 
-		break;
+		for(uint8_t i = 0; i < gb->display.line_sprite_count[gb->gb_reg.LY];
+				i++)
+		{
+			const uint8_t OT = gb->oam[4 * sprites[i] + 2];
+
+			if(signature->LCDC & LCDC_OBJ_SIZE ?
+					gb->display.tile_changed[OT & 0xFE] >= frame ||
+					gb->display.tile_changed[OT | 0x01] >= frame :
+					gb->display.tile_changed[OT] >= frame)
+				return 0;
+		}
 	}
 
-	case 0x28: /* JP Z, imm */
-		if(gb->cpu_reg.f_bits.z)
+	return 1;
+}
+#endif
+
+void __gb_draw_line(struct gb_s *gb)
+{
+	if(gb->direct.frame_skip && !gb->display.frame_skip_count)
+		return;
+
+	/* If interlaced mode is activated, check if we need to draw the current
+	 * line. */
+	if(gb->direct.interlace)
+	{
+		if((gb->display.interlace_count == 0
+				&& (gb->gb_reg.LY & 1) == 0)
+				|| (gb->display.interlace_count == 1
+				    && (gb->gb_reg.LY & 1) == 1))
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-			gb->cpu_reg.pc += temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc++;
+			/* Compensate for missing window draw if required. */
+			if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
+					&& gb->gb_reg.LY >= gb->display.WY
+					&& gb->gb_reg.WX <= 166)
+				gb->display.window_clear++;
 
-		break;
+			return;
+		}
+	}
+	
+#if PEANUT_GB_FRAMEBUFFER
+	uint8_t* front_pixels = &gb->display.front_fb[gb->gb_reg.LY][0];
+	uint8_t* back_pixels = &gb->display.back_fb[gb->gb_reg.LY][0];
+	uint8_t* pixels = gb->display.back_fb_enabled ? back_pixels : front_pixels;
+#else
+	/* Only passed to the front-end, which keeps the previous frame. */
+	uint8_t pixels[LCD_WIDTH];
+#endif
 
-	case 0x29: /* ADD HL, HL */
+	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE &&
+			(gb->display.oam_changed || gb->display.line_sprite_height !=
+			 (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 16 : 8)))
+		__gb_find_line_sprites(gb);
+
+#if PEANUT_GB_LINE_SIGNATURES
+	/* The line as last drawn into the buffer drawn to, and in the previous
+	 * frame drawn. */
+#	if PEANUT_GB_FRAMEBUFFER
+	struct gb_line_signature_s *drawn = &gb->display.signatures
+		[gb->display.back_fb_enabled][gb->gb_reg.LY];
+	const struct gb_line_signature_s *previous = &gb->display.signatures
+		[!gb->display.back_fb_enabled][gb->gb_reg.LY];
+#	else
+	struct gb_line_signature_s *drawn =
+		&gb->display.signatures[0][gb->gb_reg.LY];
+	const struct gb_line_signature_s *previous = drawn;
+#	endif
+	struct gb_line_signature_s signature;
+
+	__gb_line_signature(gb, &signature);
+
+	if(__gb_line_unchanged(gb, &signature, previous))
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.hl;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = (temp & 0x1000) ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFFFF0000) ? 1 : 0;
-		gb->cpu_reg.hl = (temp & 0x0000FFFF);
-		break;
+#	if PEANUT_GB_FRAMEBUFFER
+		/* Copy the line drawn in the previous frame, unless this
+		 * buffer already holds the same. */
+		if(!__gb_line_unchanged(gb, &signature, drawn))
+			memcpy(pixels, gb->display.back_fb_enabled ?
+			       front_pixels : back_pixels, LCD_WIDTH);
+#	endif
+
+		/* Advance the window line as drawing it would have. */
+		if(signature.WX != 0xFF)
+			gb->display.window_clear++;
+
+		*drawn = signature;
+		gb->display.lines_skipped++;
+		return;
 	}
 
-	case 0x2A: /* LD A, (HL+) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl++);
-		break;
+#	if PEANUT_GB_FRAMEBUFFER
+	/* With interlacing, the line was last drawn into this buffer. */
+	if(__gb_line_unchanged(gb, &signature, drawn))
+	{
+		if(signature.WX != 0xFF)
+			gb->display.window_clear++;
 
-	case 0x2B: /* DEC HL */
-		gb->cpu_reg.hl--;
-		break;
+		*drawn = signature;
+		gb->display.lines_skipped++;
+		__gb_compare_line(gb);
+		return;
+	}
+#	endif
 
-	case 0x2C: /* INC L */
-		gb->cpu_reg.l++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.l == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.l & 0x0F) == 0x00);
-		break;
+	*drawn = signature;
+	gb->display.lines_drawn++;
+#endif
 
-	case 0x2D: /* DEC L */
-		gb->cpu_reg.l--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.l == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.l & 0x0F) == 0x0F);
-		break;
+	/* Whole tiles covering a line, before it is scrolled into place. */
+	uint8_t tiles[LCD_WIDTH + 8];
 
-	case 0x2E: /* LD L, imm */
-		gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+	/* If background is enabled, draw it. */
+	if(gb->gb_reg.LCDC & LCDC_BG_ENABLE)
+	{
+		/* Calculate current background line to draw. Constant because
+		 * this function draws only this one line each time it is
+		 * called. */
+		const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
 
-	case 0x2F: /* CPL */
-		gb->cpu_reg.a = ~gb->cpu_reg.a;
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = 1;
-		break;
+		/* Get selected background map address for first tile
+		 * corresponding to current line.
+		 * 0x20 (32) is the width of a background tile, and the bit
+		 * shift is to calculate the address. */
+		const uint16_t bg_map =
+			((gb->gb_reg.LCDC & LCDC_BG_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1)
+			+ (bg_y >> 3) * 0x20;
+
+		/* Y coordinate of tile pixel to draw. */
+		const uint8_t py = (bg_y & 0x07);
 
-	case 0x30: /* JP NC, imm */
-		if(!gb->cpu_reg.f_bits.c)
+		/* Draw the tile the first pixel is in and the 20 after it,
+		 * wrapping around the background map. */
+		for(uint_fast8_t i = 0; i < sizeof(tiles) / 8; i++)
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-			gb->cpu_reg.pc += temp;
-			inst_cycles += 4;
+			const uint8_t idx = gb->vram[bg_map +
+				(((gb->gb_reg.SCX >> 3) + i) & 0x1F)];
+
+			__gb_draw_tile_row(&tiles[i * 8], gb->display.bg_pixels,
+				__gb_tile_row(gb, __gb_bg_tile(gb, idx) + 2 * py));
 		}
-		else
-			gb->cpu_reg.pc++;
 
-		break;
+		memcpy(pixels, &tiles[gb->gb_reg.SCX & 0x07], LCD_WIDTH);
+	}
+#if !PEANUT_GB_FRAMEBUFFER
+	else
+		memset(pixels, 0, LCD_WIDTH);
+#endif
 
-	case 0x31: /* LD SP, imm */
-		gb->cpu_reg.sp = __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.sp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-		break;
+	/* draw window */
+	if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
+			&& gb->gb_reg.LY >= gb->display.WY
+			&& gb->gb_reg.WX <= 166)
+	{
+		/* Calculate Window Map Address. */
+		uint16_t win_line = (gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ?
+				    VRAM_BMAP_2 : VRAM_BMAP_1;
+		win_line += (gb->display.window_clear >> 3) * 0x20;
 
-	case 0x32: /* LD (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
-		gb->cpu_reg.hl--;
-		break;
+		// first screen column, and window columns left of the screen
+		const uint8_t start = gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7;
+		const uint8_t skip = start + 7 - gb->gb_reg.WX;
+		const uint8_t py = gb->display.window_clear & 0x07;
 
-	case 0x33: /* INC SP */
-		gb->cpu_reg.sp++;
-		break;
+		// draw the tiles the visible columns are in
+		for(uint_fast8_t i = 0; i * 8 < skip + LCD_WIDTH - start; i++)
+		{
+			const uint8_t idx = gb->vram[win_line + i];
+
+			__gb_draw_tile_row(&tiles[i * 8], gb->display.bg_pixels,
+				__gb_tile_row(gb, __gb_bg_tile(gb, idx) + 2 * py));
+		}
+
+		memcpy(&pixels[start], &tiles[skip], LCD_WIDTH - start);
+
+		gb->display.window_clear++; // advance window line
+	}
 
-	case 0x34: /* INC (HL) */
+	// draw sprites
+	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
 	{
-		uint8_t temp = __gb_read(gb, gb->cpu_reg.hl) + 1;
-		gb->cpu_reg.f_bits.z = (temp == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((temp & 0x0F) == 0x00);
-		__gb_write(gb, gb->cpu_reg.hl, temp);
-		break;
+		const uint8_t *sprites = gb->display.line_sprites[gb->gb_reg.LY];
+
+		/* Render each sprite, from low priority to high priority. */
+		for(uint8_t i = gb->display.line_sprite_count[gb->gb_reg.LY] - 1;
+				i != 0xFF; i--)
+		{
+			uint8_t s = sprites[i];
+			/* Sprite Y position. */
+			uint8_t OY = gb->oam[4 * s + 0];
+			/* Sprite X position. */
+			uint8_t OX = gb->oam[4 * s + 1];
+			/* Sprite Tile/Pattern Number. */
+			uint8_t OT = gb->oam[4 * s + 2]
+				     & (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
+			/* Additional attributes. */
+			uint8_t OF = gb->oam[4 * s + 3];
+
+			/* Continue if sprite not visible. */
+			if(OX == 0 || OX >= 168)
+				continue;
+
+			// y flip
+			uint8_t py = gb->gb_reg.LY - OY + 16;
+
+			if(OF & OBJ_FLIP_Y)
+				py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
+
+			// fetch the tile
+			uint_fast16_t row =
+				__gb_tile_row(gb, VRAM_TILES_1 + OT * 0x10 + 2 * py);
+
+			// handle x flip
+			if(OF & OBJ_FLIP_X)
+				row = tile_row_flip[row & 0xFF] << 8 |
+				      tile_row_flip[row >> 8];
+
+			// columns on screen, and sprite columns left of the screen
+			const uint8_t start = (OX < 8 ? 0 : OX - 8);
+			const uint8_t end = MIN(OX, LCD_WIDTH);
+			const uint8_t skip = start + 8 - OX;
+			uint8_t sprite[8], under[8];
+			uint32_t sprite_half, under_half;
+
+			__gb_draw_tile_row(sprite, gb->display.sp_pixels[
+					(OF & OBJ_PALETTE) ? 1 : 0], row);
+
+			// check transparency / background overlap
+			if(end - start < 8)
+				memset(under, 0, sizeof(under));
+
+			memcpy(&under[skip], &pixels[start], end - start);
+
+			for(uint_fast8_t i = 0; i < 8; i += 4)
+			{
+				memcpy(&sprite_half, &sprite[i], sizeof(sprite_half));
+				memcpy(&under_half, &under[i], sizeof(under_half));
+				under_half = __gb_merge_sprite_pixels(under_half,
+						sprite_half, OF & OBJ_PRIORITY);
+				memcpy(&under[i], &under_half, sizeof(under_half));
+			}
+
+			memcpy(&pixels[start], &under[skip], end - start);
+		}
 	}
 
-	case 0x35: /* DEC (HL) */
+#if PEANUT_GB_FRAMEBUFFER
+	__gb_compare_line(gb);
+#else
+	if(gb->display.lcd_draw_line != NULL)
+		gb->display.lcd_draw_line(gb, pixels, gb->gb_reg.LY);
+#endif
+}
+#endif
+
+/**
+ * Internal function used to end a frame while the LCD is off. No lines are
+ * drawn, and the screen is blanked on the first frame that would have been
+ * drawn after the LCD was switched off.
+ */
+void __gb_lcd_off_frame(struct gb_s *gb)
+{
+	gb->gb_frame = 1;
+
+#if PEANUT_GB_LINE_SIGNATURES
+	gb->display.frame++;
+#endif
+
+#if ENABLE_LCD
+	if(gb->direct.frame_skip)
+		gb->display.frame_skip_count = !gb->display.frame_skip_count;
+
+	if(gb->display.lcd_off_blanked ||
+			(gb->direct.frame_skip && gb->display.frame_skip_count))
+		return;
+
+	/* Blank both buffers, so that whichever the front-end draws from is
+	 * blank, and the first frame drawn once the LCD is switched back on is
+	 * compared against a blank screen. Without them, pass blank lines to
+	 * the front-end instead. */
+	for(uint_fast8_t line = 0; line < LCD_HEIGHT; line++)
 	{
-		uint8_t temp = __gb_read(gb, gb->cpu_reg.hl) - 1;
-		gb->cpu_reg.f_bits.z = (temp == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((temp & 0x0F) == 0x0F);
-		__gb_write(gb, gb->cpu_reg.hl, temp);
-		break;
+		uint8_t blank[LCD_WIDTH] = {0};
+
+#if PEANUT_GB_FRAMEBUFFER
+		if(memcmp(gb->display.front_fb[line], blank, LCD_WIDTH) == 0 &&
+				memcmp(gb->display.back_fb[line], blank, LCD_WIDTH) == 0)
+			continue;
+
+		memset(gb->display.front_fb[line], 0, LCD_WIDTH);
+		memset(gb->display.back_fb[line], 0, LCD_WIDTH);
+		gb->display.changed_rows[line] = 1;
+		gb->display.changed_row_count++;
+
+		if(gb->display.lcd_line_changed != NULL)
+			gb->display.lcd_line_changed(gb, line);
+#else
+		if(gb->display.lcd_draw_line != NULL)
+			gb->display.lcd_draw_line(gb, blank, line);
+#endif
 	}
 
-	case 0x36: /* LD (HL), imm */
-		__gb_write(gb, gb->cpu_reg.hl, __gb_read(gb, gb->cpu_reg.pc++));
-		break;
+#if PEANUT_GB_LINE_SIGNATURES
+	memset(gb->display.signatures, 0, sizeof(gb->display.signatures));
+#endif
+	gb->display.lcd_off_blanked = 1;
+#endif
+}
 
-	case 0x37: /* SCF */
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 1;
-		break;
+/**
+ * Internal function used to advance the timers, serial and the LCD by the
+ * cycles executed since they were last updated, processing any events that
+ * are due.
+ */
+void __gb_process_events(struct gb_s *gb, const uint_fast32_t cycles)
+{
+	/* DIV register timing */
+	gb->counter.div_count += cycles;
+	gb->gb_reg.DIV += gb->counter.div_count / DIV_CYCLES;
+	gb->counter.div_count %= DIV_CYCLES;
+
+	/* Check serial transmission. */
+	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
+	{
+		/* If new transfer, call TX function. */
+		if(gb->counter.serial_count == 0 && gb->gb_serial_tx != NULL)
+			(gb->gb_serial_tx)(gb, gb->gb_reg.SB);
 
-	case 0x38: /* JP C, imm */
-		if(gb->cpu_reg.f_bits.c)
+		gb->counter.serial_count += cycles;
+
+		/* If it's time to receive byte, call RX function. */
+		if(gb->counter.serial_count >= SERIAL_CYCLES)
 		{
-			int8_t temp = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-			gb->cpu_reg.pc += temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc++;
+			/* If RX can be done, do it. */
+			/* If RX failed, do not change SB if using external
+			 * clock, or set to 0xFF if using internal clock. */
+			uint8_t rx;
 
-		break;
+			if(gb->gb_serial_rx != NULL &&
+				(gb->gb_serial_rx(gb, &rx) ==
+					 GB_SERIAL_RX_SUCCESS))
+			{
+				gb->gb_reg.SB = rx;
 
-	case 0x39: /* ADD HL, SP */
+				/* Inform game of serial TX/RX completion. */
+				gb->gb_reg.SC &= 0x01;
+				__gb_request_intr(gb, SERIAL_INTR);
+			}
+			else if(gb->gb_reg.SC & SERIAL_SC_CLOCK_SRC)
+			{
+				/* If using internal clock, and console is not
+				 * attached to any external peripheral, shifted
+				 * bits are replaced with logic 1. */
+				gb->gb_reg.SB = 0xFF;
+
+				/* Inform game of serial TX/RX completion. */
+				gb->gb_reg.SC &= 0x01;
+				__gb_request_intr(gb, SERIAL_INTR);
+			}
+			else
+			{
+				/* If using external clock, and console is not
+				 * attached to any external peripheral, bits are
+				 * not shifted, so SB is not modified. */
+			}
+
+			gb->counter.serial_count = 0;
+		}
+	}
+
+	/* TIMA register timing */
+	/* TODO: Change tac_enable to struct of TAC timer control bits. */
+	if(gb->gb_reg.tac_enable)
 	{
-		uint_fast32_t temp = gb->cpu_reg.hl + gb->cpu_reg.sp;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			((gb->cpu_reg.hl & 0xFFF) + (gb->cpu_reg.sp & 0xFFF)) & 0x1000 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = temp & 0x10000 ? 1 : 0;
-		gb->cpu_reg.hl = (uint16_t)temp;
-		break;
+		gb->counter.tima_count += cycles;
+
+		while(gb->counter.tima_count >= TAC_CYCLES[gb->gb_reg.tac_rate])
+		{
+			gb->counter.tima_count -= TAC_CYCLES[gb->gb_reg.tac_rate];
+
+			if(++gb->gb_reg.TIMA == 0)
+			{
+				__gb_request_intr(gb, TIMER_INTR);
+				/* On overflow, set TMA to TIMA. */
+				gb->gb_reg.TIMA = gb->gb_reg.TMA;
+			}
+		}
 	}
 
-	case 0x3A: /* LD A, (HL) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl--);
-		break;
+	/* TODO Check behaviour of LCD during LCD power off state. */
+	/* If LCD is off, don't update LCD state, but still end a frame every
+	 * LCD_FRAME_CYCLES so that gb_run_frame() returns. */
+	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
+	{
+		gb->counter.lcd_count += cycles;
 
-	case 0x3B: /* DEC SP */
-		gb->cpu_reg.sp--;
-		break;
+		if(gb->counter.lcd_count >= LCD_FRAME_CYCLES)
+		{
+			gb->counter.lcd_count -= LCD_FRAME_CYCLES;
+			__gb_lcd_off_frame(gb);
+		}
 
-	case 0x3C: /* INC A */
-		gb->cpu_reg.a++;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a & 0x0F) == 0x00);
-		break;
+		return;
+	}
 
-	case 0x3D: /* DEC A */
-		gb->cpu_reg.a--;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a & 0x0F) == 0x0F);
-		break;
+	/* LCD Timing */
+	gb->counter.lcd_count += cycles;
 
-	case 0x3E: /* LD A, imm */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.pc++);
-		break;
+	/* New Scanline */
+	if(gb->counter.lcd_count > LCD_LINE_CYCLES)
+	{
+		gb->counter.lcd_count -= LCD_LINE_CYCLES;
 
-	case 0x3F: /* CCF */
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = ~gb->cpu_reg.f_bits.c;
-		break;
+		/* LYC Update */
+		if(gb->gb_reg.LY == gb->gb_reg.LYC)
+		{
+			gb->gb_reg.STAT |= STAT_LYC_COINC;
 
-	case 0x40: /* LD B, B */
-		break;
+			if(gb->gb_reg.STAT & STAT_LYC_INTR)
+				__gb_request_intr(gb, LCDC_INTR);
+		}
+		else
+			gb->gb_reg.STAT &= 0xFB;
 
-	case 0x41: /* LD B, C */
-		gb->cpu_reg.b = gb->cpu_reg.c;
-		break;
+		/* Next line */
+		gb->gb_reg.LY = (gb->gb_reg.LY + 1) % LCD_VERT_LINES;
 
-	case 0x42: /* LD B, D */
-		gb->cpu_reg.b = gb->cpu_reg.d;
-		break;
+		/* VBLANK Start */
+		if(gb->gb_reg.LY == LCD_HEIGHT)
+		{
+			gb->lcd_mode = LCD_VBLANK;
+			gb->gb_frame = 1;
+			__gb_request_intr(gb, VBLANK_INTR);
+			gb->lcd_blank = 0;
 
-	case 0x43: /* LD B, E */
-		gb->cpu_reg.b = gb->cpu_reg.e;
-		break;
+			if(gb->gb_reg.STAT & STAT_MODE_1_INTR)
+				__gb_request_intr(gb, LCDC_INTR);
 
-	case 0x44: /* LD B, H */
-		gb->cpu_reg.b = gb->cpu_reg.h;
-		break;
+#if ENABLE_LCD
+#if PEANUT_GB_LINE_SIGNATURES
+			gb->display.frame++;
+#endif
 
-	case 0x45: /* LD B, L */
-		gb->cpu_reg.b = gb->cpu_reg.l;
-		break;
+			/* If frame skip is activated, check if we need to draw
+			 * the frame or skip it. */
+			if(gb->direct.frame_skip)
+			{
+				gb->display.frame_skip_count =
+					!gb->display.frame_skip_count;
+			}
 
-	case 0x46: /* LD B, (HL) */
-		gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+			/* If interlaced is activated, change which lines get
+			 * updated. Also, only update lines on frames that are
+			 * actually drawn when frame skip is enabled. */
+			if(gb->direct.interlace &&
+					(!gb->direct.frame_skip ||
+					 gb->display.frame_skip_count))
+			{
+				gb->display.interlace_count =
+					!gb->display.interlace_count;
+			}
+			
+			if(!gb->direct.frame_skip ||
+				 !gb->display.frame_skip_count)
+			{
+					gb->display.back_fb_enabled =
+							!gb->display.back_fb_enabled;
+			}
 
-	case 0x47: /* LD B, A */
-		gb->cpu_reg.b = gb->cpu_reg.a;
-		break;
+#endif
+		}
+		/* Normal Line */
+		else if(gb->gb_reg.LY < LCD_HEIGHT)
+		{
+			if(gb->gb_reg.LY == 0)
+			{
+				/* Clear Screen */
+				gb->display.WY = gb->gb_reg.WY;
+				gb->display.window_clear = 0;
+			}
 
-	case 0x48: /* LD C, B */
-		gb->cpu_reg.c = gb->cpu_reg.b;
-		break;
+			gb->lcd_mode = LCD_HBLANK;
 
-	case 0x49: /* LD C, C */
-		break;
+			if(gb->gb_reg.STAT & STAT_MODE_0_INTR)
+				__gb_request_intr(gb, LCDC_INTR);
+		}
+	}
+	/* OAM access */
+	else if(gb->lcd_mode == LCD_HBLANK
+			&& gb->counter.lcd_count >= LCD_MODE_2_CYCLES)
+	{
+		gb->lcd_mode = LCD_SEARCH_OAM;
+
+		if(gb->gb_reg.STAT & STAT_MODE_2_INTR)
+			__gb_request_intr(gb, LCDC_INTR);
+	}
+	/* Update LCD */
+	else if(gb->lcd_mode == LCD_SEARCH_OAM
+			&& gb->counter.lcd_count >= LCD_MODE_3_CYCLES)
+	{
+		gb->lcd_mode = LCD_TRANSFER;
+#if ENABLE_LCD
+		if(!gb->lcd_blank)
+			__gb_draw_line(gb);
+#endif
+	}
+}
+
+/**
+ * Internal function used to skip ahead while the CPU is halted.
+ * Adds as many NOP steps as possible up to, but not including, the step in
+ * which the next event happens. The event step itself is executed normally, so
+ * this is identical to executing the skipped steps one at a time.
+ */
+void __gb_halt_skip(struct gb_s *gb)
+{
+	/* Cycles taken by each halted step, the same as a NOP. */
+	const uint_fast32_t step_cycles = 4;
+	const uint_fast32_t steps = (gb->counter.event_cycles -
+				     gb->counter.cycles - 1) / step_cycles;
 
-	case 0x4A: /* LD C, D */
-		gb->cpu_reg.c = gb->cpu_reg.d;
-		break;
+	gb->counter.cycles += steps * step_cycles;
+}
 
-	case 0x4B: /* LD C, E */
-		gb->cpu_reg.c = gb->cpu_reg.e;
-		break;
+#if PEANUT_GB_IDLE_LOOP_SKIP
+/**
+ * Internal function used to skip iterations of a loop polling LY, STAT or IF.
+ * Called after fetching a LD A, (0xFF00+imm) or LD A, (imm) opcode, with the PC
+ * pointing past the opcode. Detects
+ * loops of the form
+ *
+ *	loop:	LD A, (LY|STAT|IF)
+ *		CP imm | AND imm
+ *		JR NZ|Z|NC|C, loop
+ *
+ * and, if the branch would be taken, skips every iteration that completes
+ * before the next event could change the polled register. Each of those
+ * iterations leaves A and F as computed here, so only their cycles have to be
+ * added. The loop head is then executed normally. Returns nonzero if
+ * iterations were skipped, in which case A and F are set in gb->cpu_reg.
+ */
+uint_fast8_t __gb_idle_loop_skip(struct gb_s *gb, const uint8_t opcode,
+		const uint16_t opcode_pc)
+{
+	uint16_t pc = opcode_pc;
+	uint16_t addr;
+	uint8_t op, imm, branch, val, a;
+	uint_fast8_t z, c, taken;
+	uint_fast32_t loop_cycles, iterations;
 
-	case 0x4C: /* LD C, H */
-		gb->cpu_reg.c = gb->cpu_reg.h;
-		break;
+	if(opcode == 0xF0)
+	{
+		addr = 0xFF00 | __gb_read(gb, pc++);
+		loop_cycles = 12;
+	}
+	else
+	{
+		addr = __gb_read(gb, pc++);
+		addr |= __gb_read(gb, pc++) << 8;
+		loop_cycles = 16;
+	}
 
-	case 0x4D: /* LD C, L */
-		gb->cpu_reg.c = gb->cpu_reg.l;
-		break;
+	if(addr != 0xFF44 && addr != 0xFF41 && addr != 0xFF0F)
+		return 0;
 
-	case 0x4E: /* LD C, (HL) */
-		gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+	op = __gb_read(gb, pc++);
 
-	case 0x4F: /* LD C, A */
-		gb->cpu_reg.c = gb->cpu_reg.a;
-		break;
+	if(op != 0xFE && op != 0xE6)
+		return 0;
 
-	case 0x50: /* LD D, B */
-		gb->cpu_reg.d = gb->cpu_reg.b;
-		break;
+	imm = __gb_read(gb, pc++);
+	branch = __gb_read(gb, pc++);
 
-	case 0x51: /* LD D, C */
-		gb->cpu_reg.d = gb->cpu_reg.c;
-		break;
+	/* The branch must jump back to the loop head. */
+	if((branch & 0xE7) != 0x20 ||
+			(uint16_t)(pc + 1 + (int8_t) __gb_read(gb, pc)) !=
+			(uint16_t)(opcode_pc - 1))
+		return 0;
 
-	case 0x52: /* LD D, D */
-		break;
+	/* CP or AND imm, and a taken JR. */
+	loop_cycles += 8 + 12;
 
-	case 0x53: /* LD D, E */
-		gb->cpu_reg.d = gb->cpu_reg.e;
-		break;
+	val = __gb_read(gb, addr);
 
-	case 0x54: /* LD D, H */
-		gb->cpu_reg.d = gb->cpu_reg.h;
-		break;
+	if(op == 0xFE)
+	{
+		uint16_t temp_16 = val - imm;
+		a = val;
+		z = ((temp_16 & 0xFF) == 0x00);
+		c = (temp_16 & 0xFF00) ? 1 : 0;
+	}
+	else
+	{
+		a = val & imm;
+		z = (a == 0x00);
+		c = 0;
+	}
 
-	case 0x55: /* LD D, L */
-		gb->cpu_reg.d = gb->cpu_reg.l;
-		break;
+	switch(branch)
+	{
+	case 0x20: taken = !z; break;
+	case 0x28: taken = z; break;
+	case 0x30: taken = !c; break;
+	default:   taken = c; break;
+	}
 
-	case 0x56: /* LD D, (HL) */
-		gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+	if(!taken)
+		return 0;
 
-	case 0x57: /* LD D, A */
-		gb->cpu_reg.d = gb->cpu_reg.a;
-		break;
+	iterations = (gb->counter.event_cycles - gb->counter.cycles - 1) /
+		     loop_cycles;
 
-	case 0x58: /* LD E, B */
-		gb->cpu_reg.e = gb->cpu_reg.b;
-		break;
+	if(iterations == 0)
+		return 0;
 
-	case 0x59: /* LD E, C */
-		gb->cpu_reg.e = gb->cpu_reg.c;
-		break;
+	gb->cpu_reg.a = a;
+	gb->cpu_reg.f_bits.z = z;
+	gb->cpu_reg.f_bits.c = c;
 
-	case 0x5A: /* LD E, D */
-		gb->cpu_reg.e = gb->cpu_reg.d;
-		break;
+	if(op == 0xFE)
+	{
+		uint16_t temp_16 = val - imm;
+		gb->cpu_reg.f_bits.n = 1;
+		gb->cpu_reg.f_bits.h = ((val ^ imm ^ temp_16) & 0x10) ? 1 : 0;
+	}
+	else
+	{
+		gb->cpu_reg.f_bits.n = 0;
+		gb->cpu_reg.f_bits.h = 1;
+	}
 
-	case 0x5B: /* LD E, E */
-		break;
+	gb->counter.cycles += iterations * loop_cycles;
+	gb->idle_stats.frame_cycles += iterations * loop_cycles;
+	gb->idle_stats.total_cycles += iterations * loop_cycles;
+	return 1;
+}
+#endif
 
-	case 0x5C: /* LD E, H */
-		gb->cpu_reg.e = gb->cpu_reg.h;
-		break;
+#if PEANUT_GB_BULK_LOOPS
+/* Where a copy or fill loop reads from and writes to. */
+#define BULK_HL_INC	0
+#define BULK_HL_DEC	1
+#define BULK_DE_INC	2
+#define BULK_REG_A	3
+#define BULK_REG_D	4
+#define BULK_REG_E	5
+
+/* Register counting the iterations of a copy or fill loop. */
+#define BULK_COUNT_B	0
+#define BULK_COUNT_C	1
+#define BULK_COUNT_BC	2
+
+/* Copy or fill loop, ending with a JR NZ back to its first instruction. */
+struct gb_bulk_loop_s
+{
+	/* Instructions before the JR NZ. */
+	uint8_t code[6];
+	uint8_t length;
+	/* Clock cycles of each iteration that jumps back. */
+	uint8_t cycles;
+	uint8_t src;
+	uint8_t dst;
+	uint8_t count;
+};
 
-	case 0x5D: /* LD E, L */
-		gb->cpu_reg.e = gb->cpu_reg.l;
-		break;
+static const struct gb_bulk_loop_s bulk_loops[] =
+{
+	/* LD A, (HL+); LD (DE), A; INC DE; DEC B|C */
+	{ { 0x2A, 0x12, 0x13, 0x05 }, 4, 40, BULK_HL_INC, BULK_DE_INC, BULK_COUNT_B },
+	{ { 0x2A, 0x12, 0x13, 0x0D }, 4, 40, BULK_HL_INC, BULK_DE_INC, BULK_COUNT_C },
+	/* LD A, (DE); LD (HL+), A; INC DE; DEC B|C */
+	{ { 0x1A, 0x22, 0x13, 0x05 }, 4, 40, BULK_DE_INC, BULK_HL_INC, BULK_COUNT_B },
+	{ { 0x1A, 0x22, 0x13, 0x0D }, 4, 40, BULK_DE_INC, BULK_HL_INC, BULK_COUNT_C },
+	/* LD A, (HL+); LD (DE), A; INC DE; DEC BC; LD A, B; OR C */
+	{ { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1 }, 6, 52, BULK_HL_INC, BULK_DE_INC, BULK_COUNT_BC },
+	/* LD A, (DE); LD (HL+), A; INC DE; DEC BC; LD A, B; OR C */
+	{ { 0x1A, 0x22, 0x13, 0x0B, 0x78, 0xB1 }, 6, 52, BULK_DE_INC, BULK_HL_INC, BULK_COUNT_BC },
+	/* LD (HL+)|(HL-), A; DEC B|C */
+	{ { 0x22, 0x05 }, 2, 24, BULK_REG_A, BULK_HL_INC, BULK_COUNT_B },
+	{ { 0x22, 0x0D }, 2, 24, BULK_REG_A, BULK_HL_INC, BULK_COUNT_C },
+	{ { 0x32, 0x05 }, 2, 24, BULK_REG_A, BULK_HL_DEC, BULK_COUNT_B },
+	{ { 0x32, 0x0D }, 2, 24, BULK_REG_A, BULK_HL_DEC, BULK_COUNT_C },
+	/* LD A, D|E; LD (HL+), A; DEC BC; LD A, B; OR C */
+	{ { 0x7A, 0x22, 0x0B, 0x78, 0xB1 }, 5, 40, BULK_REG_D, BULK_HL_INC, BULK_COUNT_BC },
+	{ { 0x7B, 0x22, 0x0B, 0x78, 0xB1 }, 5, 40, BULK_REG_E, BULK_HL_INC, BULK_COUNT_BC },
+};
 
-	case 0x5E: /* LD E, (HL) */
-		gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+/**
+ * Internal function used to find the copy or fill loop starting with the
+ * opcode just fetched, with the PC pointing past the opcode. Returns NULL if
+ * the code at the PC is not one of the loops in bulk_loops.
+ */
+const struct gb_bulk_loop_s *__gb_bulk_loop_find(struct gb_s *gb,
+		const uint8_t opcode, const uint16_t pc)
+{
+	const uint8_t next = __gb_read(gb, pc);
 
-	case 0x5F: /* LD E, A */
-		gb->cpu_reg.e = gb->cpu_reg.a;
-		break;
+	for(uint_fast8_t i = 0; i < PEANUT_GB_ARRAYSIZE(bulk_loops); i++)
+	{
+		const struct gb_bulk_loop_s *loop = &bulk_loops[i];
+		uint_fast8_t j;
 
-	case 0x60: /* LD H, B */
-		gb->cpu_reg.h = gb->cpu_reg.b;
-		break;
+		if(loop->code[0] != opcode || loop->code[1] != next)
+			continue;
 
-	case 0x61: /* LD H, C */
-		gb->cpu_reg.h = gb->cpu_reg.c;
-		break;
+		for(j = 2; j < loop->length; j++)
+		{
+			if(__gb_read(gb, pc + j - 1) != loop->code[j])
+				break;
+		}
 
-	case 0x62: /* LD H, D */
-		gb->cpu_reg.h = gb->cpu_reg.d;
-		break;
+		/* JR NZ back to the first instruction. */
+		if(j == loop->length &&
+				__gb_read(gb, pc + j - 1) == 0x20 &&
+				__gb_read(gb, pc + j) == (uint8_t) -(j + 2))
+			return loop;
+	}
 
-	case 0x63: /* LD H, E */
-		gb->cpu_reg.h = gb->cpu_reg.e;
-		break;
+	return NULL;
+}
 
-	case 0x64: /* LD H, H */
-		break;
+/**
+ * Internal function used to find the host memory behind addr that a copy or
+ * fill loop may access without side effects: ROM, VRAM, cart RAM and WRAM
+ * where mapped for direct access, and OAM. VRAM is also written directly when
+ * it is left to the slow path for the tile cache. Returns NULL if accesses must
+ * go through __gb_read() or __gb_write(), otherwise sets *avail to the number
+ * of bytes that may be accessed from addr upwards, or downwards if down is set.
+ * Memory mapped for reads is only read through the returned pointer.
+ */
+uint8_t *__gb_bulk_memory(struct gb_s *gb, const uint16_t addr,
+		const uint_fast8_t write, const uint_fast8_t down,
+		uint_fast16_t *avail)
+{
+	uint8_t *page = write ? gb->memory_map.write[addr >> 12] :
+			(uint8_t *) gb->memory_map.read[addr >> 12];
 
-	case 0x65: /* LD H, L */
-		gb->cpu_reg.h = gb->cpu_reg.l;
-		break;
+	if(page != NULL)
+	{
+		const uint_fast16_t offset = addr & (MAP_PAGE_SIZE - 1);
+		*avail = down ? offset + 1 : MAP_PAGE_SIZE - offset;
+		return page + offset;
+	}
 
-	case 0x66: /* LD H, (HL) */
-		gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+	if(addr >= OAM_ADDR && addr < UNUSED_ADDR)
+	{
+		*avail = down ? addr - OAM_ADDR + 1 : UNUSED_ADDR - addr;
+		return gb->oam + (addr - OAM_ADDR);
+	}
 
-	case 0x67: /* LD H, A */
-		gb->cpu_reg.h = gb->cpu_reg.a;
-		break;
+#if PEANUT_GB_TILE_CACHE
+	/* The tile cache is updated after the loop writes VRAM. */
+	if(addr >= VRAM_ADDR && addr < CART_RAM_ADDR)
+	{
+		*avail = down ? addr - VRAM_ADDR + 1 : CART_RAM_ADDR - addr;
+		return gb->vram + (addr - VRAM_ADDR);
+	}
+#endif
 
-	case 0x68: /* LD L, B */
-		gb->cpu_reg.l = gb->cpu_reg.b;
-		break;
+	return NULL;
+}
 
-	case 0x69: /* LD L, C */
-		gb->cpu_reg.l = gb->cpu_reg.c;
-		break;
+/**
+ * Internal function used to check whether a copy or fill loop starting with
+ * the opcode just fetched could be run at once, given where HL and DE point.
+ * This is checked before looking for the loop, as copies from ROM are common
+ * but cannot be run at once without direct memory access.
+ */
+uint_fast8_t __gb_bulk_loop_possible(struct gb_s *gb, const uint8_t opcode)
+{
+	uint_fast16_t avail;
 
-	case 0x6A: /* LD L, D */
-		gb->cpu_reg.l = gb->cpu_reg.d;
-		break;
+	switch(opcode)
+	{
+	case 0x1A:
+		return __gb_bulk_memory(gb, gb->cpu_reg.de, 0, 0, &avail) != NULL &&
+		       __gb_bulk_memory(gb, gb->cpu_reg.hl, 1, 0, &avail) != NULL;
 
-	case 0x6B: /* LD L, E */
-		gb->cpu_reg.l = gb->cpu_reg.e;
-		break;
+	case 0x2A:
+		return __gb_bulk_memory(gb, gb->cpu_reg.hl, 0, 0, &avail) != NULL &&
+		       __gb_bulk_memory(gb, gb->cpu_reg.de, 1, 0, &avail) != NULL;
 
-	case 0x6C: /* LD L, H */
-		gb->cpu_reg.l = gb->cpu_reg.h;
-		break;
+	case 0x22:
+	case 0x32:
+	case 0x7A:
+	case 0x7B:
+		return __gb_bulk_memory(gb, gb->cpu_reg.hl, 1, 0, &avail) != NULL;
 
-	case 0x6D: /* LD L, L */
-		break;
+	default:
+		return 0;
+	}
+}
 
-	case 0x6E: /* LD L, (HL) */
-		gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+/**
+ * Internal function used to run the iterations of a copy or fill loop that
+ * jump back to its first instruction, with the PC pointing past its first
+ * opcode. Iterations are run at once while they complete before the next
+ * event, and access only memory without side effects outside of the loop
+ * itself. The registers, flags and cycles are left as if they had been
+ * executed one instruction at a time, and the loop head is then executed
+ * normally. Returns the number of iterations run.
+ */
+uint_fast32_t __gb_bulk_loop_run(struct gb_s *gb,
+		const struct gb_bulk_loop_s *loop)
+{
+	const uint16_t head = gb->cpu_reg.pc - 1;
+	const uint16_t dst_addr = loop->dst == BULK_DE_INC ?
+				  gb->cpu_reg.de : gb->cpu_reg.hl;
+	const uint_fast8_t down = (loop->dst == BULK_HL_DEC);
+	uint_fast32_t iterations;
+	uint_fast16_t avail;
+	uint8_t *dst;
+	uint8_t val;
 
-	case 0x6F: /* LD L, A */
-		gb->cpu_reg.l = gb->cpu_reg.a;
+	/* The last iteration does not jump back, so is left to the
+	 * interpreter. A count of zero wraps around. */
+	switch(loop->count)
+	{
+	case BULK_COUNT_B:
+		iterations = (uint8_t)(gb->cpu_reg.b - 1);
 		break;
 
-	case 0x70: /* LD (HL), B */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.b);
+	case BULK_COUNT_C:
+		iterations = (uint8_t)(gb->cpu_reg.c - 1);
 		break;
 
-	case 0x71: /* LD (HL), C */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.c);
+	default:
+		iterations = (uint16_t)(gb->cpu_reg.bc - 1);
 		break;
+	}
 
-	case 0x72: /* LD (HL), D */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.d);
-		break;
+	iterations = MIN(iterations,
+			 (gb->counter.event_cycles - gb->counter.cycles - 1) /
+			 loop->cycles);
 
-	case 0x73: /* LD (HL), E */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.e);
-		break;
+	dst = __gb_bulk_memory(gb, dst_addr, 1, down, &avail);
 
-	case 0x74: /* LD (HL), H */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.h);
-		break;
+	if(dst == NULL)
+		return 0;
 
-	case 0x75: /* LD (HL), L */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.l);
-		break;
+	iterations = MIN(iterations, avail);
 
-	case 0x76: /* HALT */
-		/* TODO: Emulate HALT bug? */
-		gb->gb_halt = 1;
-		break;
+	/* Writes to the loop itself would change the following
+	 * iterations. */
+	if(iterations > 0)
+	{
+		const uint16_t lo = down ? dst_addr - (iterations - 1) : dst_addr;
+		const uint16_t hi = lo + (iterations - 1);
 
-	case 0x77: /* LD (HL), A */
-		__gb_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
-		break;
+		if(lo <= (uint16_t)(head + loop->length + 1) && head <= hi)
+			return 0;
+	}
 
-	case 0x78: /* LD A, B */
-		gb->cpu_reg.a = gb->cpu_reg.b;
-		break;
+	if(loop->src == BULK_HL_INC || loop->src == BULK_DE_INC)
+	{
+		const uint16_t src_addr = loop->src == BULK_DE_INC ?
+					  gb->cpu_reg.de : gb->cpu_reg.hl;
+		const uint8_t *src = __gb_bulk_memory(gb, src_addr, 0, 0, &avail);
 
-	case 0x79: /* LD A, C */
-		gb->cpu_reg.a = gb->cpu_reg.c;
-		break;
+		if(src == NULL)
+			return 0;
 
-	case 0x7A: /* LD A, D */
-		gb->cpu_reg.a = gb->cpu_reg.d;
-		break;
+		iterations = MIN(iterations, avail);
 
-	case 0x7B: /* LD A, E */
-		gb->cpu_reg.a = gb->cpu_reg.e;
-		break;
+		if(iterations == 0)
+			return 0;
 
-	case 0x7C: /* LD A, H */
-		gb->cpu_reg.a = gb->cpu_reg.h;
-		break;
+		/* Overlapping copies repeat bytes like the loop does. */
+		if(dst < src + iterations && src < dst + iterations)
+		{
+			for(uint_fast32_t i = 0; i < iterations; i++)
+				dst[i] = src[i];
+		}
+		else
+			memcpy(dst, src, iterations);
 
-	case 0x7D: /* LD A, L */
-		gb->cpu_reg.a = gb->cpu_reg.l;
-		break;
+		val = src[iterations - 1];
 
-	case 0x7E: /* LD A, (HL) */
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl);
-		break;
+		if(loop->src == BULK_DE_INC)
+			gb->cpu_reg.de += iterations;
+		else
+			gb->cpu_reg.hl += iterations;
+	}
+	else
+	{
+		if(iterations == 0)
+			return 0;
 
-	case 0x7F: /* LD A, A */
-		break;
+		if(loop->src == BULK_REG_D)
+			val = gb->cpu_reg.d;
+		else if(loop->src == BULK_REG_E)
+			val = gb->cpu_reg.e;
+		else
+			val = gb->cpu_reg.a;
 
-	case 0x80: /* ADD A, B */
-	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		memset(down ? dst - (iterations - 1) : dst, val, iterations);
 	}
 
-	case 0x81: /* ADD A, C */
+#if PEANUT_GB_TILE_CACHE
+	if(dst_addr >= VRAM_ADDR && dst_addr < CART_RAM_ADDR)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		__gb_vram_written(gb, (down ? dst_addr - (iterations - 1) :
+				       dst_addr) - VRAM_ADDR, iterations);
 	}
+#endif
+#if ENABLE_LCD
+	if(dst_addr >= OAM_ADDR)
+		gb->display.oam_changed = 1;
+#endif
 
-	case 0x82: /* ADD A, D */
-	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
-	}
+	if(loop->dst == BULK_DE_INC)
+		gb->cpu_reg.de += iterations;
+	else if(down)
+		gb->cpu_reg.hl -= iterations;
+	else
+		gb->cpu_reg.hl += iterations;
 
-	case 0x83: /* ADD A, E */
+	/* A and the flags as left by the last DEC, or LD A, B; OR C. */
+	switch(loop->count)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
+	case BULK_COUNT_B:
+	case BULK_COUNT_C:
+	{
+		const uint8_t count = loop->count == BULK_COUNT_B ?
+				      (gb->cpu_reg.b -= iterations) :
+				      (gb->cpu_reg.c -= iterations);
+		gb->cpu_reg.a = val;
+		gb->cpu_reg.f_bits.z = 0;
+		gb->cpu_reg.f_bits.n = 1;
+		gb->cpu_reg.f_bits.h = ((count & 0x0F) == 0x0F);
 		break;
 	}
 
-	case 0x84: /* ADD A, H */
-	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
+	default:
+		gb->cpu_reg.bc -= iterations;
+		gb->cpu_reg.a = gb->cpu_reg.b | gb->cpu_reg.c;
+		gb->cpu_reg.f_bits.z = 0;
 		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
+		gb->cpu_reg.f_bits.h = 0;
+		gb->cpu_reg.f_bits.c = 0;
 		break;
 	}
 
-	case 0x85: /* ADD A, L */
+	gb->counter.cycles += iterations * loop->cycles;
+	gb->bulk_stats.frame_iterations += iterations;
+	gb->bulk_stats.total_iterations += iterations;
+	return iterations;
+}
+#endif
+
+/* Clock cycles of each opcode, not including the extra cycles of taken
+ * conditional branches or CB-prefixed instructions. */
+static const uint8_t op_cycles[0x100] =
+{
+	/* *INDENT-OFF* */
+	/*0 1 2  3  4  5  6  7  8  9  A  B  C  D  E  F	*/
+	4,12, 8, 8, 4, 4, 8, 4,20, 8, 8, 8, 4, 4, 8, 4,	/* 0x00 */
+	4,12, 8, 8, 4, 4, 8, 4,12, 8, 8, 8, 4, 4, 8, 4,	/* 0x10 */
+	8,12, 8, 8, 4, 4, 8, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x20 */
+	8,12, 8, 8,12,12,12, 4, 8, 8, 8, 8, 4, 4, 8, 4,	/* 0x30 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x40 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x50 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x60 */
+	8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x70 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x80 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0x90 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xA0 */
+	4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,	/* 0xB0 */
+	8,12,12,16,12,16, 8,16, 8,16,12, 8,12,24, 8,16,	/* 0xC0 */
+	8,12,12, 0,12,16, 8,16, 8,16,12, 0,12, 0, 8,16,	/* 0xD0 */
+	12,12,8, 0, 0,16, 8,16,16, 4,16, 0, 0, 0, 8,16,	/* 0xE0 */
+	12,12,8, 4, 0,16, 8,16,12, 8,16, 4, 0, 0, 8,16	/* 0xF0 */
+	/* *INDENT-ON* */
+};
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+/* Length of each opcode in bytes, or 0 for invalid opcodes, and whether it
+ * ends a block. STOP is one byte long, as it is executed as such. */
+#define BLOCK_END	0x80
+#define B(length)	(BLOCK_END | (length))
+static const uint8_t op_info[0x100] =
+{
+	/* *INDENT-OFF* */
+	/*  0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F	*/
+	   1,   3,   1,   1,   1,   1,   2,   1,   3,   1,   1,   1,   1,   1,   2,   1,	/* 0x00 */
+	B(1),   3,   1,   1,   1,   1,   2,   1,B(2),   1,   1,   1,   1,   1,   2,   1,	/* 0x10 */
+	B(2),   3,   1,   1,   1,   1,   2,   1,B(2),   1,   1,   1,   1,   1,   2,   1,	/* 0x20 */
+	B(2),   3,   1,   1,   1,   1,   2,   1,B(2),   1,   1,   1,   1,   1,   2,   1,	/* 0x30 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x40 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x50 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x60 */
+	   1,   1,   1,   1,   1,   1,B(1),   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x70 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x80 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0x90 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0xA0 */
+	   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,	/* 0xB0 */
+	B(1),   1,B(3),B(3),B(3),   1,   2,B(1),B(1),B(1),B(3),   2,B(3),B(3),   2,B(1),	/* 0xC0 */
+	B(1),   1,B(3),   0,B(3),   1,   2,B(1),B(1),B(1),B(3),   0,B(3),   0,   2,B(1),	/* 0xD0 */
+	   2,   1,   1,   0,   0,   1,   2,B(1),   2,B(1),   3,   0,   0,   0,   2,B(1),	/* 0xE0 */
+	   2,   1,   1,   1,   0,   1,   2,B(1),   2,   1,   3,   1,   0,   0,   2,B(1) 	/* 0xF0 */
+	/* *INDENT-ON* */
+};
+#undef B
+
+/**
+ * Internal function used to find the decoded block of instructions starting
+ * at pc, decoding it into the cache if required. Returns NULL if code at pc
+ * cannot be cached.
+ */
+struct gb_block_s *__gb_block_lookup(struct gb_s *gb, const uint_fast16_t pc)
+{
+	uint_fast32_t end, addr, bank = 0;
+	uint_fast32_t tag;
+	struct gb_block_s *block;
+	uint_fast8_t count = 0;
+	uint_fast8_t ram_page = 0;
+
+	if(pc < ROM_N_ADDR)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		tag = 0;
+		end = ROM_N_ADDR;
 	}
-
-	case 0x86: /* ADD A, (HL) */
+	else if(pc < VRAM_ADDR)
 	{
-		uint8_t hl = __gb_read(gb, gb->cpu_reg.hl);
-		uint16_t temp = gb->cpu_reg.a + hl;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ hl ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		tag = bank = gb->rom_bank_offset / ROM_BANK_SIZE;
+		end = VRAM_ADDR;
 	}
-
-	case 0x87: /* ADD A, A */
+	else if(pc >= WRAM_0_ADDR && pc < ECHO_ADDR)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.a;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = temp & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		ram_page = (pc - WRAM_0_ADDR) / BLOCK_RAM_PAGE_SIZE;
+		tag = BLOCK_TAG_RAM | gb->block_cache.page_generation[ram_page];
+		end = (pc | (BLOCK_RAM_PAGE_SIZE - 1)) + 1;
 	}
-
-	case 0x88: /* ADC A, B */
+	else if(pc >= HRAM_ADDR && pc < INTR_EN_ADDR)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.b + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		ram_page = BLOCK_HRAM_PAGE;
+		tag = BLOCK_TAG_RAM | gb->block_cache.page_generation[ram_page];
+		end = INTR_EN_ADDR;
 	}
+	else
+		return NULL;
+
+	block = &gb->block_cache.blocks[(pc ^ (bank << 6)) &
+					  (PEANUT_GB_BLOCK_CACHE_SIZE - 1)];
 
-	case 0x89: /* ADC A, C */
+	if(block->count != 0 && block->addr == pc && block->tag == tag)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.c + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		gb->block_cache.hits++;
+
+		if(block->runs != 0xFFFF)
+			block->runs++;
+
+		return block;
 	}
 
-	case 0x8A: /* ADC A, D */
+	gb->block_cache.misses++;
+
+	/* Decode up to and including the next branch. */
+	for(addr = pc; count < BLOCK_MAX_OPS;)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.d + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		struct gb_block_op_s *op = &block->ops[count];
+		const uint8_t opcode = __gb_read(gb, addr);
+		const uint_fast8_t length = op_info[opcode] & ~BLOCK_END;
+
+		if(length == 0 || addr + length > end)
+			break;
+
+		op->opcode = opcode;
+		op->length = length;
+
+		for(uint_fast8_t i = 1; i < length; i++)
+			op->imm[i - 1] = __gb_read(gb, addr + i);
+
+		addr += length;
+		count++;
+
+		if(op_info[opcode] & BLOCK_END)
+			break;
 	}
 
-	case 0x8B: /* ADC A, E */
+	block->count = count;
+	block->runs = 1;
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	block->heat = 0;
+	block->rec_count = 0;
+#endif
+
+	if(count == 0)
+		return NULL;
+
+	block->addr = pc;
+	block->tag = tag;
+
+	/* Writes to its page of WRAM or HRAM must now invalidate the block. */
+	if(pc >= HRAM_ADDR)
+		gb->block_cache.hram_code = 1;
+	else if(pc >= WRAM_0_ADDR &&
+			!(gb->block_cache.wram_code & ((uint32_t)1 << ram_page)))
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.e + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		gb->block_cache.wram_code |= (uint32_t)1 << ram_page;
+		__gb_map_wram_writes(gb);
 	}
 
-	case 0x8C: /* ADC A, H */
+	return block;
+}
+
+/**
+ * Internal function used to fetch the next decoded instruction at pc.
+ * Returns NULL if the instruction must be read from memory instead.
+ */
+const struct gb_block_op_s *__gb_block_next(struct gb_s *gb,
+		const uint_fast16_t pc)
+{
+	const struct gb_block_op_s *op;
+
+	if(gb->block_cache.next == NULL || gb->block_cache.next_pc != pc)
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.h + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		const struct gb_block_s *block = __gb_block_lookup(gb, pc);
+
+		if(block == NULL)
+		{
+			gb->block_cache.next = NULL;
+			return NULL;
+		}
+
+		gb->block_cache.next = block->ops;
+		gb->block_cache.end = block->ops + block->count;
+		gb->block_cache.next_pc = pc;
 	}
 
-	case 0x8D: /* ADC A, L */
+	op = gb->block_cache.next++;
+	gb->block_cache.next_pc += op->length;
+
+	if(gb->block_cache.next == gb->block_cache.end)
+		gb->block_cache.next = NULL;
+
+	return op;
+}
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+#	include "peanut_gb_rec.h"
+#endif
+
+/**
+ * Internal function used to step the CPU.
+ * Instructions are executed in a batch until a frame has been completed or the
+ * cycles requested by gb_run_cycles() have been run. gb->cpu_reg is only up
+ * to date between batches and in the functions called with PGB_SAVE_REGS().
+ */
+void __gb_step_cpu(struct gb_s *gb)
+{
+	uint8_t opcode, inst_cycles;
+	/* B, C, D, E, H and L are accessed through the emulator context, as
+	 * they overlap BC, DE and HL. */
+	struct cpu_registers_s *const cpu = &gb->cpu_reg;
+	/* The other registers are kept in locals until the batch of
+	 * instructions ends, so that they may be held in host registers. */
+	struct
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.l + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
-	}
+		uint8_t a;
+		uint8_t f_z, f_n, f_h, f_c;
+		uint16_t sp;
+		uint16_t pc;
+#if PEANUT_GB_LAZY_FLAGS
+		/* Instruction that last set the flags, the XOR of its
+		 * operands and its result. */
+		uint8_t lf_op;
+		uint8_t lf_x;
+		uint16_t lf_res;
+#endif
+	} reg;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	/* Operands of the instruction if it came from the block cache. */
+	const uint8_t *imm;
+#endif
+#if PEANUT_GB_THREADED_DISPATCH
+	static const void *const op_table[0x100] =
+	{
+		&&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+		&&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+		&&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+		&&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+		&&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+		&&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+		&&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+		&&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+		&&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+		&&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+		&&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+		&&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+		&&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+		&&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+		&&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+		&&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+		&&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+		&&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+		&&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+		&&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+		&&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+		&&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+		&&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+		&&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+		&&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+		&&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+		&&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_invalid, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+		&&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_invalid, &&op_0xDC, &&op_invalid, &&op_0xDE, &&op_0xDF,
+		&&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_invalid, &&op_invalid, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+		&&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_invalid, &&op_invalid, &&op_invalid, &&op_0xEE, &&op_0xEF,
+		&&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_invalid, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+		&&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_invalid, &&op_invalid, &&op_0xFE, &&op_0xFF,
+	};
+#endif
+
+	PGB_LOAD_REGS();
+#if PEANUT_GB_LAZY_FLAGS
+	reg.lf_x = 0;
+	reg.lf_res = 0;
+#endif
 
-	case 0x8E: /* ADC A, (HL) */
+next_instruction:
+
+	/* Handle interrupts */
+	if(gb->intr_pending)
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-		uint16_t temp = gb->cpu_reg.a + val + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		gb->gb_halt = 0;
+
+		if(gb->gb_ime)
+		{
+			uint_fast8_t pending;
+
+			/* Disable interrupts */
+			gb->gb_ime = 0;
+
+			/* Push Program Counter */
+			__gb_write(gb, --reg.sp, reg.pc >> 8);
+			__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+
+			/* Call the handler of the highest priority interrupt
+			 * still pending, as the push may have written IE. */
+			pending = gb->gb_reg.IF & gb->gb_reg.IE & ANY_INTR;
+
+			if(pending)
+			{
+				const uint_fast8_t intr = intr_priority[pending];
+
+				reg.pc = VBLANK_INTR_ADDR +
+					 intr * (LCDC_INTR_ADDR - VBLANK_INTR_ADDR);
+				gb->gb_reg.IF ^= 1 << intr;
+			}
+		}
+
+		__gb_update_intr(gb);
 	}
 
-	case 0x8F: /* ADC A, A */
+	/* Skip ahead to the next event while halted. */
+	if(gb->gb_halt)
+		__gb_halt_skip(gb);
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	/* Run the translation of the block at the PC instead, if there is
+	 * one. */
+	if(!gb->gb_halt && (gb->block_cache.next == NULL ||
+				gb->block_cache.next_pc != reg.pc))
 	{
-		uint16_t temp = gb->cpu_reg.a + gb->cpu_reg.a + gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		/* TODO: Optimisation here? */
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.a ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		uint_fast8_t executed;
+
+		PGB_SAVE_REGS();
+		executed = __gb_rec_execute(gb);
+		PGB_LOAD_REGS();
+
+		if(executed)
+		{
+			inst_cycles = 0;
+			goto op_done;
+		}
 	}
+#endif
 
-	case 0x90: /* SUB B */
+	/* Obtain opcode */
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	imm = NULL;
+
+	if(gb->gb_halt)
+		opcode = 0x00;
+	else
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		const struct gb_block_op_s *op = __gb_block_next(gb, reg.pc);
+
+		if(op != NULL)
+		{
+			opcode = op->opcode;
+			imm = op->imm;
+			reg.pc++;
+		}
+		else
+			opcode = __gb_read(gb, reg.pc++);
 	}
+#else
+	opcode = (gb->gb_halt ? 0x00 : __gb_read(gb, reg.pc++));
+#endif
 
-	case 0x91: /* SUB C */
+#if PEANUT_GB_IDLE_LOOP_SKIP
+	/* Skip ahead to the next event while polling LY, STAT or IF. */
+	if((opcode == 0xF0 || opcode == 0xFA) &&
+			__gb_idle_loop_skip(gb, opcode, reg.pc))
+		PGB_LOAD_AF();
+#endif
+#if PEANUT_GB_BULK_LOOPS
+	/* Run a copy or fill loop at once. */
+	if((opcode == 0x1A || opcode == 0x22 || opcode == 0x2A ||
+			opcode == 0x32 || opcode == 0x7A || opcode == 0x7B) &&
+			__gb_bulk_loop_possible(gb, opcode))
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		const struct gb_bulk_loop_s *loop =
+			__gb_bulk_loop_find(gb, opcode, reg.pc);
+
+		if(loop != NULL)
+		{
+			PGB_SAVE_REGS();
+			__gb_bulk_loop_run(gb, loop);
+			PGB_LOAD_REGS();
+		}
 	}
+#endif
+	inst_cycles = op_cycles[opcode];
 
-	case 0x92: /* SUB D */
+	/* Execute opcode */
+#if PEANUT_GB_THREADED_DISPATCH
+	goto *op_table[opcode];
+#else
+	switch(opcode)
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+#endif
+	PGB_OPCODE(0x00) /* NOP */
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x01) /* LD BC, imm */
+		cpu->c = PGB_FETCH();
+		cpu->b = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x02) /* LD (BC), A */
+		__gb_write(gb, cpu->bc, reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x03) /* INC BC */
+		cpu->bc++;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x04) /* INC B */
+		cpu->b++;
+		PGB_FLAGS_INC(cpu->b);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x05) /* DEC B */
+		cpu->b--;
+		PGB_FLAGS_DEC(cpu->b);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x06) /* LD B, imm */
+		cpu->b = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x07) /* RLCA */
+		PGB_FLAGS_WRITE();
+		reg.a = (reg.a << 1) | (reg.a >> 7);
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = 0;
+		reg.f_c = (reg.a & 0x01);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x08) /* LD (imm), SP */
+	{
+		uint16_t temp = PGB_FETCH();
+		temp |= PGB_FETCH() << 8;
+		__gb_write(gb, temp++, reg.sp & 0xFF);
+		__gb_write(gb, temp, reg.sp >> 8);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x93: /* SUB E */
+	PGB_OPCODE(0x09) /* ADD HL, BC */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint_fast32_t temp = cpu->hl + cpu->bc;
+		reg.f_n = 0;
+		reg.f_h =
+			(temp ^ cpu->hl ^ cpu->bc) & 0x1000 ? 1 : 0;
+		reg.f_c = (temp & 0xFFFF0000) ? 1 : 0;
+		cpu->hl = (temp & 0x0000FFFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x94: /* SUB H */
+	PGB_OPCODE(0x0A) /* LD A, (BC) */
+		reg.a = __gb_read(gb, cpu->bc);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x0B) /* DEC BC */
+		cpu->bc--;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x0C) /* INC C */
+		cpu->c++;
+		PGB_FLAGS_INC(cpu->c);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x0D) /* DEC C */
+		cpu->c--;
+		PGB_FLAGS_DEC(cpu->c);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x0E) /* LD C, imm */
+		cpu->c = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x0F) /* RRCA */
+		PGB_FLAGS_WRITE();
+		reg.f_c = reg.a & 0x01;
+		reg.a = (reg.a >> 1) | (reg.a << 7);
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = 0;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x10) /* STOP */
+		//gb->gb_halt = 1;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x11) /* LD DE, imm */
+		cpu->e = PGB_FETCH();
+		cpu->d = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x12) /* LD (DE), A */
+		__gb_write(gb, cpu->de, reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x13) /* INC DE */
+		cpu->de++;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x14) /* INC D */
+		cpu->d++;
+		PGB_FLAGS_INC(cpu->d);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x15) /* DEC D */
+		cpu->d--;
+		PGB_FLAGS_DEC(cpu->d);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x16) /* LD D, imm */
+		cpu->d = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x17) /* RLA */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint8_t temp = reg.a;
+		reg.a = (reg.a << 1) | reg.f_c;
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = 0;
+		reg.f_c = (temp >> 7) & 0x01;
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x95: /* SUB L */
+	PGB_OPCODE(0x18) /* JR imm */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		int8_t temp = (int8_t) PGB_FETCH();
+		reg.pc += temp;
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x96: /* SUB (HL) */
+	PGB_OPCODE(0x19) /* ADD HL, DE */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-		uint16_t temp = gb->cpu_reg.a - val;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint_fast32_t temp = cpu->hl + cpu->de;
+		reg.f_n = 0;
+		reg.f_h =
+			(temp ^ cpu->hl ^ cpu->de) & 0x1000 ? 1 : 0;
+		reg.f_c = (temp & 0xFFFF0000) ? 1 : 0;
+		cpu->hl = (temp & 0x0000FFFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x97: /* SUB A */
-		gb->cpu_reg.a = 0;
-		gb->cpu_reg.f_bits.z = 1;
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x1A) /* LD A, (DE) */
+		reg.a = __gb_read(gb, cpu->de);
+		PGB_OPCODE_DONE;
 
-	case 0x98: /* SBC A, B */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
-	}
+	PGB_OPCODE(0x1B) /* DEC DE */
+		cpu->de--;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x1C) /* INC E */
+		cpu->e++;
+		PGB_FLAGS_INC(cpu->e);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x1D) /* DEC E */
+		cpu->e--;
+		PGB_FLAGS_DEC(cpu->e);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x1E) /* LD E, imm */
+		cpu->e = PGB_FETCH();
+		PGB_OPCODE_DONE;
 
-	case 0x99: /* SBC A, C */
+	PGB_OPCODE(0x1F) /* RRA */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint8_t temp = reg.a;
+		reg.a = reg.a >> 1 | (reg.f_c << 7);
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = 0;
+		reg.f_c = temp & 0x1;
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9A: /* SBC A, D */
+	PGB_OPCODE(0x20) /* JP NZ, imm */
+		if(!PGB_FLAG_Z())
+		{
+			int8_t temp = (int8_t) PGB_FETCH();
+			reg.pc += temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc++;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x21) /* LD HL, imm */
+		cpu->l = PGB_FETCH();
+		cpu->h = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x22) /* LDI (HL), A */
+		__gb_write(gb, cpu->hl, reg.a);
+		cpu->hl++;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x23) /* INC HL */
+		cpu->hl++;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x24) /* INC H */
+		cpu->h++;
+		PGB_FLAGS_INC(cpu->h);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x25) /* DEC H */
+		cpu->h--;
+		PGB_FLAGS_DEC(cpu->h);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x26) /* LD H, imm */
+		cpu->h = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x27) /* DAA */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint16_t a = reg.a;
+
+		if(reg.f_n)
+		{
+			if(reg.f_h)
+				a = (a - 0x06) & 0xFF;
+
+			if(reg.f_c)
+				a -= 0x60;
+		}
+		else
+		{
+			if(reg.f_h || (a & 0x0F) > 9)
+				a += 0x06;
+
+			if(reg.f_c || a > 0x9F)
+				a += 0x60;
+		}
+
+		if((a & 0x100) == 0x100)
+			reg.f_c = 1;
+
+		reg.a = a;
+		reg.f_z = (reg.a == 0);
+		reg.f_h = 0;
+
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9B: /* SBC A, E */
+	PGB_OPCODE(0x28) /* JP Z, imm */
+		if(PGB_FLAG_Z())
+		{
+			int8_t temp = (int8_t) PGB_FETCH();
+			reg.pc += temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc++;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x29) /* ADD HL, HL */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint_fast32_t temp = cpu->hl + cpu->hl;
+		reg.f_n = 0;
+		reg.f_h = (temp & 0x1000) ? 1 : 0;
+		reg.f_c = (temp & 0xFFFF0000) ? 1 : 0;
+		cpu->hl = (temp & 0x0000FFFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9C: /* SBC A, H */
+	PGB_OPCODE(0x2A) /* LD A, (HL+) */
+		reg.a = __gb_read(gb, cpu->hl++);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x2B) /* DEC HL */
+		cpu->hl--;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x2C) /* INC L */
+		cpu->l++;
+		PGB_FLAGS_INC(cpu->l);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x2D) /* DEC L */
+		cpu->l--;
+		PGB_FLAGS_DEC(cpu->l);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x2E) /* LD L, imm */
+		cpu->l = PGB_FETCH();
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x2F) /* CPL */
+		PGB_FLAGS_SYNC();
+		reg.a = ~reg.a;
+		reg.f_n = 1;
+		reg.f_h = 1;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x30) /* JP NC, imm */
+		if(!PGB_FLAG_C())
+		{
+			int8_t temp = (int8_t) PGB_FETCH();
+			reg.pc += temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc++;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x31) /* LD SP, imm */
+		reg.sp = PGB_FETCH();
+		reg.sp |= PGB_FETCH() << 8;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x32) /* LD (HL), A */
+		__gb_write(gb, cpu->hl, reg.a);
+		cpu->hl--;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x33) /* INC SP */
+		reg.sp++;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x34) /* INC (HL) */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		uint8_t temp = __gb_read(gb, cpu->hl) + 1;
+		PGB_FLAGS_INC(temp);
+		__gb_write(gb, cpu->hl, temp);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9D: /* SBC A, L */
+	PGB_OPCODE(0x35) /* DEC (HL) */
 	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		uint8_t temp = __gb_read(gb, cpu->hl) - 1;
+		PGB_FLAGS_DEC(temp);
+		__gb_write(gb, cpu->hl, temp);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9E: /* SBC A, (HL) */
+	PGB_OPCODE(0x36) /* LD (HL), imm */
+		__gb_write(gb, cpu->hl, PGB_FETCH());
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x37) /* SCF */
+		PGB_FLAGS_SYNC();
+		reg.f_n = 0;
+		reg.f_h = 0;
+		reg.f_c = 1;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x38) /* JP C, imm */
+		if(PGB_FLAG_C())
+		{
+			int8_t temp = (int8_t) PGB_FETCH();
+			reg.pc += temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc++;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x39) /* ADD HL, SP */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-		uint16_t temp = gb->cpu_reg.a - val - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		PGB_FLAGS_SYNC();
+		uint_fast32_t temp = cpu->hl + reg.sp;
+		reg.f_n = 0;
+		reg.f_h =
+			((cpu->hl & 0xFFF) + (reg.sp & 0xFFF)) & 0x1000 ? 1 : 0;
+		reg.f_c = temp & 0x10000 ? 1 : 0;
+		cpu->hl = (uint16_t)temp;
+		PGB_OPCODE_DONE;
 	}
 
-	case 0x9F: /* SBC A, A */
-		gb->cpu_reg.a = gb->cpu_reg.f_bits.c ? 0xFF : 0x00;
-		gb->cpu_reg.f_bits.z = gb->cpu_reg.f_bits.c ? 0x00 : 0x01;
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = gb->cpu_reg.f_bits.c;
-		break;
+	PGB_OPCODE(0x3A) /* LD A, (HL) */
+		reg.a = __gb_read(gb, cpu->hl--);
+		PGB_OPCODE_DONE;
 
-	case 0xA0: /* AND B */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x3B) /* DEC SP */
+		reg.sp--;
+		PGB_OPCODE_DONE;
 
-	case 0xA1: /* AND C */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x3C) /* INC A */
+		reg.a++;
+		PGB_FLAGS_INC(reg.a);
+		PGB_OPCODE_DONE;
 
-	case 0xA2: /* AND D */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x3D) /* DEC A */
+		reg.a--;
+		PGB_FLAGS_DEC(reg.a);
+		PGB_OPCODE_DONE;
 
-	case 0xA3: /* AND E */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x3E) /* LD A, imm */
+		reg.a = PGB_FETCH();
+		PGB_OPCODE_DONE;
 
-	case 0xA4: /* AND H */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x3F) /* CCF */
+		PGB_FLAGS_SYNC();
+		reg.f_n = 0;
+		reg.f_h = 0;
+		reg.f_c = !reg.f_c;
+		PGB_OPCODE_DONE;
 
-	case 0xA5: /* AND L */
-		gb->cpu_reg.a = gb->cpu_reg.a & gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x40) /* LD B, B */
+		PGB_OPCODE_DONE;
 
-	case 0xA6: /* AND B */
-		gb->cpu_reg.a = gb->cpu_reg.a & __gb_read(gb, gb->cpu_reg.hl);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x41) /* LD B, C */
+		cpu->b = cpu->c;
+		PGB_OPCODE_DONE;
 
-	case 0xA7: /* AND A */
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x42) /* LD B, D */
+		cpu->b = cpu->d;
+		PGB_OPCODE_DONE;
 
-	case 0xA8: /* XOR B */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x43) /* LD B, E */
+		cpu->b = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xA9: /* XOR C */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x44) /* LD B, H */
+		cpu->b = cpu->h;
+		PGB_OPCODE_DONE;
 
-	case 0xAA: /* XOR D */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x45) /* LD B, L */
+		cpu->b = cpu->l;
+		PGB_OPCODE_DONE;
 
-	case 0xAB: /* XOR E */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x46) /* LD B, (HL) */
+		cpu->b = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-	case 0xAC: /* XOR H */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x47) /* LD B, A */
+		cpu->b = reg.a;
+		PGB_OPCODE_DONE;
 
-	case 0xAD: /* XOR L */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x48) /* LD C, B */
+		cpu->c = cpu->b;
+		PGB_OPCODE_DONE;
 
-	case 0xAE: /* XOR (HL) */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ __gb_read(gb, gb->cpu_reg.hl);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x49) /* LD C, C */
+		PGB_OPCODE_DONE;
 
-	case 0xAF: /* XOR A */
-		gb->cpu_reg.a = 0x00;
-		gb->cpu_reg.f_bits.z = 1;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4A) /* LD C, D */
+		cpu->c = cpu->d;
+		PGB_OPCODE_DONE;
 
-	case 0xB0: /* OR B */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4B) /* LD C, E */
+		cpu->c = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xB1: /* OR C */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4C) /* LD C, H */
+		cpu->c = cpu->h;
+		PGB_OPCODE_DONE;
 
-	case 0xB2: /* OR D */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4D) /* LD C, L */
+		cpu->c = cpu->l;
+		PGB_OPCODE_DONE;
 
-	case 0xB3: /* OR E */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4E) /* LD C, (HL) */
+		cpu->c = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-	case 0xB4: /* OR H */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x4F) /* LD C, A */
+		cpu->c = reg.a;
+		PGB_OPCODE_DONE;
 
-	case 0xB5: /* OR L */
-		gb->cpu_reg.a = gb->cpu_reg.a | gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x50) /* LD D, B */
+		cpu->d = cpu->b;
+		PGB_OPCODE_DONE;
 
-	case 0xB6: /* OR (HL) */
-		gb->cpu_reg.a = gb->cpu_reg.a | __gb_read(gb, gb->cpu_reg.hl);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x51) /* LD D, C */
+		cpu->d = cpu->c;
+		PGB_OPCODE_DONE;
 
-	case 0xB7: /* OR A */
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x52) /* LD D, D */
+		PGB_OPCODE_DONE;
 
-	case 0xB8: /* CP B */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.b;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.b ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x53) /* LD D, E */
+		cpu->d = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xB9: /* CP C */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.c;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.c ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x54) /* LD D, H */
+		cpu->d = cpu->h;
+		PGB_OPCODE_DONE;
 
-	case 0xBA: /* CP D */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.d;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.d ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x55) /* LD D, L */
+		cpu->d = cpu->l;
+		PGB_OPCODE_DONE;
 
-	case 0xBB: /* CP E */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.e;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.e ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x56) /* LD D, (HL) */
+		cpu->d = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-	case 0xBC: /* CP H */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.h;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.h ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x57) /* LD D, A */
+		cpu->d = reg.a;
+		PGB_OPCODE_DONE;
 
-	case 0xBD: /* CP L */
-	{
-		uint16_t temp = gb->cpu_reg.a - gb->cpu_reg.l;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ gb->cpu_reg.l ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x58) /* LD E, B */
+		cpu->e = cpu->b;
+		PGB_OPCODE_DONE;
 
-	/* TODO: Optimsation by combining similar opcode routines. */
-	case 0xBE: /* CP B */
-	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.hl);
-		uint16_t temp = gb->cpu_reg.a - val;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		break;
-	}
+	PGB_OPCODE(0x59) /* LD E, C */
+		cpu->e = cpu->c;
+		PGB_OPCODE_DONE;
 
-	case 0xBF: /* CP A */
-		gb->cpu_reg.f_bits.z = 1;
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x5A) /* LD E, D */
+		cpu->e = cpu->d;
+		PGB_OPCODE_DONE;
 
-	case 0xC0: /* RET NZ */
-		if(!gb->cpu_reg.f_bits.z)
-		{
-			gb->cpu_reg.pc = __gb_read(gb, gb->cpu_reg.sp++);
-			gb->cpu_reg.pc |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-			inst_cycles += 12;
-		}
+	PGB_OPCODE(0x5B) /* LD E, E */
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x5C) /* LD E, H */
+		cpu->e = cpu->h;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x5D) /* LD E, L */
+		cpu->e = cpu->l;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x5E) /* LD E, (HL) */
+		cpu->e = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x5F) /* LD E, A */
+		cpu->e = reg.a;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x60) /* LD H, B */
+		cpu->h = cpu->b;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x61) /* LD H, C */
+		cpu->h = cpu->c;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0x62) /* LD H, D */
+		cpu->h = cpu->d;
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x63) /* LD H, E */
+		cpu->h = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xC1: /* POP BC */
-		gb->cpu_reg.c = __gb_read(gb, gb->cpu_reg.sp++);
-		gb->cpu_reg.b = __gb_read(gb, gb->cpu_reg.sp++);
-		break;
+	PGB_OPCODE(0x64) /* LD H, H */
+		PGB_OPCODE_DONE;
 
-	case 0xC2: /* JP NZ, imm */
-		if(!gb->cpu_reg.f_bits.z)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x65) /* LD H, L */
+		cpu->h = cpu->l;
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x66) /* LD H, (HL) */
+		cpu->h = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-	case 0xC3: /* JP imm */
-	{
-		uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-		temp |= __gb_read(gb, gb->cpu_reg.pc) << 8;
-		gb->cpu_reg.pc = temp;
-		break;
-	}
+	PGB_OPCODE(0x67) /* LD H, A */
+		cpu->h = reg.a;
+		PGB_OPCODE_DONE;
 
-	case 0xC4: /* CALL NZ imm */
-		if(!gb->cpu_reg.f_bits.z)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x68) /* LD L, B */
+		cpu->l = cpu->b;
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x69) /* LD L, C */
+		cpu->l = cpu->c;
+		PGB_OPCODE_DONE;
 
-	case 0xC5: /* PUSH BC */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.b);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.c);
-		break;
+	PGB_OPCODE(0x6A) /* LD L, D */
+		cpu->l = cpu->d;
+		PGB_OPCODE_DONE;
 
-	case 0xC6: /* ADD A, imm */
-	{
-		/* Taken from SameBoy, which is released under MIT Licence. */
-		uint8_t value = __gb_read(gb, gb->cpu_reg.pc++);
-		uint16_t calc = gb->cpu_reg.a + value;
-		gb->cpu_reg.f_bits.z = ((uint8_t)calc == 0) ? 1 : 0;
-		gb->cpu_reg.f_bits.h =
-			((gb->cpu_reg.a & 0xF) + (value & 0xF) > 0x0F) ? 1 : 0;
-		gb->cpu_reg.f_bits.c = calc > 0xFF ? 1 : 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.a = (uint8_t)calc;
-		break;
-	}
+	PGB_OPCODE(0x6B) /* LD L, E */
+		cpu->l = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xC7: /* RST 0x0000 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0000;
-		break;
+	PGB_OPCODE(0x6C) /* LD L, H */
+		cpu->l = cpu->h;
+		PGB_OPCODE_DONE;
 
-	case 0xC8: /* RET Z */
-		if(gb->cpu_reg.f_bits.z)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-			temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
+	PGB_OPCODE(0x6D) /* LD L, L */
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x6E) /* LD L, (HL) */
+		cpu->l = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-	case 0xC9: /* RET */
-	{
-		uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-		temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-		gb->cpu_reg.pc = temp;
-		break;
-	}
+	PGB_OPCODE(0x6F) /* LD L, A */
+		cpu->l = reg.a;
+		PGB_OPCODE_DONE;
 
-	case 0xCA: /* JP Z, imm */
-		if(gb->cpu_reg.f_bits.z)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x70) /* LD (HL), B */
+		__gb_write(gb, cpu->hl, cpu->b);
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x71) /* LD (HL), C */
+		__gb_write(gb, cpu->hl, cpu->c);
+		PGB_OPCODE_DONE;
 
-	case 0xCB: /* CB INST */
-		inst_cycles = __gb_execute_cb(gb);
-		break;
+	PGB_OPCODE(0x72) /* LD (HL), D */
+		__gb_write(gb, cpu->hl, cpu->d);
+		PGB_OPCODE_DONE;
 
-	case 0xCC: /* CALL Z, imm */
-		if(gb->cpu_reg.f_bits.z)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x73) /* LD (HL), E */
+		__gb_write(gb, cpu->hl, cpu->e);
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x74) /* LD (HL), H */
+		__gb_write(gb, cpu->hl, cpu->h);
+		PGB_OPCODE_DONE;
 
-	case 0xCD: /* CALL imm */
-	{
-		uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-		addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = addr;
-	}
-	break;
+	PGB_OPCODE(0x75) /* LD (HL), L */
+		__gb_write(gb, cpu->hl, cpu->l);
+		PGB_OPCODE_DONE;
 
-	case 0xCE: /* ADC A, imm */
-	{
-		uint8_t value, a, carry;
-		value = __gb_read(gb, gb->cpu_reg.pc++);
-		a = gb->cpu_reg.a;
-		carry = gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.a = a + value + carry;
+	PGB_OPCODE(0x76) /* HALT */
+		/* TODO: Emulate HALT bug? */
+		gb->gb_halt = 1;
+		__gb_update_intr(gb);
+		PGB_OPCODE_DONE;
 
-		gb->cpu_reg.f_bits.z = gb->cpu_reg.a == 0 ? 1 : 0;
-		gb->cpu_reg.f_bits.h =
-			((a & 0xF) + (value & 0xF) + carry > 0x0F) ? 1 : 0;
-		gb->cpu_reg.f_bits.c =
-			(((uint16_t) a) + ((uint16_t) value) + carry > 0xFF) ? 1 : 0;
-		gb->cpu_reg.f_bits.n = 0;
-		break;
-	}
+	PGB_OPCODE(0x77) /* LD (HL), A */
+		__gb_write(gb, cpu->hl, reg.a);
+		PGB_OPCODE_DONE;
 
-	case 0xCF: /* RST 0x0008 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0008;
-		break;
+	PGB_OPCODE(0x78) /* LD A, B */
+		reg.a = cpu->b;
+		PGB_OPCODE_DONE;
 
-	case 0xD0: /* RET NC */
-		if(!gb->cpu_reg.f_bits.c)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-			temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
+	PGB_OPCODE(0x79) /* LD A, C */
+		reg.a = cpu->c;
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x7A) /* LD A, D */
+		reg.a = cpu->d;
+		PGB_OPCODE_DONE;
 
-	case 0xD1: /* POP DE */
-		gb->cpu_reg.e = __gb_read(gb, gb->cpu_reg.sp++);
-		gb->cpu_reg.d = __gb_read(gb, gb->cpu_reg.sp++);
-		break;
+	PGB_OPCODE(0x7B) /* LD A, E */
+		reg.a = cpu->e;
+		PGB_OPCODE_DONE;
 
-	case 0xD2: /* JP NC, imm */
-		if(!gb->cpu_reg.f_bits.c)
-		{
-			uint16_t temp =  __gb_read(gb, gb->cpu_reg.pc++);
-			temp |=  __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x7C) /* LD A, H */
+		reg.a = cpu->h;
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x7D) /* LD A, L */
+		reg.a = cpu->l;
+		PGB_OPCODE_DONE;
 
-	case 0xD4: /* CALL NC, imm */
-		if(!gb->cpu_reg.f_bits.c)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x7E) /* LD A, (HL) */
+		reg.a = __gb_read(gb, cpu->hl);
+		PGB_OPCODE_DONE;
 
-		break;
+	PGB_OPCODE(0x7F) /* LD A, A */
+		PGB_OPCODE_DONE;
 
-	case 0xD5: /* PUSH DE */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.d);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.e);
-		break;
+	PGB_OPCODE(0x80) /* ADD A, B */
+	{
+		uint16_t temp = reg.a + cpu->b;
+		PGB_FLAGS_ADD(reg.a ^ cpu->b, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xD6: /* SUB imm */
+	PGB_OPCODE(0x81) /* ADD A, C */
 	{
-		uint8_t val = __gb_read(gb, gb->cpu_reg.pc++);
-		uint16_t temp = gb->cpu_reg.a - val;
-		gb->cpu_reg.f_bits.z = ((temp & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ val ^ temp) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp & 0xFF);
-		break;
+		uint16_t temp = reg.a + cpu->c;
+		PGB_FLAGS_ADD(reg.a ^ cpu->c, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xD7: /* RST 0x0010 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0010;
-		break;
+	PGB_OPCODE(0x82) /* ADD A, D */
+	{
+		uint16_t temp = reg.a + cpu->d;
+		PGB_FLAGS_ADD(reg.a ^ cpu->d, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xD8: /* RET C */
-		if(gb->cpu_reg.f_bits.c)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-			temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
+	PGB_OPCODE(0x83) /* ADD A, E */
+	{
+		uint16_t temp = reg.a + cpu->e;
+		PGB_FLAGS_ADD(reg.a ^ cpu->e, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-		break;
+	PGB_OPCODE(0x84) /* ADD A, H */
+	{
+		uint16_t temp = reg.a + cpu->h;
+		PGB_FLAGS_ADD(reg.a ^ cpu->h, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xD9: /* RETI */
+	PGB_OPCODE(0x85) /* ADD A, L */
 	{
-		uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
-		temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
-		gb->cpu_reg.pc = temp;
-		gb->gb_ime = 1;
+		uint16_t temp = reg.a + cpu->l;
+		PGB_FLAGS_ADD(reg.a ^ cpu->l, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
-	break;
 
-	case 0xDA: /* JP C, imm */
-		if(gb->cpu_reg.f_bits.c)
-		{
-			uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-			addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			gb->cpu_reg.pc = addr;
-			inst_cycles += 4;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x86) /* ADD A, (HL) */
+	{
+		uint8_t hl = __gb_read(gb, cpu->hl);
+		uint16_t temp = reg.a + hl;
+		PGB_FLAGS_ADD(reg.a ^ hl, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-		break;
+	PGB_OPCODE(0x87) /* ADD A, A */
+	{
+		uint16_t temp = reg.a + reg.a;
+		PGB_FLAGS_ADD(0, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xDC: /* CALL C, imm */
-		if(gb->cpu_reg.f_bits.c)
-		{
-			uint16_t temp = __gb_read(gb, gb->cpu_reg.pc++);
-			temp |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-			__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-			gb->cpu_reg.pc = temp;
-			inst_cycles += 12;
-		}
-		else
-			gb->cpu_reg.pc += 2;
+	PGB_OPCODE(0x88) /* ADC A, B */
+	{
+		uint16_t temp = reg.a + cpu->b + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->b, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-		break;
+	PGB_OPCODE(0x89) /* ADC A, C */
+	{
+		uint16_t temp = reg.a + cpu->c + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->c, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xDE: /* SBC A, imm */
+	PGB_OPCODE(0x8A) /* ADC A, D */
 	{
-		uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.pc++);
-		uint16_t temp_16 = gb->cpu_reg.a - temp_8 - gb->cpu_reg.f_bits.c;
-		gb->cpu_reg.f_bits.z = ((temp_16 & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h =
-			(gb->cpu_reg.a ^ temp_8 ^ temp_16) & 0x10 ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp_16 & 0xFF00) ? 1 : 0;
-		gb->cpu_reg.a = (temp_16 & 0xFF);
-		break;
+		uint16_t temp = reg.a + cpu->d + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->d, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xDF: /* RST 0x0018 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0018;
-		break;
+	PGB_OPCODE(0x8B) /* ADC A, E */
+	{
+		uint16_t temp = reg.a + cpu->e + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->e, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE0: /* LD (0xFF00+imm), A */
-		__gb_write(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc++),
-			   gb->cpu_reg.a);
-		break;
+	PGB_OPCODE(0x8C) /* ADC A, H */
+	{
+		uint16_t temp = reg.a + cpu->h + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->h, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE1: /* POP HL */
-		gb->cpu_reg.l = __gb_read(gb, gb->cpu_reg.sp++);
-		gb->cpu_reg.h = __gb_read(gb, gb->cpu_reg.sp++);
-		break;
+	PGB_OPCODE(0x8D) /* ADC A, L */
+	{
+		uint16_t temp = reg.a + cpu->l + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ cpu->l, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE2: /* LD (C), A */
-		__gb_write(gb, 0xFF00 | gb->cpu_reg.c, gb->cpu_reg.a);
-		break;
+	PGB_OPCODE(0x8E) /* ADC A, (HL) */
+	{
+		uint8_t val = __gb_read(gb, cpu->hl);
+		uint16_t temp = reg.a + val + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ val, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE5: /* PUSH HL */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.h);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.l);
-		break;
+	PGB_OPCODE(0x8F) /* ADC A, A */
+	{
+		uint16_t temp = reg.a + reg.a + PGB_FLAG_C();
+		PGB_FLAGS_ADD(0, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE6: /* AND imm */
-		/* TODO: Optimisation? */
-		gb->cpu_reg.a = gb->cpu_reg.a & __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 1;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x90) /* SUB B */
+	{
+		uint16_t temp = reg.a - cpu->b;
+		PGB_FLAGS_SUB(reg.a ^ cpu->b, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE7: /* RST 0x0020 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0020;
-		break;
+	PGB_OPCODE(0x91) /* SUB C */
+	{
+		uint16_t temp = reg.a - cpu->c;
+		PGB_FLAGS_SUB(reg.a ^ cpu->c, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xE8: /* ADD SP, imm */
+	PGB_OPCODE(0x92) /* SUB D */
 	{
-		int8_t offset = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-		/* TODO: Move flag assignments for optimisation. */
-		gb->cpu_reg.f_bits.z = 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-		gb->cpu_reg.f_bits.c = ((gb->cpu_reg.sp & 0xFF) + (offset & 0xFF) > 0xFF);
-		gb->cpu_reg.sp += offset;
-		break;
+		uint16_t temp = reg.a - cpu->d;
+		PGB_FLAGS_SUB(reg.a ^ cpu->d, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xE9: /* JP (HL) */
-		gb->cpu_reg.pc = gb->cpu_reg.hl;
-		break;
+	PGB_OPCODE(0x93) /* SUB E */
+	{
+		uint16_t temp = reg.a - cpu->e;
+		PGB_FLAGS_SUB(reg.a ^ cpu->e, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xEA: /* LD (imm), A */
+	PGB_OPCODE(0x94) /* SUB H */
 	{
-		uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-		addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-		__gb_write(gb, addr, gb->cpu_reg.a);
-		break;
+		uint16_t temp = reg.a - cpu->h;
+		PGB_FLAGS_SUB(reg.a ^ cpu->h, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xEE: /* XOR imm */
-		gb->cpu_reg.a = gb->cpu_reg.a ^ __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x95) /* SUB L */
+	{
+		uint16_t temp = reg.a - cpu->l;
+		PGB_FLAGS_SUB(reg.a ^ cpu->l, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xEF: /* RST 0x0028 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0028;
-		break;
+	PGB_OPCODE(0x96) /* SUB (HL) */
+	{
+		uint8_t val = __gb_read(gb, cpu->hl);
+		uint16_t temp = reg.a - val;
+		PGB_FLAGS_SUB(reg.a ^ val, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF0: /* LD A, (0xFF00+imm) */
-		gb->cpu_reg.a =
-			__gb_read(gb, 0xFF00 | __gb_read(gb, gb->cpu_reg.pc++));
-		break;
+	PGB_OPCODE(0x97) /* SUB A */
+		reg.a = 0;
+		PGB_FLAGS_SUB(0, 0);
+		PGB_OPCODE_DONE;
 
-	case 0xF1: /* POP AF */
+	PGB_OPCODE(0x98) /* SBC A, B */
 	{
-		uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.sp++);
-		gb->cpu_reg.f_bits.z = (temp_8 >> 7) & 1;
-		gb->cpu_reg.f_bits.n = (temp_8 >> 6) & 1;
-		gb->cpu_reg.f_bits.h = (temp_8 >> 5) & 1;
-		gb->cpu_reg.f_bits.c = (temp_8 >> 4) & 1;
-		gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.sp++);
-		break;
+		uint16_t temp = reg.a - cpu->b - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->b, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xF2: /* LD A, (C) */
-		gb->cpu_reg.a = __gb_read(gb, 0xFF00 | gb->cpu_reg.c);
-		break;
+	PGB_OPCODE(0x99) /* SBC A, C */
+	{
+		uint16_t temp = reg.a - cpu->c - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->c, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF3: /* DI */
-		gb->gb_ime = 0;
-		break;
+	PGB_OPCODE(0x9A) /* SBC A, D */
+	{
+		uint16_t temp = reg.a - cpu->d - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->d, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF5: /* PUSH AF */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.a);
-		__gb_write(gb, --gb->cpu_reg.sp,
-			   gb->cpu_reg.f_bits.z << 7 | gb->cpu_reg.f_bits.n << 6 |
-			   gb->cpu_reg.f_bits.h << 5 | gb->cpu_reg.f_bits.c << 4);
-		break;
+	PGB_OPCODE(0x9B) /* SBC A, E */
+	{
+		uint16_t temp = reg.a - cpu->e - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->e, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF6: /* OR imm */
-		gb->cpu_reg.a = gb->cpu_reg.a | __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.f_bits.z = (gb->cpu_reg.a == 0x00);
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = 0;
-		gb->cpu_reg.f_bits.c = 0;
-		break;
+	PGB_OPCODE(0x9C) /* SBC A, H */
+	{
+		uint16_t temp = reg.a - cpu->h - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->h, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF7: /* PUSH AF */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0030;
-		break;
+	PGB_OPCODE(0x9D) /* SBC A, L */
+	{
+		uint16_t temp = reg.a - cpu->l - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ cpu->l, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xF8: /* LD HL, SP+/-imm */
+	PGB_OPCODE(0x9E) /* SBC A, (HL) */
 	{
-		/* Taken from SameBoy, which is released under MIT Licence. */
-		int8_t offset = (int8_t) __gb_read(gb, gb->cpu_reg.pc++);
-		gb->cpu_reg.hl = gb->cpu_reg.sp + offset;
-		gb->cpu_reg.f_bits.z = 0;
-		gb->cpu_reg.f_bits.n = 0;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
-		gb->cpu_reg.f_bits.c = ((gb->cpu_reg.sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 :
-				       0;
-		break;
+		uint8_t val = __gb_read(gb, cpu->hl);
+		uint16_t temp = reg.a - val - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ val, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xF9: /* LD SP, HL */
-		gb->cpu_reg.sp = gb->cpu_reg.hl;
-		break;
+	PGB_OPCODE(0x9F) /* SBC A, A */
+		PGB_FLAGS_SYNC();
+		reg.a = reg.f_c ? 0xFF : 0x00;
+		reg.f_z = reg.f_c ? 0x00 : 0x01;
+		reg.f_n = 1;
+		reg.f_h = reg.f_c;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA0) /* AND B */
+		reg.a = reg.a & cpu->b;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA1) /* AND C */
+		reg.a = reg.a & cpu->c;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA2) /* AND D */
+		reg.a = reg.a & cpu->d;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA3) /* AND E */
+		reg.a = reg.a & cpu->e;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA4) /* AND H */
+		reg.a = reg.a & cpu->h;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA5) /* AND L */
+		reg.a = reg.a & cpu->l;
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA6) /* AND B */
+		reg.a = reg.a & __gb_read(gb, cpu->hl);
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA7) /* AND A */
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA8) /* XOR B */
+		reg.a = reg.a ^ cpu->b;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xA9) /* XOR C */
+		reg.a = reg.a ^ cpu->c;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAA) /* XOR D */
+		reg.a = reg.a ^ cpu->d;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAB) /* XOR E */
+		reg.a = reg.a ^ cpu->e;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAC) /* XOR H */
+		reg.a = reg.a ^ cpu->h;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAD) /* XOR L */
+		reg.a = reg.a ^ cpu->l;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAE) /* XOR (HL) */
+		reg.a = reg.a ^ __gb_read(gb, cpu->hl);
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xAF) /* XOR A */
+		reg.a = 0x00;
+		PGB_FLAGS_OR(0);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB0) /* OR B */
+		reg.a = reg.a | cpu->b;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB1) /* OR C */
+		reg.a = reg.a | cpu->c;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB2) /* OR D */
+		reg.a = reg.a | cpu->d;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB3) /* OR E */
+		reg.a = reg.a | cpu->e;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB4) /* OR H */
+		reg.a = reg.a | cpu->h;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB5) /* OR L */
+		reg.a = reg.a | cpu->l;
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB6) /* OR (HL) */
+		reg.a = reg.a | __gb_read(gb, cpu->hl);
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB7) /* OR A */
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xB8) /* CP B */
+	{
+		uint16_t temp = reg.a - cpu->b;
+		PGB_FLAGS_SUB(reg.a ^ cpu->b, temp);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xFA: /* LD A, (imm) */
+	PGB_OPCODE(0xB9) /* CP C */
 	{
-		uint16_t addr = __gb_read(gb, gb->cpu_reg.pc++);
-		addr |= __gb_read(gb, gb->cpu_reg.pc++) << 8;
-		gb->cpu_reg.a = __gb_read(gb, addr);
-		break;
+		uint16_t temp = reg.a - cpu->c;
+		PGB_FLAGS_SUB(reg.a ^ cpu->c, temp);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xFB: /* EI */
-		gb->gb_ime = 1;
-		break;
+	PGB_OPCODE(0xBA) /* CP D */
+	{
+		uint16_t temp = reg.a - cpu->d;
+		PGB_FLAGS_SUB(reg.a ^ cpu->d, temp);
+		PGB_OPCODE_DONE;
+	}
 
-	case 0xFE: /* CP imm */
+	PGB_OPCODE(0xBB) /* CP E */
 	{
-		uint8_t temp_8 = __gb_read(gb, gb->cpu_reg.pc++);
-		uint16_t temp_16 = gb->cpu_reg.a - temp_8;
-		gb->cpu_reg.f_bits.z = ((temp_16 & 0xFF) == 0x00);
-		gb->cpu_reg.f_bits.n = 1;
-		gb->cpu_reg.f_bits.h = ((gb->cpu_reg.a ^ temp_8 ^ temp_16) & 0x10) ? 1 : 0;
-		gb->cpu_reg.f_bits.c = (temp_16 & 0xFF00) ? 1 : 0;
-		break;
+		uint16_t temp = reg.a - cpu->e;
+		PGB_FLAGS_SUB(reg.a ^ cpu->e, temp);
+		PGB_OPCODE_DONE;
 	}
 
-	case 0xFF: /* RST 0x0038 */
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
-		__gb_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
-		gb->cpu_reg.pc = 0x0038;
-		break;
+	PGB_OPCODE(0xBC) /* CP H */
+	{
+		uint16_t temp = reg.a - cpu->h;
+		PGB_FLAGS_SUB(reg.a ^ cpu->h, temp);
+		PGB_OPCODE_DONE;
+	}
 
-	default:
-		(gb->gb_error)(gb, GB_INVALID_OPCODE, opcode);
+	PGB_OPCODE(0xBD) /* CP L */
+	{
+		uint16_t temp = reg.a - cpu->l;
+		PGB_FLAGS_SUB(reg.a ^ cpu->l, temp);
+		PGB_OPCODE_DONE;
 	}
 
-	/* DIV register timing */
-	gb->counter.div_count += inst_cycles;
+	/* TODO: Optimsation by combining similar opcode routines. */
+	PGB_OPCODE(0xBE) /* CP B */
+	{
+		uint8_t val = __gb_read(gb, cpu->hl);
+		uint16_t temp = reg.a - val;
+		PGB_FLAGS_SUB(reg.a ^ val, temp);
+		PGB_OPCODE_DONE;
+	}
+
+	PGB_OPCODE(0xBF) /* CP A */
+		PGB_FLAGS_SUB(0, 0);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xC0) /* RET NZ */
+		if(!PGB_FLAG_Z())
+		{
+			reg.pc = __gb_read(gb, reg.sp++);
+			reg.pc |= __gb_read(gb, reg.sp++) << 8;
+			inst_cycles += 12;
+		}
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xC1) /* POP BC */
+		cpu->c = __gb_read(gb, reg.sp++);
+		cpu->b = __gb_read(gb, reg.sp++);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xC2) /* JP NZ, imm */
+		if(!PGB_FLAG_Z())
+		{
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			reg.pc = temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc += 2;
+
+		PGB_OPCODE_DONE;
 
-	if(gb->counter.div_count >= DIV_CYCLES)
+	PGB_OPCODE(0xC3) /* JP imm */
 	{
-		gb->gb_reg.DIV++;
-		gb->counter.div_count -= DIV_CYCLES;
+		uint16_t temp = PGB_FETCH();
+		temp |= PGB_FETCH() << 8;
+		reg.pc = temp;
+		PGB_OPCODE_DONE;
 	}
 
-	/* Check serial transmission. */
-	if(gb->gb_reg.SC & SERIAL_SC_TX_START)
+	PGB_OPCODE(0xC4) /* CALL NZ imm */
+		if(!PGB_FLAG_Z())
+		{
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			__gb_write(gb, --reg.sp, reg.pc >> 8);
+			__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
+		else
+			reg.pc += 2;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xC5) /* PUSH BC */
+		__gb_write(gb, --reg.sp, cpu->b);
+		__gb_write(gb, --reg.sp, cpu->c);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xC6) /* ADD A, imm */
 	{
-		/* If new transfer, call TX function. */
-		if(gb->counter.serial_count == 0 && gb->gb_serial_tx != NULL)
-			(gb->gb_serial_tx)(gb, gb->gb_reg.SB);
+		uint8_t value = PGB_FETCH();
+		uint16_t calc = reg.a + value;
+		PGB_FLAGS_ADD(reg.a ^ value, calc);
+		reg.a = (uint8_t)calc;
+		PGB_OPCODE_DONE;
+	}
 
-		gb->counter.serial_count += inst_cycles;
+	PGB_OPCODE(0xC7) /* RST 0x0000 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0000;
+		PGB_OPCODE_DONE;
 
-		/* If it's time to receive byte, call RX function. */
-		if(gb->counter.serial_count >= SERIAL_CYCLES)
+	PGB_OPCODE(0xC8) /* RET Z */
+		if(PGB_FLAG_Z())
 		{
-			/* If RX can be done, do it. */
-			/* If RX failed, do not change SB if using external
-			 * clock, or set to 0xFF if using internal clock. */
-			uint8_t rx;
+			uint16_t temp = __gb_read(gb, reg.sp++);
+			temp |= __gb_read(gb, reg.sp++) << 8;
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
 
-			if(gb->gb_serial_rx != NULL &&
-				(gb->gb_serial_rx(gb, &rx) ==
-					 GB_SERIAL_RX_SUCCESS))
-			{
-				gb->gb_reg.SB = rx;
+		PGB_OPCODE_DONE;
 
-				/* Inform game of serial TX/RX completion. */
-				gb->gb_reg.SC &= 0x01;
-				gb->gb_reg.IF |= SERIAL_INTR;
-			}
-			else if(gb->gb_reg.SC & SERIAL_SC_CLOCK_SRC)
-			{
-				/* If using internal clock, and console is not
-				 * attached to any external peripheral, shifted
-				 * bits are replaced with logic 1. */
-				gb->gb_reg.SB = 0xFF;
+	PGB_OPCODE(0xC9) /* RET */
+	{
+		uint16_t temp = __gb_read(gb, reg.sp++);
+		temp |= __gb_read(gb, reg.sp++) << 8;
+		reg.pc = temp;
+		PGB_OPCODE_DONE;
+	}
 
-				/* Inform game of serial TX/RX completion. */
-				gb->gb_reg.SC &= 0x01;
-				gb->gb_reg.IF |= SERIAL_INTR;
-			}
-			else
-			{
-				/* If using external clock, and console is not
-				 * attached to any external peripheral, bits are
-				 * not shifted, so SB is not modified. */
-			}
+	PGB_OPCODE(0xCA) /* JP Z, imm */
+		if(PGB_FLAG_Z())
+		{
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			reg.pc = temp;
+			inst_cycles += 4;
+		}
+		else
+			reg.pc += 2;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xCB) /* CB INST */
+	{
+		const uint8_t cbop = PGB_FETCH();
+
+		PGB_SAVE_REGS();
+		inst_cycles = __gb_execute_cb(gb, cbop);
+		PGB_LOAD_REGS();
+		PGB_OPCODE_DONE;
+	}
 
-			gb->counter.serial_count = 0;
+	PGB_OPCODE(0xCC) /* CALL Z, imm */
+		if(PGB_FLAG_Z())
+		{
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			__gb_write(gb, --reg.sp, reg.pc >> 8);
+			__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+			reg.pc = temp;
+			inst_cycles += 12;
 		}
+		else
+			reg.pc += 2;
+
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xCD) /* CALL imm */
+	{
+		uint16_t addr = PGB_FETCH();
+		addr |= PGB_FETCH() << 8;
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = addr;
 	}
+	PGB_OPCODE_DONE;
 
-	/* TIMA register timing */
-	/* TODO: Change tac_enable to struct of TAC timer control bits. */
-	if(gb->gb_reg.tac_enable)
+	PGB_OPCODE(0xCE) /* ADC A, imm */
 	{
-		static const uint_fast16_t TAC_CYCLES[4] = {1024, 16, 64, 256};
+		uint8_t value = PGB_FETCH();
+		uint16_t temp = reg.a + value + PGB_FLAG_C();
+		PGB_FLAGS_ADD(reg.a ^ value, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-		gb->counter.tima_count += inst_cycles;
+	PGB_OPCODE(0xCF) /* RST 0x0008 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0008;
+		PGB_OPCODE_DONE;
 
-		while(gb->counter.tima_count >= TAC_CYCLES[gb->gb_reg.tac_rate])
+	PGB_OPCODE(0xD0) /* RET NC */
+		if(!PGB_FLAG_C())
 		{
-			gb->counter.tima_count -= TAC_CYCLES[gb->gb_reg.tac_rate];
+			uint16_t temp = __gb_read(gb, reg.sp++);
+			temp |= __gb_read(gb, reg.sp++) << 8;
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
 
-			if(++gb->gb_reg.TIMA == 0)
-			{
-				gb->gb_reg.IF |= TIMER_INTR;
-				/* On overflow, set TMA to TIMA. */
-				gb->gb_reg.TIMA = gb->gb_reg.TMA;
-			}
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD1) /* POP DE */
+		cpu->e = __gb_read(gb, reg.sp++);
+		cpu->d = __gb_read(gb, reg.sp++);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD2) /* JP NC, imm */
+		if(!PGB_FLAG_C())
+		{
+			uint16_t temp =  PGB_FETCH();
+			temp |=  PGB_FETCH() << 8;
+			reg.pc = temp;
+			inst_cycles += 4;
 		}
-	}
+		else
+			reg.pc += 2;
 
-	/* TODO Check behaviour of LCD during LCD power off state. */
-	/* If LCD is off, don't update LCD state. */
-	if((gb->gb_reg.LCDC & LCDC_ENABLE) == 0)
-		return;
+		PGB_OPCODE_DONE;
 
-	/* LCD Timing */
-	gb->counter.lcd_count += inst_cycles;
+	PGB_OPCODE(0xD4) /* CALL NC, imm */
+		if(!PGB_FLAG_C())
+		{
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			__gb_write(gb, --reg.sp, reg.pc >> 8);
+			__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
+		else
+			reg.pc += 2;
 
-	/* New Scanline */
-	if(gb->counter.lcd_count > LCD_LINE_CYCLES)
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD5) /* PUSH DE */
+		__gb_write(gb, --reg.sp, cpu->d);
+		__gb_write(gb, --reg.sp, cpu->e);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD6) /* SUB imm */
 	{
-		gb->counter.lcd_count -= LCD_LINE_CYCLES;
+		uint8_t val = PGB_FETCH();
+		uint16_t temp = reg.a - val;
+		PGB_FLAGS_SUB(reg.a ^ val, temp);
+		reg.a = (temp & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-		/* LYC Update */
-		if(gb->gb_reg.LY == gb->gb_reg.LYC)
+	PGB_OPCODE(0xD7) /* RST 0x0010 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0010;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD8) /* RET C */
+		if(PGB_FLAG_C())
 		{
-			gb->gb_reg.STAT |= STAT_LYC_COINC;
+			uint16_t temp = __gb_read(gb, reg.sp++);
+			temp |= __gb_read(gb, reg.sp++) << 8;
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
 
-			if(gb->gb_reg.STAT & STAT_LYC_INTR)
-				gb->gb_reg.IF |= LCDC_INTR;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xD9) /* RETI */
+	{
+		uint16_t temp = __gb_read(gb, reg.sp++);
+		temp |= __gb_read(gb, reg.sp++) << 8;
+		reg.pc = temp;
+		gb->gb_ime = 1;
+		__gb_update_intr(gb);
+	}
+	PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xDA) /* JP C, imm */
+		if(PGB_FLAG_C())
+		{
+			uint16_t addr = PGB_FETCH();
+			addr |= PGB_FETCH() << 8;
+			reg.pc = addr;
+			inst_cycles += 4;
 		}
 		else
-			gb->gb_reg.STAT &= 0xFB;
+			reg.pc += 2;
 
-		/* Next line */
-		gb->gb_reg.LY = (gb->gb_reg.LY + 1) % LCD_VERT_LINES;
+		PGB_OPCODE_DONE;
 
-		/* VBLANK Start */
-		if(gb->gb_reg.LY == LCD_HEIGHT)
+	PGB_OPCODE(0xDC) /* CALL C, imm */
+		if(PGB_FLAG_C())
 		{
-			gb->lcd_mode = LCD_VBLANK;
-			gb->gb_frame = 1;
-			gb->gb_reg.IF |= VBLANK_INTR;
-			gb->lcd_blank = 0;
+			uint16_t temp = PGB_FETCH();
+			temp |= PGB_FETCH() << 8;
+			__gb_write(gb, --reg.sp, reg.pc >> 8);
+			__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+			reg.pc = temp;
+			inst_cycles += 12;
+		}
+		else
+			reg.pc += 2;
 
-			if(gb->gb_reg.STAT & STAT_MODE_1_INTR)
-				gb->gb_reg.IF |= LCDC_INTR;
+		PGB_OPCODE_DONE;
 
-#if ENABLE_LCD
+	PGB_OPCODE(0xDE) /* SBC A, imm */
+	{
+		uint8_t temp_8 = PGB_FETCH();
+		uint16_t temp_16 = reg.a - temp_8 - PGB_FLAG_C();
+		PGB_FLAGS_SUB(reg.a ^ temp_8, temp_16);
+		reg.a = (temp_16 & 0xFF);
+		PGB_OPCODE_DONE;
+	}
 
-			/* If frame skip is activated, check if we need to draw
-			 * the frame or skip it. */
-			if(gb->direct.frame_skip)
-			{
-				gb->display.frame_skip_count =
-					!gb->display.frame_skip_count;
-			}
+	PGB_OPCODE(0xDF) /* RST 0x0018 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0018;
+		PGB_OPCODE_DONE;
 
-			/* If interlaced is activated, change which lines get
-			 * updated. Also, only update lines on frames that are
-			 * actually drawn when frame skip is enabled. */
-			if(gb->direct.interlace &&
-					(!gb->direct.frame_skip ||
-					 gb->display.frame_skip_count))
-			{
-				gb->display.interlace_count =
-					!gb->display.interlace_count;
-			}
-			
-			if(!gb->direct.frame_skip ||
-				 !gb->display.frame_skip_count)
-			{
-					gb->display.back_fb_enabled =
-							!gb->display.back_fb_enabled;
-			}
+	PGB_OPCODE(0xE0) /* LD (0xFF00+imm), A */
+		__gb_write_io(gb, PGB_FETCH(), reg.a);
+		PGB_OPCODE_DONE;
 
-#endif
-		}
-		/* Normal Line */
-		else if(gb->gb_reg.LY < LCD_HEIGHT)
-		{
-			if(gb->gb_reg.LY == 0)
-			{
-				/* Clear Screen */
-				gb->display.WY = gb->gb_reg.WY;
-				gb->display.window_clear = 0;
-			}
+	PGB_OPCODE(0xE1) /* POP HL */
+		cpu->l = __gb_read(gb, reg.sp++);
+		cpu->h = __gb_read(gb, reg.sp++);
+		PGB_OPCODE_DONE;
 
-			gb->lcd_mode = LCD_HBLANK;
+	PGB_OPCODE(0xE2) /* LD (C), A */
+		__gb_write_io(gb, cpu->c, reg.a);
+		PGB_OPCODE_DONE;
 
-			if(gb->gb_reg.STAT & STAT_MODE_0_INTR)
-				gb->gb_reg.IF |= LCDC_INTR;
-		}
+	PGB_OPCODE(0xE5) /* PUSH HL */
+		__gb_write(gb, --reg.sp, cpu->h);
+		__gb_write(gb, --reg.sp, cpu->l);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xE6) /* AND imm */
+		/* TODO: Optimisation? */
+		reg.a = reg.a & PGB_FETCH();
+		PGB_FLAGS_AND(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xE7) /* RST 0x0020 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0020;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xE8) /* ADD SP, imm */
+	{
+		PGB_FLAGS_WRITE();
+		int8_t offset = (int8_t) PGB_FETCH();
+		/* TODO: Move flag assignments for optimisation. */
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = ((reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
+		reg.f_c = ((reg.sp & 0xFF) + (offset & 0xFF) > 0xFF);
+		reg.sp += offset;
+		PGB_OPCODE_DONE;
 	}
-	/* OAM access */
-	else if(gb->lcd_mode == LCD_HBLANK
-			&& gb->counter.lcd_count >= LCD_MODE_2_CYCLES)
+
+	PGB_OPCODE(0xE9) /* JP (HL) */
+		reg.pc = cpu->hl;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xEA) /* LD (imm), A */
 	{
-		gb->lcd_mode = LCD_SEARCH_OAM;
+		uint16_t addr = PGB_FETCH();
+		addr |= PGB_FETCH() << 8;
+		__gb_write(gb, addr, reg.a);
+		PGB_OPCODE_DONE;
+	}
 
-		if(gb->gb_reg.STAT & STAT_MODE_2_INTR)
-			gb->gb_reg.IF |= LCDC_INTR;
+	PGB_OPCODE(0xEE) /* XOR imm */
+		reg.a = reg.a ^ PGB_FETCH();
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xEF) /* RST 0x0028 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0028;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF0) /* LD A, (0xFF00+imm) */
+		reg.a = __gb_read_io(gb, PGB_FETCH());
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF1) /* POP AF */
+	{
+		PGB_FLAGS_WRITE();
+		uint8_t temp_8 = __gb_read(gb, reg.sp++);
+		reg.f_z = (temp_8 >> 7) & 1;
+		reg.f_n = (temp_8 >> 6) & 1;
+		reg.f_h = (temp_8 >> 5) & 1;
+		reg.f_c = (temp_8 >> 4) & 1;
+		reg.a = __gb_read(gb, reg.sp++);
+		PGB_OPCODE_DONE;
 	}
-	/* Update LCD */
-	else if(gb->lcd_mode == LCD_SEARCH_OAM
-			&& gb->counter.lcd_count >= LCD_MODE_3_CYCLES)
+
+	PGB_OPCODE(0xF2) /* LD A, (C) */
+		reg.a = __gb_read_io(gb, cpu->c);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF3) /* DI */
+		gb->gb_ime = 0;
+		__gb_update_intr(gb);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF5) /* PUSH AF */
+		PGB_FLAGS_SYNC();
+		__gb_write(gb, --reg.sp, reg.a);
+		__gb_write(gb, --reg.sp,
+			   reg.f_z << 7 | reg.f_n << 6 |
+			   reg.f_h << 5 | reg.f_c << 4);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF6) /* OR imm */
+		reg.a = reg.a | PGB_FETCH();
+		PGB_FLAGS_OR(reg.a);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF7) /* PUSH AF */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0030;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xF8) /* LD HL, SP+/-imm */
 	{
-		gb->lcd_mode = LCD_TRANSFER;
-#if ENABLE_LCD
-		if(!gb->lcd_blank)
-			__gb_draw_line(gb);
+		PGB_FLAGS_WRITE();
+		/* Taken from SameBoy, which is released under MIT Licence. */
+		int8_t offset = (int8_t) PGB_FETCH();
+		cpu->hl = reg.sp + offset;
+		reg.f_z = 0;
+		reg.f_n = 0;
+		reg.f_h = ((reg.sp & 0xF) + (offset & 0xF) > 0xF) ? 1 : 0;
+		reg.f_c = ((reg.sp & 0xFF) + (offset & 0xFF) > 0xFF) ? 1 :
+				       0;
+		PGB_OPCODE_DONE;
+	}
+
+	PGB_OPCODE(0xF9) /* LD SP, HL */
+		reg.sp = cpu->hl;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xFA) /* LD A, (imm) */
+	{
+		uint16_t addr = PGB_FETCH();
+		addr |= PGB_FETCH() << 8;
+		reg.a = __gb_read(gb, addr);
+		PGB_OPCODE_DONE;
+	}
+
+	PGB_OPCODE(0xFB) /* EI */
+		gb->gb_ime = 1;
+		__gb_update_intr(gb);
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE(0xFE) /* CP imm */
+	{
+		uint8_t temp_8 = PGB_FETCH();
+		uint16_t temp_16 = reg.a - temp_8;
+		PGB_FLAGS_SUB(reg.a ^ temp_8, temp_16);
+		PGB_OPCODE_DONE;
+	}
+
+	PGB_OPCODE(0xFF) /* RST 0x0038 */
+		__gb_write(gb, --reg.sp, reg.pc >> 8);
+		__gb_write(gb, --reg.sp, reg.pc & 0xFF);
+		reg.pc = 0x0038;
+		PGB_OPCODE_DONE;
+
+	PGB_OPCODE_INVALID
+		PGB_SAVE_REGS();
+		(gb->gb_error)(gb, GB_INVALID_OPCODE, opcode);
+		PGB_LOAD_REGS();
+#if !PEANUT_GB_THREADED_DISPATCH
+	}
 #endif
+#if PEANUT_GB_THREADED_DISPATCH || PEANUT_GB_BLOCK_TRANSLATOR
+op_done:
+#endif
+
+	/* Timers, serial and the LCD are only updated once an event is due. */
+	gb->counter.cycles += inst_cycles;
+
+	if(gb->counter.cycles >= gb->counter.event_cycles)
+	{
+		const uint_fast32_t cycles = gb->counter.cycles;
+
+		gb->counter.cycles = 0;
+		gb->counter.run_cycles += cycles;
+		__gb_process_events(gb, cycles);
+		gb->counter.event_cycles = __gb_cycles_to_event(gb);
 	}
+
+	/* Only return to the caller once a frame has been completed, or the
+	 * cycles requested by gb_run_cycles() have been run. */
+	if(!gb->gb_frame && gb->counter.run_cycles < gb->counter.run_target)
+		goto next_instruction;
+
+	PGB_SAVE_REGS();
 }
 
-void gb_run_frame(struct gb_s *gb)
+/**
+ * Internal function used to start a new frame.
+ */
+void __gb_new_frame(struct gb_s *gb)
 {
 	gb->gb_frame = 0;
+	gb->idle_stats.frame_cycles = 0;
+	gb->bulk_stats.frame_iterations = 0;
+#if PEANUT_GB_FRAMEBUFFER
 	if(gb->display.changed_row_count > 0) {
 		memset(gb->display.changed_rows, 0, sizeof(gb->display.changed_rows));
 	}
 	gb->display.changed_row_count = 0;
-	while(!gb->gb_frame)
+#endif
+}
+
+/**
+ * Runs the emulator for the given number of clock cycles, or until a frame
+ * has been completed if that happens first, in which case gb->gb_frame is set.
+ * Whole instructions are executed, so slightly more cycles than requested may
+ * be run. The next call continues from where this one stopped.
+ *
+ * \param gb_s		emulator context
+ * \param cycles	clock cycles to run, at DMG_CLOCK_FREQ
+ * \return		clock cycles run
+ */
+uint_fast32_t gb_run_cycles(struct gb_s *gb, const uint_fast32_t cycles)
+{
+	/* The last call completed a frame. */
+	if(gb->gb_frame)
+		__gb_new_frame(gb);
+
+	if(cycles == 0)
+		return 0;
+
+	/* The end of the run is due after the requested cycles, unless another
+	 * event is due first. */
+	__gb_sync_counters(gb);
+	gb->counter.run_cycles = 0;
+	gb->counter.run_target = cycles;
+	gb->counter.event_cycles = MIN(gb->counter.event_cycles, cycles);
+
+	while(!gb->gb_frame && gb->counter.run_cycles < cycles)
 		__gb_step_cpu(gb);
+
+	return gb->counter.run_cycles;
+}
+
+void gb_run_frame(struct gb_s *gb)
+{
+	__gb_new_frame(gb);
+
+	while(!gb->gb_frame)
+		gb_run_cycles(gb, LCD_FRAME_CYCLES);
 }
 
 /**
@@ -3663,6 +5789,161 @@ uint_fast32_t gb_get_save_size(struct gb_s *gb)
 	return ram_sizes[ram_size];
 }
 
+/**
+ * Give the core direct access to the ROM and cart RAM, so that reads and
+ * writes to these bypass the gb_rom_read, gb_cart_ram_read and
+ * gb_cart_ram_write callbacks. This is optional and must be called after
+ * gb_init(). Either pointer may be NULL to keep using the callbacks.
+ *
+ * \param rom		ROM file contents
+ * \param cart_ram	cart RAM of at least gb_get_save_size() bytes
+ */
+void gb_set_direct_memory(struct gb_s *gb, const uint8_t *rom,
+		uint8_t *cart_ram)
+{
+	gb->rom_data = rom;
+	gb->cart_ram_data = cart_ram;
+	__gb_update_memory_map(gb);
+}
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+/**
+ * Gets the largest size of the profile saved by gb_save_profile().
+ */
+size_t gb_get_profile_size(struct gb_s *gb)
+{
+	(void)gb;
+	return PROFILE_HEADER_SIZE +
+	       PROFILE_ENTRY_SIZE * PEANUT_GB_BLOCK_CACHE_SIZE;
+}
+
+/**
+ * Save the blocks of ROM code entered most often since reset, and how often,
+ * so that they can be decoded again by gb_load_profile() when the ROM is next
+ * loaded.
+ *
+ * \param buf		at least gb_get_profile_size() bytes
+ * \returns		size of the profile in bytes
+ */
+size_t gb_save_profile(struct gb_s *gb, uint8_t *buf)
+{
+	uint8_t *p = buf + PROFILE_HEADER_SIZE;
+	uint_fast16_t entries = 0;
+
+	for(uint_fast16_t i = 0; i < PEANUT_GB_BLOCK_CACHE_SIZE; i++)
+	{
+		const struct gb_block_s *block = &gb->block_cache.blocks[i];
+		const uint_fast16_t bank = block->tag;
+
+		if(block->count == 0 || (block->tag & BLOCK_TAG_RAM) ||
+				block->runs < BLOCK_PROFILE_MIN_RUNS)
+			continue;
+
+		p[0] = bank & 0xFF;
+		p[1] = bank >> 8;
+		p[2] = block->addr & 0xFF;
+		p[3] = block->addr >> 8;
+		p[4] = block->runs & 0xFF;
+		p[5] = block->runs >> 8;
+		p += PROFILE_ENTRY_SIZE;
+		entries++;
+	}
+
+	buf[0] = 'P';
+	buf[1] = 'G';
+	buf[2] = 'B';
+	buf[3] = 'P';
+	buf[4] = PROFILE_VERSION;
+	buf[5] = gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC);
+	buf[6] = gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC + 1);
+	buf[7] = gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC + 2);
+	buf[8] = entries & 0xFF;
+	buf[9] = entries >> 8;
+
+	return p - buf;
+}
+
+/**
+ * Internal function used to decode the block at addr in the given ROM bank
+ * into the cache, and to translate it if it was entered often enough to be
+ * translated before. Returns 0 if it could not be decoded.
+ */
+uint_fast8_t __gb_block_prewarm(struct gb_s *gb, const uint_fast16_t bank,
+		const uint_fast16_t addr, const uint_fast16_t runs)
+{
+	const uint_fast16_t selected_rom_bank = gb->selected_rom_bank;
+	struct gb_block_s *block;
+
+	if(addr >= VRAM_ADDR || bank > gb->num_rom_banks_mask ||
+			(addr < ROM_N_ADDR && bank != 0))
+		return 0;
+
+	/* Map the bank the block was decoded from while decoding it. */
+	gb->selected_rom_bank = bank;
+	__gb_select_rom_bank(gb);
+
+	block = __gb_block_lookup(gb, addr);
+
+	if(block != NULL)
+	{
+		block->runs = runs;
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+		if(runs >= PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD &&
+				gb->direct.translate && block->rec_count == 0)
+		{
+			block->heat = PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD;
+			__gb_rec_translate(gb, block);
+		}
+#endif
+	}
+
+	gb->selected_rom_bank = selected_rom_bank;
+	__gb_select_rom_bank(gb);
+
+	return block != NULL;
+}
+
+/**
+ * Decode the blocks saved in a profile by gb_save_profile() into the block
+ * cache, and translate those that were translated before, so that they do
+ * not have to warm up again. This is optional, and must be called after
+ * gb_init(), gb_set_direct_memory() and gb_set_translator_code(), before the
+ * first frame is run. Profiles saved for another ROM are ignored.
+ *
+ * \param buf		profile
+ * \param len		size of the profile in bytes
+ * \returns		number of blocks decoded
+ */
+uint_fast16_t gb_load_profile(struct gb_s *gb, const uint8_t *buf,
+		const size_t len)
+{
+	uint_fast16_t entries, loaded = 0;
+
+	if(len < PROFILE_HEADER_SIZE || memcmp(buf, "PGBP", 4) != 0 ||
+			buf[4] != PROFILE_VERSION ||
+			buf[5] != gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC) ||
+			buf[6] != gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC + 1) ||
+			buf[7] != gb->gb_rom_read(gb, ROM_HEADER_CHECKSUM_LOC + 2))
+		return 0;
+
+	entries = buf[8] | buf[9] << 8;
+
+	if(len < PROFILE_HEADER_SIZE + entries * PROFILE_ENTRY_SIZE)
+		return 0;
+
+	for(const uint8_t *p = buf + PROFILE_HEADER_SIZE; entries > 0;
+			p += PROFILE_ENTRY_SIZE, entries--)
+	{
+		loaded += __gb_block_prewarm(gb, p[0] | p[1] << 8,
+					     p[2] | p[3] << 8,
+					     p[4] | p[5] << 8);
+	}
+
+	return loaded;
+}
+#endif
+
 /**
  * Set the function used to handle serial transfer in the front-end. This is
  * optional.
@@ -3706,6 +5987,21 @@ void gb_reset(struct gb_s *gb)
 	gb->cart_ram_bank = 0;
 	gb->enable_cart_ram = 0;
 	gb->cart_mode_select = 0;
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	memset(&gb->block_cache, 0, sizeof(gb->block_cache));
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	gb->translator.used = 0;
+	gb->translator.blocks = 0;
+	gb->translator.runs = 0;
+	gb->translator.flushes = 0;
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	gb->translator.code_used = 0;
+	gb->translator.native_blocks = 0;
+#endif
+	__gb_update_memory_map(gb);
+	__gb_update_io_map(gb);
 
 	/* Initialise CPU registers as though a DMG. */
 	gb->cpu_reg.af = 0x01B0;
@@ -3720,6 +6016,13 @@ void gb_reset(struct gb_s *gb)
 	gb->counter.div_count = 0;
 	gb->counter.tima_count = 0;
 	gb->counter.serial_count = 0;
+	gb->counter.cycles = 0;
+	gb->counter.run_cycles = 0;
+	gb->counter.run_target = 0;
+	gb->idle_stats.frame_cycles = 0;
+	gb->idle_stats.total_cycles = 0;
+	gb->bulk_stats.frame_iterations = 0;
+	gb->bulk_stats.total_iterations = 0;
 
 	gb->gb_reg.TIMA      = 0x00;
 	gb->gb_reg.TMA       = 0x00;
@@ -3744,11 +6047,20 @@ void gb_reset(struct gb_s *gb)
 	gb->gb_reg.WY        = 0x00;
 	gb->gb_reg.WX        = 0x00;
 	gb->gb_reg.IE        = 0x00;
+	__gb_update_intr(gb);
 
 	gb->direct.joypad = 0xFF;
 	gb->gb_reg.P1 = 0xCF;
 
 	memset(gb->vram, 0x00, VRAM_SIZE);
+#if PEANUT_GB_TILE_CACHE
+	memset(gb->display.tile_rows, 0, sizeof(gb->display.tile_rows));
+#endif
+#if PEANUT_GB_LINE_SIGNATURES
+	memset(gb->display.signatures, 0, sizeof(gb->display.signatures));
+#endif
+
+	gb->counter.event_cycles = __gb_cycles_to_event(gb);
 }
 
 /**
@@ -3803,6 +6115,11 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 	gb->gb_serial_tx = NULL;
 	gb->gb_serial_rx = NULL;
 
+	/* ROM and cart RAM are accessed through the callbacks above unless
+	 * the front-end calls gb_set_direct_memory(). */
+	gb->rom_data = NULL;
+	gb->cart_ram_data = NULL;
+
 	/* Check valid ROM using checksum value. */
 	{
 		uint8_t x = 0;
@@ -3823,12 +6140,39 @@ enum gb_init_error_e gb_init(struct gb_s *gb,
 			return GB_INIT_CARTRIDGE_UNSUPPORTED;
 	}
 
+	/* Choose the handlers instantiated for the MBC type. */
+	switch(gb->mbc)
+	{
+#define PGB_MBC_SELECT(n)						\
+	case n:								\
+		gb->mbc_write = __gb_mbc##n##_write;			\
+		gb->mbc_cart_ram_read = __gb_mbc##n##_cart_ram_read;	\
+		gb->mbc_cart_ram_write = __gb_mbc##n##_cart_ram_write;	\
+		break
+	PGB_MBC_SELECT(0);
+	PGB_MBC_SELECT(1);
+	PGB_MBC_SELECT(2);
+	PGB_MBC_SELECT(3);
+	PGB_MBC_SELECT(5);
+#undef PGB_MBC_SELECT
+	}
+
 	gb->cart_ram = cart_ram[gb->gb_rom_read(gb, mbc_location)];
 	gb->num_rom_banks_mask = num_rom_banks_mask[gb->gb_rom_read(gb, bank_count_location)] - 1;
 	gb->num_ram_banks = num_ram_banks[gb->gb_rom_read(gb, ram_size_location)];
 
 	gb->lcd_blank = 0;
 	gb->display.lcd_line_changed = NULL;
+#if !PEANUT_GB_FRAMEBUFFER
+	gb->display.lcd_draw_line = NULL;
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	gb->direct.translate = 1;
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	gb->translator.code = NULL;
+	gb->translator.code_size = 0;
+#endif
 
 	gb_reset(gb);
 
@@ -3882,12 +6226,45 @@ void gb_init_lcd(struct gb_s *gb,
 	gb->display.WY = 0;
 	
 	gb->display.back_fb_enabled = 0;
+	gb->display.lcd_off_blanked = 0;
+	gb->display.oam_changed = 1;
 	
+#if PEANUT_GB_LINE_SIGNATURES
+	gb->display.frame = 1;
+	gb->display.lines_drawn = 0;
+	gb->display.lines_skipped = 0;
+	memset(gb->display.tile_changed, 0, sizeof(gb->display.tile_changed));
+	memset(gb->display.map_row_changed, 0,
+	       sizeof(gb->display.map_row_changed));
+	memset(gb->display.sprites_changed, 0,
+	       sizeof(gb->display.sprites_changed));
+	memset(gb->display.oam_found, 0, sizeof(gb->display.oam_found));
+	memset(gb->display.signatures, 0, sizeof(gb->display.signatures));
+#endif
+
+#if PEANUT_GB_FRAMEBUFFER
 	memset(gb->display.front_fb, 0, sizeof(gb->display.front_fb));
 	memset(gb->display.back_fb, 0, sizeof(gb->display.back_fb));
+#endif
 
 	return;
 }
+
+#if !PEANUT_GB_FRAMEBUFFER
+/**
+ * Pass each line drawn to the front-end, which must keep it, as there is no
+ * framebuffer in struct gb_s. Must be called after gb_init().
+ *
+ * \param lcd_draw_line	called with the pixels of each line drawn
+ */
+void gb_set_lcd_draw_line(struct gb_s *gb,
+		void (*lcd_draw_line)(struct gb_s *gb,
+			const uint8_t *pixels,
+			const uint_fast8_t line))
+{
+	gb->display.lcd_draw_line = lcd_draw_line;
+}
+#endif
 #endif
 
 #endif //PEANUT_GB_H
@@ -0,0 +1,1064 @@
+/**
+ * Block translator for the Peanut-GB core. Hot cached blocks are translated
+ * into threaded code, arrays of C handler pointers with decoded operands,
+ * rather than into machine code.
+ *
+ * Included by peanut_gb.h when PEANUT_GB_BLOCK_TRANSLATOR is set, after the
+ * interpreter helpers and before __gb_step_cpu(), which calls
+ * __gb_rec_execute(). Not to be included directly. Kept out of peanut_gb.h
+ * because it is opt-in and is not built for the Playdate. The x86-64 back end
+ * is in peanut_gb_rec_x64.h.
+ */
+
+#ifndef PEANUT_GB_REC_H
+#define PEANUT_GB_REC_H
+
+#ifndef PEANUT_GB_H
+#	error "peanut_gb_rec.h is included by peanut_gb.h"
+#endif
+
+/* Flags register value for the given flags, each 0 or 1. */
+#define REC_F(z, n, h, c)	((z) << 7 | (n) << 6 | (h) << 5 | (c) << 4)
+#define REC_F_Z			0x80
+#define REC_F_C			0x10
+#define REC_CARRY(gb)		(((gb)->cpu_reg.f >> 4) & 1)
+
+/* Registers by their offset in struct cpu_registers_s. */
+#define REC_R8(gb, off)		(((uint8_t *)&(gb)->cpu_reg)[off])
+#define REC_R16(gb, off)	\
+	(*(uint16_t *)((uint8_t *)&(gb)->cpu_reg + (off)))
+
+#define REC_A	offsetof(struct cpu_registers_s, a)
+#define REC_BC	offsetof(struct cpu_registers_s, bc)
+#define REC_DE	offsetof(struct cpu_registers_s, de)
+#define REC_HL	offsetof(struct cpu_registers_s, hl)
+#define REC_SP	offsetof(struct cpu_registers_s, sp)
+
+/* 8-bit registers in opcode order. (HL) is handled separately. */
+static const uint8_t rec_r8[8] =
+{
+	offsetof(struct cpu_registers_s, b),
+	offsetof(struct cpu_registers_s, c),
+	offsetof(struct cpu_registers_s, d),
+	offsetof(struct cpu_registers_s, e),
+	offsetof(struct cpu_registers_s, h),
+	offsetof(struct cpu_registers_s, l),
+	0,
+	offsetof(struct cpu_registers_s, a)
+};
+
+/**
+ * Internal function used to check whether a write from a translated block
+ * that was not to a mapped page may have changed the memory map, the code
+ * being run, pending interrupts or when the next event is due.
+ */
+uint_fast8_t __gb_rec_write_leaves(const struct gb_s *gb,
+		const uint_fast16_t addr, const uint_fast32_t generation)
+{
+	return addr < VRAM_ADDR ||
+		(addr >= IO_ADDR && addr < HRAM_ADDR) ||
+		addr == INTR_EN_ADDR ||
+		generation != gb->block_cache.ram_generation;
+}
+
+/**
+ * Internal function used to write bytes from a translated block. Returns
+ * nonzero if the rest of the block must not be run.
+ */
+uint_fast8_t __gb_rec_write(struct gb_s *gb, const uint_fast16_t addr,
+		const uint8_t val)
+{
+	uint8_t *page = gb->memory_map.write[addr >> 12];
+	uint_fast32_t generation;
+
+	if(page != NULL)
+	{
+		page[addr & (MAP_PAGE_SIZE - 1)] = val;
+		return 0;
+	}
+
+	generation = gb->block_cache.ram_generation;
+	__gb_write(gb, addr, val);
+	return __gb_rec_write_leaves(gb, addr, generation);
+}
+
+/* Loads. */
+uint_fast8_t __gb_rec_nop(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)gb;
+	(void)op;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_r_r(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R8(gb, op->dst) = REC_R8(gb, op->src);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_r_imm(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R8(gb, op->dst) = op->imm;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_rr_imm(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R16(gb, op->dst) = op->imm;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_r_ind(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R8(gb, op->dst) = __gb_read(gb, REC_R16(gb, op->src));
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_ind_r(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	return __gb_rec_write(gb, REC_R16(gb, op->dst), REC_R8(gb, op->src));
+}
+
+uint_fast8_t __gb_rec_ld_ind_imm(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	return __gb_rec_write(gb, gb->cpu_reg.hl, op->imm);
+}
+
+/* LD A, (HL+) and LD A, (HL-), with the step in imm. */
+uint_fast8_t __gb_rec_ld_a_hl_step(struct gb_s *gb,
+		const struct gb_rec_op_s *op)
+{
+	gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.hl);
+	gb->cpu_reg.hl += op->imm;
+	return 0;
+}
+
+/* LD (HL+), A and LD (HL-), A, with the step in imm. */
+uint_fast8_t __gb_rec_ld_hl_step_a(struct gb_s *gb,
+		const struct gb_rec_op_s *op)
+{
+	const uint_fast8_t leave =
+		__gb_rec_write(gb, gb->cpu_reg.hl, gb->cpu_reg.a);
+	gb->cpu_reg.hl += op->imm;
+	return leave;
+}
+
+uint_fast8_t __gb_rec_ld_a_abs(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	gb->cpu_reg.a = __gb_read(gb, op->imm);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_abs_a(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	return __gb_rec_write(gb, op->imm, gb->cpu_reg.a);
+}
+
+uint_fast8_t __gb_rec_ld_a_io_c(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.a = __gb_read(gb, 0xFF00 | gb->cpu_reg.c);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_io_c_a(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	return __gb_rec_write(gb, 0xFF00 | gb->cpu_reg.c, gb->cpu_reg.a);
+}
+
+uint_fast8_t __gb_rec_ld_abs_sp(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint_fast8_t leave;
+
+	leave = __gb_rec_write(gb, op->imm, gb->cpu_reg.sp & 0xFF);
+	leave |= __gb_rec_write(gb, (uint16_t)(op->imm + 1),
+				gb->cpu_reg.sp >> 8);
+	return leave;
+}
+
+uint_fast8_t __gb_rec_ld_sp_hl(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.sp = gb->cpu_reg.hl;
+	return 0;
+}
+
+/* Flags of ADD SP, imm and LD HL, SP+imm. */
+static uint8_t __gb_rec_sp_offset_flags(const struct gb_s *gb,
+		const uint8_t offset)
+{
+	return REC_F(0, 0,
+		     (gb->cpu_reg.sp & 0xF) + (offset & 0xF) > 0xF,
+		     (gb->cpu_reg.sp & 0xFF) + offset > 0xFF);
+}
+
+uint_fast8_t __gb_rec_add_sp(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	gb->cpu_reg.f = __gb_rec_sp_offset_flags(gb, op->imm);
+	gb->cpu_reg.sp += (int8_t)op->imm;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ld_hl_sp(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	gb->cpu_reg.f = __gb_rec_sp_offset_flags(gb, op->imm);
+	gb->cpu_reg.hl = gb->cpu_reg.sp + (int8_t)op->imm;
+	return 0;
+}
+
+/* Increments and decrements. */
+uint_fast8_t __gb_rec_inc_r(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t val = ++REC_R8(gb, op->dst);
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_C) |
+		REC_F(val == 0, 0, (val & 0x0F) == 0x00, 0);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_dec_r(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t val = --REC_R8(gb, op->dst);
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_C) |
+		REC_F(val == 0, 1, (val & 0x0F) == 0x0F, 0);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_inc_ind(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t val = __gb_read(gb, gb->cpu_reg.hl) + 1;
+	(void)op;
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_C) |
+		REC_F(val == 0, 0, (val & 0x0F) == 0x00, 0);
+	return __gb_rec_write(gb, gb->cpu_reg.hl, val);
+}
+
+uint_fast8_t __gb_rec_dec_ind(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t val = __gb_read(gb, gb->cpu_reg.hl) - 1;
+	(void)op;
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_C) |
+		REC_F(val == 0, 1, (val & 0x0F) == 0x0F, 0);
+	return __gb_rec_write(gb, gb->cpu_reg.hl, val);
+}
+
+uint_fast8_t __gb_rec_inc_rr(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R16(gb, op->dst)++;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_dec_rr(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	REC_R16(gb, op->dst)--;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_add_hl_rr(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint_fast16_t val = REC_R16(gb, op->src);
+	const uint_fast32_t temp = gb->cpu_reg.hl + val;
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_Z) |
+		REC_F(0, 0, ((temp ^ gb->cpu_reg.hl ^ val) & 0x1000) != 0,
+		      temp > 0xFFFF);
+	gb->cpu_reg.hl = temp;
+	return 0;
+}
+
+/* 8-bit arithmetic and logic on A. */
+static void __gb_rec_alu_add(struct gb_s *gb, const uint8_t val)
+{
+	const uint16_t temp = gb->cpu_reg.a + val;
+	gb->cpu_reg.f = REC_F((temp & 0xFF) == 0, 0,
+			      ((gb->cpu_reg.a ^ val ^ temp) & 0x10) != 0,
+			      temp > 0xFF);
+	gb->cpu_reg.a = temp;
+}
+
+static void __gb_rec_alu_adc(struct gb_s *gb, const uint8_t val)
+{
+	const uint16_t temp = gb->cpu_reg.a + val + REC_CARRY(gb);
+	gb->cpu_reg.f = REC_F((temp & 0xFF) == 0, 0,
+			      ((gb->cpu_reg.a ^ val ^ temp) & 0x10) != 0,
+			      temp > 0xFF);
+	gb->cpu_reg.a = temp;
+}
+
+static void __gb_rec_alu_sub(struct gb_s *gb, const uint8_t val)
+{
+	const uint16_t temp = gb->cpu_reg.a - val;
+	gb->cpu_reg.f = REC_F((temp & 0xFF) == 0, 1,
+			      ((gb->cpu_reg.a ^ val ^ temp) & 0x10) != 0,
+			      (temp & 0xFF00) != 0);
+	gb->cpu_reg.a = temp;
+}
+
+static void __gb_rec_alu_sbc(struct gb_s *gb, const uint8_t val)
+{
+	const uint16_t temp = gb->cpu_reg.a - val - REC_CARRY(gb);
+	gb->cpu_reg.f = REC_F((temp & 0xFF) == 0, 1,
+			      ((gb->cpu_reg.a ^ val ^ temp) & 0x10) != 0,
+			      (temp & 0xFF00) != 0);
+	gb->cpu_reg.a = temp;
+}
+
+static void __gb_rec_alu_and(struct gb_s *gb, const uint8_t val)
+{
+	gb->cpu_reg.a &= val;
+	gb->cpu_reg.f = REC_F(gb->cpu_reg.a == 0, 0, 1, 0);
+}
+
+static void __gb_rec_alu_xor(struct gb_s *gb, const uint8_t val)
+{
+	gb->cpu_reg.a ^= val;
+	gb->cpu_reg.f = REC_F(gb->cpu_reg.a == 0, 0, 0, 0);
+}
+
+static void __gb_rec_alu_or(struct gb_s *gb, const uint8_t val)
+{
+	gb->cpu_reg.a |= val;
+	gb->cpu_reg.f = REC_F(gb->cpu_reg.a == 0, 0, 0, 0);
+}
+
+static void __gb_rec_alu_cp(struct gb_s *gb, const uint8_t val)
+{
+	const uint16_t temp = gb->cpu_reg.a - val;
+	gb->cpu_reg.f = REC_F((temp & 0xFF) == 0, 1,
+			      ((gb->cpu_reg.a ^ val ^ temp) & 0x10) != 0,
+			      (temp & 0xFF00) != 0);
+}
+
+/* Handlers of each operation with a register, (HL) or immediate operand. */
+#define REC_ALU_HANDLERS(name)						\
+	uint_fast8_t __gb_rec_##name##_r(struct gb_s *gb,		\
+			const struct gb_rec_op_s *op)			\
+	{								\
+		__gb_rec_alu_##name(gb, REC_R8(gb, op->src));		\
+		return 0;						\
+	}								\
+	uint_fast8_t __gb_rec_##name##_ind(struct gb_s *gb,		\
+			const struct gb_rec_op_s *op)			\
+	{								\
+		(void)op;						\
+		__gb_rec_alu_##name(gb, __gb_read(gb, gb->cpu_reg.hl));	\
+		return 0;						\
+	}								\
+	uint_fast8_t __gb_rec_##name##_imm(struct gb_s *gb,		\
+			const struct gb_rec_op_s *op)			\
+	{								\
+		__gb_rec_alu_##name(gb, op->imm);			\
+		return 0;						\
+	}
+
+REC_ALU_HANDLERS(add)
+REC_ALU_HANDLERS(adc)
+REC_ALU_HANDLERS(sub)
+REC_ALU_HANDLERS(sbc)
+REC_ALU_HANDLERS(and)
+REC_ALU_HANDLERS(xor)
+REC_ALU_HANDLERS(or)
+REC_ALU_HANDLERS(cp)
+#undef REC_ALU_HANDLERS
+
+/* Handlers of each operation in opcode order. */
+static uint_fast8_t (*const rec_alu_r[8])(struct gb_s *,
+		const struct gb_rec_op_s *) =
+{
+	__gb_rec_add_r, __gb_rec_adc_r, __gb_rec_sub_r, __gb_rec_sbc_r,
+	__gb_rec_and_r, __gb_rec_xor_r, __gb_rec_or_r, __gb_rec_cp_r
+};
+static uint_fast8_t (*const rec_alu_ind[8])(struct gb_s *,
+		const struct gb_rec_op_s *) =
+{
+	__gb_rec_add_ind, __gb_rec_adc_ind, __gb_rec_sub_ind, __gb_rec_sbc_ind,
+	__gb_rec_and_ind, __gb_rec_xor_ind, __gb_rec_or_ind, __gb_rec_cp_ind
+};
+static uint_fast8_t (*const rec_alu_imm[8])(struct gb_s *,
+		const struct gb_rec_op_s *) =
+{
+	__gb_rec_add_imm, __gb_rec_adc_imm, __gb_rec_sub_imm, __gb_rec_sbc_imm,
+	__gb_rec_and_imm, __gb_rec_xor_imm, __gb_rec_or_imm, __gb_rec_cp_imm
+};
+
+/* Rotates and flag operations on A. */
+uint_fast8_t __gb_rec_rlca(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.a = (gb->cpu_reg.a << 1) | (gb->cpu_reg.a >> 7);
+	gb->cpu_reg.f = REC_F(0, 0, 0, gb->cpu_reg.a & 0x01);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_rrca(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t carry = gb->cpu_reg.a & 0x01;
+	(void)op;
+	gb->cpu_reg.a = (gb->cpu_reg.a >> 1) | (gb->cpu_reg.a << 7);
+	gb->cpu_reg.f = REC_F(0, 0, 0, carry);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_rla(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t temp = gb->cpu_reg.a;
+	(void)op;
+	gb->cpu_reg.a = (temp << 1) | REC_CARRY(gb);
+	gb->cpu_reg.f = REC_F(0, 0, 0, temp >> 7);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_rra(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint8_t temp = gb->cpu_reg.a;
+	(void)op;
+	gb->cpu_reg.a = (temp >> 1) | (REC_CARRY(gb) << 7);
+	gb->cpu_reg.f = REC_F(0, 0, 0, temp & 0x01);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_daa(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint16_t a = gb->cpu_reg.a;
+	uint8_t carry = REC_CARRY(gb);
+	(void)op;
+
+	if(gb->cpu_reg.f_bits.n)
+	{
+		if(gb->cpu_reg.f_bits.h)
+			a = (a - 0x06) & 0xFF;
+
+		if(carry)
+			a -= 0x60;
+	}
+	else
+	{
+		if(gb->cpu_reg.f_bits.h || (a & 0x0F) > 9)
+			a += 0x06;
+
+		if(carry || a > 0x9F)
+			a += 0x60;
+	}
+
+	if((a & 0x100) == 0x100)
+		carry = 1;
+
+	gb->cpu_reg.a = a;
+	gb->cpu_reg.f = REC_F(gb->cpu_reg.a == 0, gb->cpu_reg.f_bits.n, 0,
+			      carry);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_cpl(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.a = ~gb->cpu_reg.a;
+	gb->cpu_reg.f |= REC_F(0, 1, 1, 0);
+	return 0;
+}
+
+uint_fast8_t __gb_rec_scf(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.f = (gb->cpu_reg.f & REC_F_Z) | REC_F_C;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ccf(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.f = (gb->cpu_reg.f & (REC_F_Z | REC_F_C)) ^ REC_F_C;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_cb(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint_fast32_t generation = gb->block_cache.ram_generation;
+
+	gb->counter.cycles += __gb_execute_cb(gb, op->imm);
+
+	/* Only operations on (HL) other than BIT write to memory. */
+	return (op->imm & 0x07) == 0x06 && (op->imm & 0xC0) != 0x40 &&
+		__gb_rec_write_leaves(gb, gb->cpu_reg.hl, generation);
+}
+
+uint_fast8_t __gb_rec_di(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->gb_ime = 0;
+	__gb_update_intr(gb);
+	return 0;
+}
+
+/* Stack. */
+uint_fast8_t __gb_rec_push(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	const uint16_t val = REC_R16(gb, op->src);
+	uint_fast8_t leave;
+
+	leave = __gb_rec_write(gb, --gb->cpu_reg.sp, val >> 8);
+	leave |= __gb_rec_write(gb, --gb->cpu_reg.sp, val & 0xFF);
+	return leave;
+}
+
+uint_fast8_t __gb_rec_pop(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint16_t val = __gb_read(gb, gb->cpu_reg.sp++);
+	val |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
+	REC_R16(gb, op->dst) = val;
+	return 0;
+}
+
+/* A and F are not stored as a 16-bit register. */
+uint_fast8_t __gb_rec_push_af(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint_fast8_t leave;
+	(void)op;
+
+	leave = __gb_rec_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.a);
+	leave |= __gb_rec_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.f & 0xF0);
+	return leave;
+}
+
+uint_fast8_t __gb_rec_pop_af(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.f = (gb->cpu_reg.f & 0x0F) |
+		(__gb_read(gb, gb->cpu_reg.sp++) & 0xF0);
+	gb->cpu_reg.a = __gb_read(gb, gb->cpu_reg.sp++);
+	return 0;
+}
+
+/* Branches. Conditional branches are taken if the flags in dst equal src. */
+uint_fast8_t __gb_rec_jump(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	gb->cpu_reg.pc = op->imm;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_jump_cc(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	if((gb->cpu_reg.f & op->dst) == op->src)
+	{
+		gb->cpu_reg.pc = op->imm;
+		gb->counter.cycles += 4;
+	}
+
+	return 0;
+}
+
+uint_fast8_t __gb_rec_jump_hl(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	(void)op;
+	gb->cpu_reg.pc = gb->cpu_reg.hl;
+	return 0;
+}
+
+/* CALL and RST. */
+uint_fast8_t __gb_rec_call(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint_fast8_t leave;
+
+	leave = __gb_rec_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc >> 8);
+	leave |= __gb_rec_write(gb, --gb->cpu_reg.sp, gb->cpu_reg.pc & 0xFF);
+	gb->cpu_reg.pc = op->imm;
+	return leave;
+}
+
+uint_fast8_t __gb_rec_call_cc(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint_fast8_t leave;
+
+	if((gb->cpu_reg.f & op->dst) != op->src)
+		return 0;
+
+	leave = __gb_rec_call(gb, op);
+	gb->counter.cycles += 12;
+	return leave;
+}
+
+uint_fast8_t __gb_rec_ret(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	uint16_t temp = __gb_read(gb, gb->cpu_reg.sp++);
+	(void)op;
+	temp |= __gb_read(gb, gb->cpu_reg.sp++) << 8;
+	gb->cpu_reg.pc = temp;
+	return 0;
+}
+
+uint_fast8_t __gb_rec_ret_cc(struct gb_s *gb, const struct gb_rec_op_s *op)
+{
+	if((gb->cpu_reg.f & op->dst) != op->src)
+		return 0;
+
+	__gb_rec_ret(gb, op);
+	gb->counter.cycles += 12;
+	return 0;
+}
+
+/**
+ * Internal function used to translate one instruction of a block. pc is the
+ * address of the next instruction. Returns 0 if the instruction must be left
+ * to the interpreter.
+ */
+uint_fast8_t __gb_rec_translate_op(struct gb_rec_op_s *op,
+		const struct gb_block_op_s *in, const uint16_t pc)
+{
+	static const uint8_t r16[4] = { REC_BC, REC_DE, REC_HL, REC_SP };
+	/* Flag mask and expected flags of NZ, Z, NC and C. */
+	static const uint8_t cc_mask[4] = { REC_F_Z, REC_F_Z, REC_F_C, REC_F_C };
+	static const uint8_t cc_flags[4] = { 0, REC_F_Z, 0, REC_F_C };
+	const uint8_t opcode = in->opcode;
+	const uint_fast8_t x = (opcode >> 3) & 0x07;
+	const uint_fast8_t y = opcode & 0x07;
+	const uint_fast8_t rr = (opcode >> 4) & 0x03;
+	const uint_fast8_t cc = (opcode >> 3) & 0x03;
+
+	op->next_pc = pc;
+	op->opcode = opcode;
+	op->cycles = op_cycles[opcode];
+	op->imm = in->length > 1 ? in->imm[0] : 0;
+	op->dst = 0;
+	op->src = 0;
+
+	if(in->length == 3)
+		op->imm |= in->imm[1] << 8;
+
+	/* LD r, r */
+	if(opcode >= 0x40 && opcode < 0x80)
+	{
+		if(opcode == 0x76)
+			return 0;
+
+		op->dst = x == 6 ? REC_HL : rec_r8[x];
+		op->src = y == 6 ? REC_HL : rec_r8[y];
+
+		if(x == 6)
+			op->exec = __gb_rec_ld_ind_r;
+		else if(y == 6)
+			op->exec = __gb_rec_ld_r_ind;
+		else if(x == y)
+			op->exec = __gb_rec_nop;
+		else
+			op->exec = __gb_rec_ld_r_r;
+
+		return 1;
+	}
+
+	/* ALU A, r */
+	if(opcode >= 0x80 && opcode < 0xC0)
+	{
+		op->src = rec_r8[y];
+		op->exec = y == 6 ? rec_alu_ind[x] : rec_alu_r[x];
+		return 1;
+	}
+
+	switch(opcode)
+	{
+	case 0x00:
+		op->exec = __gb_rec_nop;
+		break;
+
+	case 0x01: case 0x11: case 0x21: case 0x31:
+		op->dst = r16[rr];
+		op->exec = __gb_rec_ld_rr_imm;
+		break;
+
+	case 0x02: case 0x12:
+		op->dst = r16[rr];
+		op->src = REC_A;
+		op->exec = __gb_rec_ld_ind_r;
+		break;
+
+	case 0x0A: case 0x1A:
+		op->dst = REC_A;
+		op->src = r16[rr];
+		op->exec = __gb_rec_ld_r_ind;
+		break;
+
+	case 0x22: case 0x32:
+		op->imm = opcode == 0x22 ? 1 : 0xFFFF;
+		op->exec = __gb_rec_ld_hl_step_a;
+		break;
+
+	case 0x2A: case 0x3A:
+		op->imm = opcode == 0x2A ? 1 : 0xFFFF;
+		op->exec = __gb_rec_ld_a_hl_step;
+		break;
+
+	case 0x03: case 0x13: case 0x23: case 0x33:
+		op->dst = r16[rr];
+		op->exec = __gb_rec_inc_rr;
+		break;
+
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+		op->dst = r16[rr];
+		op->exec = __gb_rec_dec_rr;
+		break;
+
+	case 0x09: case 0x19: case 0x29: case 0x39:
+		op->src = r16[rr];
+		op->exec = __gb_rec_add_hl_rr;
+		break;
+
+	case 0x04: case 0x0C: case 0x14: case 0x1C:
+	case 0x24: case 0x2C: case 0x3C:
+		op->dst = rec_r8[x];
+		op->exec = __gb_rec_inc_r;
+		break;
+
+	case 0x05: case 0x0D: case 0x15: case 0x1D:
+	case 0x25: case 0x2D: case 0x3D:
+		op->dst = rec_r8[x];
+		op->exec = __gb_rec_dec_r;
+		break;
+
+	case 0x34:
+		op->exec = __gb_rec_inc_ind;
+		break;
+
+	case 0x35:
+		op->exec = __gb_rec_dec_ind;
+		break;
+
+	case 0x06: case 0x0E: case 0x16: case 0x1E:
+	case 0x26: case 0x2E: case 0x3E:
+		op->dst = rec_r8[x];
+		op->exec = __gb_rec_ld_r_imm;
+		break;
+
+	case 0x36:
+		op->exec = __gb_rec_ld_ind_imm;
+		break;
+
+	case 0x07:
+		op->exec = __gb_rec_rlca;
+		break;
+
+	case 0x0F:
+		op->exec = __gb_rec_rrca;
+		break;
+
+	case 0x17:
+		op->exec = __gb_rec_rla;
+		break;
+
+	case 0x1F:
+		op->exec = __gb_rec_rra;
+		break;
+
+	case 0x27:
+		op->exec = __gb_rec_daa;
+		break;
+
+	case 0x2F:
+		op->exec = __gb_rec_cpl;
+		break;
+
+	case 0x37:
+		op->exec = __gb_rec_scf;
+		break;
+
+	case 0x3F:
+		op->exec = __gb_rec_ccf;
+		break;
+
+	case 0x08:
+		op->exec = __gb_rec_ld_abs_sp;
+		break;
+
+	case 0x18:
+		op->imm = pc + (int8_t)in->imm[0];
+		op->exec = __gb_rec_jump;
+		break;
+
+	case 0x20: case 0x28: case 0x30: case 0x38:
+		op->imm = pc + (int8_t)in->imm[0];
+		op->dst = cc_mask[cc];
+		op->src = cc_flags[cc];
+		op->exec = __gb_rec_jump_cc;
+		break;
+
+	case 0xC3:
+		op->exec = __gb_rec_jump;
+		break;
+
+	case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+		op->dst = cc_mask[cc];
+		op->src = cc_flags[cc];
+		op->exec = __gb_rec_jump_cc;
+		break;
+
+	case 0xE9:
+		op->exec = __gb_rec_jump_hl;
+		break;
+
+	case 0xCD:
+		op->exec = __gb_rec_call;
+		break;
+
+	case 0xC4: case 0xCC: case 0xD4: case 0xDC:
+		op->dst = cc_mask[cc];
+		op->src = cc_flags[cc];
+		op->exec = __gb_rec_call_cc;
+		break;
+
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		op->imm = opcode & 0x38;
+		op->exec = __gb_rec_call;
+		break;
+
+	case 0xC9:
+		op->exec = __gb_rec_ret;
+		break;
+
+	case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+		op->dst = cc_mask[cc];
+		op->src = cc_flags[cc];
+		op->exec = __gb_rec_ret_cc;
+		break;
+
+	case 0xC5: case 0xD5: case 0xE5:
+		op->src = r16[rr];
+		op->exec = __gb_rec_push;
+		break;
+
+	case 0xF5:
+		op->exec = __gb_rec_push_af;
+		break;
+
+	case 0xC1: case 0xD1: case 0xE1:
+		op->dst = r16[rr];
+		op->exec = __gb_rec_pop;
+		break;
+
+	case 0xF1:
+		op->exec = __gb_rec_pop_af;
+		break;
+
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE:
+	case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		op->exec = rec_alu_imm[x];
+		break;
+
+	case 0xCB:
+		/* The handler adds the cycles. */
+		op->cycles = 0;
+		op->exec = __gb_rec_cb;
+		break;
+
+	case 0xE0: case 0xF0:
+		op->imm |= 0xFF00;
+		op->exec = opcode == 0xE0 ? __gb_rec_ld_abs_a : __gb_rec_ld_a_abs;
+		break;
+
+	case 0xEA:
+		op->exec = __gb_rec_ld_abs_a;
+		break;
+
+	case 0xFA:
+		op->exec = __gb_rec_ld_a_abs;
+		break;
+
+	case 0xE2:
+		op->exec = __gb_rec_ld_io_c_a;
+		break;
+
+	case 0xF2:
+		op->exec = __gb_rec_ld_a_io_c;
+		break;
+
+	case 0xE8:
+		op->exec = __gb_rec_add_sp;
+		break;
+
+	case 0xF8:
+		op->exec = __gb_rec_ld_hl_sp;
+		break;
+
+	case 0xF9:
+		op->exec = __gb_rec_ld_sp_hl;
+		break;
+
+	case 0xF3:
+		op->exec = __gb_rec_di;
+		break;
+
+	/* STOP, HALT, RETI and EI change the CPU state in ways that must be
+	 * seen before the next instruction. */
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+#	include "peanut_gb_rec_x64.h"
+#endif
+
+/**
+ * Internal function used to discard all translations.
+ */
+void __gb_rec_flush(struct gb_s *gb)
+{
+	for(uint_fast16_t i = 0; i < PEANUT_GB_BLOCK_CACHE_SIZE; i++)
+	{
+		gb->block_cache.blocks[i].heat = 0;
+		gb->block_cache.blocks[i].rec_count = 0;
+	}
+
+	gb->translator.used = 0;
+	gb->translator.flushes++;
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	gb->translator.code_used = 0;
+#endif
+}
+
+/**
+ * Internal function used to translate the instructions of a block, up to the
+ * first one that must be left to the interpreter.
+ */
+void __gb_rec_translate(struct gb_s *gb, struct gb_block_s *block)
+{
+	struct gb_rec_op_s *ops;
+	uint_fast16_t pc = block->addr;
+	uint_fast16_t cycles = 0;
+	uint_fast8_t count;
+
+#if PEANUT_GB_IDLE_LOOP_SKIP
+	/* Leave loops that poll LY, STAT or IF to the idle loop detector. */
+	if(block->ops[0].opcode == 0xF0 || block->ops[0].opcode == 0xFA)
+		return;
+#endif
+#if PEANUT_GB_BULK_LOOPS
+	/* Leave copy and fill loops to __gb_bulk_loop_run(). */
+	if(__gb_bulk_loop_find(gb, block->ops[0].opcode, pc + 1) != NULL)
+		return;
+#endif
+
+	if(gb->translator.used + block->count >
+			PEANUT_GB_BLOCK_TRANSLATOR_BUFFER_SIZE)
+		__gb_rec_flush(gb);
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	else if(gb->translator.code != NULL && gb->translator.code_used +
+			block->count * REC_X64_OP_SIZE + REC_X64_BLOCK_SIZE >
+			gb->translator.code_size)
+		__gb_rec_flush(gb);
+#endif
+
+	ops = &gb->translator.ops[gb->translator.used];
+
+	for(count = 0; count < block->count; count++)
+	{
+		pc += block->ops[count].length;
+
+		if(!__gb_rec_translate_op(&ops[count], &block->ops[count], pc))
+			break;
+
+		/* Only the last instruction of a block can be a branch, so
+		 * only CB-prefixed instructions take a variable number of
+		 * cycles here. */
+		if(count > 0)
+			cycles += ops[count - 1].opcode == 0xCB ?
+				  16 : ops[count - 1].cycles;
+	}
+
+	if(count == 0)
+		return;
+
+	block->rec_count = count;
+	block->rec_first = gb->translator.used;
+	block->rec_cycles = cycles;
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	block->rec_native = __gb_rec_x64_compile(gb, ops, count);
+#endif
+	gb->translator.used += count;
+	gb->translator.blocks++;
+}
+
+/**
+ * Internal function used to run the translation of the block at the PC.
+ * Translated instructions do not check for interrupts or events, so the
+ * translation is only run if no event is due before its last instruction, and
+ * is left as soon as an instruction writes to memory that could change the
+ * pending interrupts, the next event or the code being run. Returns 0 if the
+ * block must be interpreted instead, in which case the block cache is ready
+ * to fetch it.
+ */
+uint_fast8_t __gb_rec_execute(struct gb_s *gb)
+{
+	struct gb_block_s *block = __gb_block_lookup(gb, gb->cpu_reg.pc);
+	const struct gb_rec_op_s *op, *last;
+	uint_fast8_t leave;
+
+	if(block == NULL)
+		return 0;
+
+	if(block->rec_count == 0 && gb->direct.translate &&
+			block->heat < PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD &&
+			++block->heat == PEANUT_GB_BLOCK_TRANSLATOR_THRESHOLD)
+		__gb_rec_translate(gb, block);
+
+	if(block->rec_count == 0 || !gb->direct.translate ||
+			gb->counter.cycles + block->rec_cycles >=
+			gb->counter.event_cycles)
+	{
+		gb->block_cache.next = block->ops;
+		gb->block_cache.end = block->ops + block->count;
+		gb->block_cache.next_pc = gb->cpu_reg.pc;
+		return 0;
+	}
+
+	op = &gb->translator.ops[block->rec_first];
+	last = op + block->rec_count - 1;
+	gb->translator.runs++;
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	if(block->rec_native != NULL)
+		leave = ((uint_fast8_t (*)(struct gb_s *))block->rec_native)(gb);
+	else
+#endif
+	for(;; op++)
+	{
+		gb->cpu_reg.pc = op->next_pc;
+		leave = op->exec(gb, op);
+		gb->counter.cycles += op->cycles;
+
+		if(leave || op == last)
+			break;
+	}
+
+	/* Interpret the rest of the block, unless the translation was left
+	 * early. */
+	if(!leave && block->rec_count < block->count)
+	{
+		gb->block_cache.next = block->ops + block->rec_count;
+		gb->block_cache.end = block->ops + block->count;
+		gb->block_cache.next_pc = gb->cpu_reg.pc;
+	}
+	else
+		gb->block_cache.next = NULL;
+
+	return 1;
+}
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+/**
+ * Give the translator executable memory to compile translated blocks into.
+ * This is optional and must be called after gb_init(). The memory must stay
+ * valid until gb_init() is called again or another buffer is given. code may
+ * be NULL to stop compiling blocks.
+ *
+ * \param code		readable, writable and executable memory
+ * \param size		size of code in bytes
+ */
+void gb_set_translator_code(struct gb_s *gb, void *code, size_t size)
+{
+	__gb_rec_flush(gb);
+	gb->translator.code = code;
+	gb->translator.code_size = code != NULL ? size : 0;
+}
+#endif
+
+#endif //PEANUT_GB_REC_H
@@ -0,0 +1,192 @@
+/**
+ * x86-64 back end of the Peanut-GB block translator, for headless testing on
+ * System V hosts such as Linux. Compiles translated blocks to native code in
+ * memory given by the front-end with gb_set_translator_code().
+ *
+ * Included by peanut_gb_rec.h when PEANUT_GB_BLOCK_TRANSLATOR_X86_64 is set.
+ * Not to be included directly.
+ */
+
+#ifndef PEANUT_GB_REC_X64_H
+#define PEANUT_GB_REC_X64_H
+
+#ifndef PEANUT_GB_REC_H
+#	error "peanut_gb_rec_x64.h is included by peanut_gb_rec.h"
+#endif
+
+/* Worst case size of the code of one instruction and of the rest of a
+ * block. */
+#define REC_X64_OP_SIZE		64
+#define REC_X64_BLOCK_SIZE	32
+
+/* Offset of a register in struct gb_s. */
+#define REC_X64_REG(off)	(offsetof(struct gb_s, cpu_reg) + (off))
+#define REC_X64_PC		REC_X64_REG(offsetof(struct cpu_registers_s, pc))
+#define REC_X64_CYCLES		offsetof(struct gb_s, counter.cycles)
+
+/* ModRM byte of [rbx + disp32] with the given register or opcode extension. */
+#define REC_X64_RBX_DISP32(reg)	(0x80 | ((reg) << 3) | 0x03)
+
+static void __gb_rec_x64_emit(struct gb_s *gb, const uint_fast64_t val,
+		uint_fast8_t bytes)
+{
+	uint8_t *code = gb->translator.code + gb->translator.code_used;
+
+	gb->translator.code_used += bytes;
+
+	for(uint_fast8_t i = 0; bytes > 0; i += 8, bytes--)
+		*code++ = val >> i;
+}
+
+/* Instruction with a [rbx + disp32] operand, which is an offset in struct
+ * gb_s while the block runs. */
+static void __gb_rec_x64_mem(struct gb_s *gb, const uint8_t prefix,
+		const uint8_t opcode, const uint8_t reg, const uint32_t disp)
+{
+	if(prefix != 0)
+		__gb_rec_x64_emit(gb, prefix, 1);
+
+	__gb_rec_x64_emit(gb, opcode, 1);
+	__gb_rec_x64_emit(gb, REC_X64_RBX_DISP32(reg), 1);
+	__gb_rec_x64_emit(gb, disp, 4);
+}
+
+/* Size of add [rbx + counter.cycles], imm32, with a REX.W prefix if the
+ * counter is 64 bits wide. */
+#define REC_X64_ADD_CYCLES_SIZE	\
+	(sizeof(((struct gb_s *)0)->counter.cycles) == 8 ? 11 : 10)
+
+/* add [rbx + counter.cycles], cycles */
+static void __gb_rec_x64_add_cycles(struct gb_s *gb, const uint32_t cycles)
+{
+	if(cycles == 0)
+		return;
+
+	__gb_rec_x64_mem(gb, REC_X64_ADD_CYCLES_SIZE == 11 ? 0x48 : 0,
+			 0x81, 0, REC_X64_CYCLES);
+	__gb_rec_x64_emit(gb, cycles, 4);
+}
+
+/* mov word [rbx + cpu_reg.pc], pc */
+static void __gb_rec_x64_set_pc(struct gb_s *gb, const uint16_t pc)
+{
+	__gb_rec_x64_mem(gb, 0x66, 0xC7, 0, REC_X64_PC);
+	__gb_rec_x64_emit(gb, pc, 2);
+}
+
+/**
+ * Internal function used to compile translated instructions to x86-64 code,
+ * which runs them as the loop in __gb_rec_execute() would, but with the
+ * simplest of them inlined and the others called directly. The code is a
+ * function taking the emulator context and returning nonzero if the block was
+ * left early. Returns NULL if there is no code buffer.
+ */
+const uint8_t *__gb_rec_x64_compile(struct gb_s *gb,
+		const struct gb_rec_op_s *ops, const uint_fast8_t count)
+{
+	const uint8_t *start;
+	uint_fast32_t pending = 0;
+	uint_fast8_t pc_set = 1;
+
+	if(gb->translator.code == NULL || gb->translator.code_used +
+			count * REC_X64_OP_SIZE + REC_X64_BLOCK_SIZE >
+			gb->translator.code_size)
+		return NULL;
+
+	start = gb->translator.code + gb->translator.code_used;
+
+	/* push rbx; mov rbx, rdi */
+	__gb_rec_x64_emit(gb, 0x53, 1);
+	__gb_rec_x64_emit(gb, 0xFB8948, 3);
+
+	for(uint_fast8_t i = 0; i < count; i++)
+	{
+		const struct gb_rec_op_s *op = &ops[i];
+
+		if(op->exec == __gb_rec_nop)
+			pc_set = 0;
+		else if(op->exec == __gb_rec_ld_r_r)
+		{
+			/* mov al, [src]; mov [dst], al */
+			__gb_rec_x64_mem(gb, 0, 0x8A, 0, REC_X64_REG(op->src));
+			__gb_rec_x64_mem(gb, 0, 0x88, 0, REC_X64_REG(op->dst));
+			pc_set = 0;
+		}
+		else if(op->exec == __gb_rec_ld_r_imm)
+		{
+			/* mov byte [dst], imm */
+			__gb_rec_x64_mem(gb, 0, 0xC6, 0, REC_X64_REG(op->dst));
+			__gb_rec_x64_emit(gb, op->imm, 1);
+			pc_set = 0;
+		}
+		else if(op->exec == __gb_rec_ld_rr_imm)
+		{
+			/* mov word [dst], imm */
+			__gb_rec_x64_mem(gb, 0x66, 0xC7, 0, REC_X64_REG(op->dst));
+			__gb_rec_x64_emit(gb, op->imm, 2);
+			pc_set = 0;
+		}
+		else if(op->exec == __gb_rec_inc_rr || op->exec == __gb_rec_dec_rr)
+		{
+			/* inc word [dst] or dec word [dst] */
+			__gb_rec_x64_mem(gb, 0x66, 0xFF,
+					 op->exec == __gb_rec_dec_rr,
+					 REC_X64_REG(op->dst));
+			pc_set = 0;
+		}
+		else if(op->exec == __gb_rec_ld_sp_hl)
+		{
+			/* mov ax, [hl]; mov [sp], ax */
+			__gb_rec_x64_mem(gb, 0x66, 0x8B, 0, REC_X64_REG(REC_HL));
+			__gb_rec_x64_mem(gb, 0x66, 0x89, 0, REC_X64_REG(REC_SP));
+			pc_set = 0;
+		}
+		else if(op->exec == __gb_rec_jump)
+		{
+			__gb_rec_x64_set_pc(gb, op->imm);
+			pc_set = 1;
+		}
+		else
+		{
+			/* Handlers may read the PC and the cycles, for example
+			 * to push the PC or to synchronise the timers. */
+			__gb_rec_x64_set_pc(gb, op->next_pc);
+			__gb_rec_x64_add_cycles(gb, pending);
+			pending = 0;
+
+			/* mov rdi, rbx; mov rsi, op; mov rax, exec; call rax */
+			__gb_rec_x64_emit(gb, 0xDF8948, 3);
+			__gb_rec_x64_emit(gb, 0xBE48, 2);
+			__gb_rec_x64_emit(gb, (uintptr_t)op, 8);
+			__gb_rec_x64_emit(gb, 0xB848, 2);
+			__gb_rec_x64_emit(gb, (uintptr_t)op->exec, 8);
+			__gb_rec_x64_emit(gb, 0xD0FF, 2);
+
+			/* test al, al; jz continue; then return the nonzero
+			 * result after counting the cycles of the instruction. */
+			__gb_rec_x64_emit(gb, 0xC084, 2);
+			__gb_rec_x64_emit(gb, 0x74, 1);
+			__gb_rec_x64_emit(gb, 2 + (op->cycles ?
+					  REC_X64_ADD_CYCLES_SIZE : 0), 1);
+			__gb_rec_x64_add_cycles(gb, op->cycles);
+			/* pop rbx; ret */
+			__gb_rec_x64_emit(gb, 0xC35B, 2);
+			pc_set = 1;
+		}
+
+		pending += op->cycles;
+	}
+
+	if(!pc_set)
+		__gb_rec_x64_set_pc(gb, ops[count - 1].next_pc);
+
+	__gb_rec_x64_add_cycles(gb, pending);
+
+	/* xor eax, eax; pop rbx; ret */
+	__gb_rec_x64_emit(gb, 0xC35BC031, 4);
+
+	gb->translator.native_blocks++;
+	return start;
+}
+
+#endif //PEANUT_GB_REC_X64_H
@@ -0,0 +1,309 @@
+/**
+ * Host benchmark for the Peanut-GB core used by Gamekid.
+ *
+ * Runs a ROM headless for a fixed number of frames, several times, and
+ * reports emulated frames per second, both with ROM and cart RAM read through
+ * the front-end callbacks and with gb_set_direct_memory(). Passing
+ * --mbc5-banks instead of a ROM runs a generated 1 MiB MBC5 ROM that switches
+ * ROM bank and executes from, and reads from, the switchable bank constantly.
+ * Build it once per configuration to compare core options on the same ROM,
+ * e.g.:
+ *
+ *   cc -O2 -Iextension/emulator/gb tools/benchmark/peanut_benchmark.c \
+ *      -o peanut_benchmark
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_THREADED_DISPATCH=1 \
+ *      tools/benchmark/peanut_benchmark.c -o peanut_benchmark_threaded
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_LAZY_FLAGS=1 \
+ *      tools/benchmark/peanut_benchmark.c -o peanut_benchmark_lazy_flags
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_BLOCK_CACHE_SIZE=1024 \
+ *      tools/benchmark/peanut_benchmark.c -o peanut_benchmark_block_cache
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_BLOCK_CACHE_SIZE=1024 \
+ *      -DPEANUT_GB_BLOCK_TRANSLATOR=1 tools/benchmark/peanut_benchmark.c \
+ *      -o peanut_benchmark_translator
+ *
+ *   ./peanut_benchmark game.gb|--mbc5-banks [frames] [runs]
+ *
+ * To compare the memory traffic of two builds rather than their speed, e.g.
+ * before and after a change to how __gb_step_cpu() accesses the emulator
+ * context, run both under a profiler with cache counters:
+ *
+ *   perf stat -e instructions,L1-dcache-loads,L1-dcache-stores \
+ *      ./peanut_benchmark game.gb 3600 1
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ENABLE_SOUND 0
+#define ENABLE_LCD 1
+#define PEANUT_GB_HIGH_LCD_ACCURACY 0
+
+/* Sound is disabled at runtime, but the core still links against these. */
+uint8_t audio_read(const uint16_t addr)
+{
+	(void)addr;
+	return 0xFF;
+}
+
+void audio_write(const uint16_t addr, const uint8_t val)
+{
+	(void)addr;
+	(void)val;
+}
+
+#include "peanut_gb.h"
+
+#define DEFAULT_FRAMES	3600
+#define DEFAULT_RUNS	5
+
+#define MBC5_BANKS_ROM_SIZE	(64 * ROM_BANK_SIZE)
+
+struct priv_t
+{
+	uint8_t *rom;
+	uint8_t *cart_ram;
+};
+
+static uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	return p->rom[addr];
+}
+
+static uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	return p->cart_ram[addr];
+}
+
+static void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+			      const uint8_t val)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	p->cart_ram[addr] = val;
+}
+
+static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
+		     const uint16_t val)
+{
+	if(gb_err == GB_INVALID_OPCODE)
+	{
+		fprintf(stderr, "Invalid opcode %#04x at PC: %#06x\n", val,
+			gb->cpu_reg.pc - 1);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static uint8_t *read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *buf = NULL;
+	long len;
+
+	if(f == NULL)
+		return NULL;
+
+	if(fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 &&
+			fseek(f, 0, SEEK_SET) == 0 &&
+			(buf = malloc(len)) != NULL &&
+			fread(buf, 1, len, f) != (size_t)len)
+	{
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(f);
+	return buf;
+}
+
+/**
+ * Generates a 64 bank MBC5 ROM. Bank 0 selects each bank in turn and calls a
+ * routine at 0x4000 which sums 256 bytes of data from the same bank.
+ */
+static uint8_t *generate_mbc5_banks_rom(void)
+{
+	static const uint8_t main_loop[] =
+	{
+		0x31, 0xFF, 0xDF,	/* 0150: LD SP, 0xDFFF */
+		0x3E, 0x01,		/* 0153: LD A, 1 */
+		0xE0, 0x80,		/* 0155: LDH (0x80), A */
+		0xF0, 0x80,		/* 0157: LDH A, (0x80) */
+		0xEA, 0x00, 0x20,	/* 0159: LD (0x2000), A */
+		0xCD, 0x00, 0x40,	/* 015C: CALL 0x4000 */
+		0xF0, 0x80,		/* 015F: LDH A, (0x80) */
+		0x3C,			/* 0161: INC A */
+		0xE6, 0x3F,		/* 0162: AND 0x3F */
+		0x20, 0x01,		/* 0164: JR NZ, 0x0167 */
+		0x3C,			/* 0166: INC A */
+		0xE0, 0x80,		/* 0167: LDH (0x80), A */
+		0x18, 0xEC		/* 0169: JR 0x0157 */
+	};
+	static const uint8_t bank_routine[] =
+	{
+		0x21, 0x00, 0x41,	/* 4000: LD HL, 0x4100 */
+		0x06, 0x00,		/* 4003: LD B, 0 */
+		0x0E, 0x00,		/* 4005: LD C, 0 */
+		0x2A,			/* 4007: LD A, (HL+) */
+		0x81,			/* 4008: ADD A, C */
+		0x4F,			/* 4009: LD C, A */
+		0x05,			/* 400A: DEC B */
+		0x20, 0xFA,		/* 400B: JR NZ, 0x4007 */
+		0xC9			/* 400D: RET */
+	};
+	uint8_t *rom = malloc(MBC5_BANKS_ROM_SIZE);
+	uint32_t seed = 1;
+	uint8_t x = 0;
+
+	if(rom == NULL)
+		return NULL;
+
+	memset(rom, 0xFF, MBC5_BANKS_ROM_SIZE);
+
+	for(uint_fast32_t bank = 1; bank < 64; bank++)
+	{
+		uint8_t *b = rom + bank * ROM_BANK_SIZE;
+
+		memcpy(b, bank_routine, sizeof(bank_routine));
+
+		for(uint_fast16_t i = 0x100; i < 0x200; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			b[i] = seed >> 16;
+		}
+	}
+
+	/* Entry point: NOP; JP 0x0150. */
+	memcpy(rom + 0x100, "\x00\xC3\x50\x01", 4);
+	memcpy(rom + 0x150, main_loop, sizeof(main_loop));
+	memset(rom + 0x134, 0, 0x14D - 0x134);
+	memcpy(rom + 0x134, "MBC5 BANKS", 10);
+	rom[0x147] = 0x19;	/* MBC5 */
+	rom[0x148] = 0x05;	/* 64 banks */
+	rom[0x149] = 0x00;	/* No cart RAM */
+
+	for(uint_fast16_t i = 0x134; i < ROM_HEADER_CHECKSUM_LOC; i++)
+		x = x - rom[i] - 1;
+
+	rom[ROM_HEADER_CHECKSUM_LOC] = x;
+	return rom;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct gb_s gb;
+	struct priv_t priv;
+	unsigned frames = DEFAULT_FRAMES;
+	unsigned runs = DEFAULT_RUNS;
+
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s ROM|--mbc5-banks [frames] [runs]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(argc > 2)
+		frames = strtoul(argv[2], NULL, 10);
+
+	if(argc > 3)
+		runs = strtoul(argv[3], NULL, 10);
+
+	if(strcmp(argv[1], "--mbc5-banks") == 0)
+		priv.rom = generate_mbc5_banks_rom();
+	else
+		priv.rom = read_file(argv[1]);
+
+	if(priv.rom == NULL)
+	{
+		fprintf(stderr, "Unable to read %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	/* Large enough for any supported cartridge. */
+	priv.cart_ram = calloc(1, 0x20000);
+
+	printf("Dispatch: %s\n",
+	       PEANUT_GB_THREADED_DISPATCH ? "threaded" : "switch");
+	printf("Block cache: %u blocks\n", PEANUT_GB_BLOCK_CACHE_SIZE);
+	printf("Block translator: %s\n",
+	       PEANUT_GB_BLOCK_TRANSLATOR ? "on" : "off");
+
+	for(int direct = 0; direct < 2; direct++)
+	{
+		double best = 0.0;
+
+		printf("Memory: %s\n", direct ? "direct" : "callbacks");
+
+		for(unsigned run = 0; run < runs; run++)
+		{
+			double start, elapsed;
+
+			if(gb_init(&gb, &gb_rom_read, &gb_cart_ram_read,
+					&gb_cart_ram_write, &gb_error, &priv) !=
+					GB_INIT_NO_ERROR)
+			{
+				fprintf(stderr, "Unable to initialise %s\n",
+					argv[1]);
+				return EXIT_FAILURE;
+			}
+
+			if(direct)
+				gb_set_direct_memory(&gb, priv.rom, priv.cart_ram);
+
+			gb_init_lcd(&gb, NULL);
+
+			start = now();
+
+			for(unsigned frame = 0; frame < frames; frame++)
+				gb_run_frame(&gb);
+
+			elapsed = now() - start;
+			printf("Run %u: %u frames in %.3f s, %.1f FPS\n",
+			       run + 1, frames, elapsed, frames / elapsed);
+
+			if(frames / elapsed > best)
+				best = frames / elapsed;
+		}
+
+		printf("Best: %.1f FPS (%.1fx real time)\n", best,
+		       best / VERTICAL_SYNC);
+
+#if PEANUT_GB_BULK_LOOPS
+		printf("Bulk loop iterations: %lu (last run)\n",
+		       (unsigned long)gb.bulk_stats.total_iterations);
+#endif
+#if PEANUT_GB_LINE_SIGNATURES
+		printf("Lines drawn: %lu, skipped: %lu (last run)\n",
+		       (unsigned long)gb.display.lines_drawn,
+		       (unsigned long)gb.display.lines_skipped);
+#endif
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+		printf("Block cache hits: %lu, misses: %lu (last run)\n",
+		       (unsigned long)gb.block_cache.hits,
+		       (unsigned long)gb.block_cache.misses);
+		printf("RAM code pages invalidated: %lu (last run)\n",
+		       (unsigned long)gb.block_cache.invalidations);
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR
+		printf("Translated blocks: %lu, runs: %lu, flushes: %lu "
+		       "(last run)\n",
+		       (unsigned long)gb.translator.blocks,
+		       (unsigned long)gb.translator.runs,
+		       (unsigned long)gb.translator.flushes);
+#endif
+	}
+
+	free(priv.cart_ram);
+	free(priv.rom);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+/**
+ * Line renderer check and microbenchmark for the Peanut-GB core used by
+ * Gamekid.
+ *
+ * Draws lines with __gb_draw_line() from random VRAM, OAM, palettes and LCD
+ * registers, and compares every pixel against a reference renderer that
+ * combines the two bytes of each tile row a pixel at a time and scans OAM for
+ * every line, as the core did before drawing from pixel tables and per-line
+ * sprite lists. Then times both over whole frames of the last state. Build it
+ * once per configuration to check core options, e.g.:
+ *
+ *   cc -O2 -Iextension/emulator/gb tools/renderer/peanut_renderer.c \
+ *      -o peanut_renderer
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_TILE_CACHE=0 \
+ *      tools/renderer/peanut_renderer.c -o peanut_renderer_no_tile_cache
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_HIGH_LCD_ACCURACY=0 \
+ *      tools/renderer/peanut_renderer.c -o peanut_renderer_low_accuracy
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_FRAMEBUFFER=0 \
+ *      tools/renderer/peanut_renderer.c -o peanut_renderer_no_framebuffer
+ *
+ *   ./peanut_renderer [cases] [frames]
+ *
+ * Exits with a failure status at the first line that differs.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ENABLE_SOUND 0
+#define ENABLE_LCD 1
+
+/* Sound is disabled at runtime, but the core still links against these. */
+uint8_t audio_read(const uint16_t addr)
+{
+	(void)addr;
+	return 0xFF;
+}
+
+void audio_write(const uint16_t addr, const uint8_t val)
+{
+	(void)addr;
+	(void)val;
+}
+
+#include "peanut_gb.h"
+
+#define DEFAULT_CASES	100000
+#define DEFAULT_FRAMES	2000
+
+/* 32 KiB ROM without an MBC, only used to get through gb_init(). */
+static uint8_t rom[2 * ROM_BANK_SIZE];
+
+static uint32_t seed = 1;
+
+static uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	return rom[addr];
+}
+
+static uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	(void)gb;
+	(void)addr;
+	return 0xFF;
+}
+
+static void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+			      const uint8_t val)
+{
+	(void)gb;
+	(void)addr;
+	(void)val;
+}
+
+static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
+		     const uint16_t val)
+{
+	(void)gb;
+	(void)gb_err;
+	(void)val;
+}
+
+#if !PEANUT_GB_FRAMEBUFFER
+/* Last line passed to line_drawn(). */
+static uint8_t drawn[LCD_WIDTH];
+
+static void line_drawn(struct gb_s *gb, const uint8_t *pixels,
+		       const uint_fast8_t line)
+{
+	(void)gb;
+	(void)line;
+	memcpy(drawn, pixels, LCD_WIDTH);
+}
+#endif
+
+static uint8_t random_byte(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+struct sprite_data
+{
+	uint8_t sprite_number;
+	uint8_t x;
+};
+
+static int compare_sprites(const void *in1, const void *in2)
+{
+	const struct sprite_data *sd1 = in1, *sd2 = in2;
+	int x_res = (int)sd1->x - (int)sd2->x;
+
+	if(x_res != 0)
+		return x_res;
+
+	return (int)sd1->sprite_number - (int)sd2->sprite_number;
+}
+#endif
+
+/**
+ * Draws a line as the core did before drawing from pixel tables and sprite
+ * lists, into pixels instead of the framebuffer. window_line is the line of
+ * the window to draw.
+ */
+static void reference_draw_line(const struct gb_s *gb, uint8_t *pixels,
+				const uint8_t window_line)
+{
+	uint8_t pixel;
+
+	if(gb->gb_reg.LCDC & LCDC_BG_ENABLE)
+	{
+		const uint8_t bg_y = gb->gb_reg.LY + gb->gb_reg.SCY;
+		const uint16_t bg_map =
+			((gb->gb_reg.LCDC & LCDC_BG_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1) + (bg_y >> 3) * 0x20;
+		const uint8_t py = bg_y & 0x07;
+
+		for(uint_fast16_t disp_x = 0; disp_x < LCD_WIDTH; disp_x++)
+		{
+			const uint8_t bg_x = disp_x + gb->gb_reg.SCX;
+			const uint8_t idx = gb->vram[bg_map + (bg_x >> 3)];
+			const uint8_t px = 7 - (bg_x & 0x07);
+			uint16_t tile;
+
+			if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+				tile = VRAM_TILES_1 + idx * 0x10;
+			else
+				tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+			tile += 2 * py;
+
+			const uint8_t t1 = gb->vram[tile] >> px;
+			const uint8_t t2 = gb->vram[tile + 1] >> px;
+			const uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+
+			pixels[disp_x] = gb->display.bg_palette[c] | LCD_PALETTE_BG;
+		}
+	}
+
+	if(gb->gb_reg.LCDC & LCDC_WINDOW_ENABLE
+			&& gb->gb_reg.LY >= gb->display.WY
+			&& gb->gb_reg.WX <= 166)
+	{
+		const uint16_t win_line =
+			((gb->gb_reg.LCDC & LCDC_WINDOW_MAP) ?
+			 VRAM_BMAP_2 : VRAM_BMAP_1) + (window_line >> 3) * 0x20;
+		const uint8_t py = window_line & 0x07;
+		const uint_fast16_t start =
+			gb->gb_reg.WX < 7 ? 0 : gb->gb_reg.WX - 7;
+
+		for(uint_fast16_t disp_x = start; disp_x < LCD_WIDTH; disp_x++)
+		{
+			const uint8_t win_x = disp_x - gb->gb_reg.WX + 7;
+			const uint8_t idx = gb->vram[win_line + (win_x >> 3)];
+			const uint8_t px = 7 - (win_x & 0x07);
+			uint16_t tile;
+
+			if(gb->gb_reg.LCDC & LCDC_TILE_SELECT)
+				tile = VRAM_TILES_1 + idx * 0x10;
+			else
+				tile = VRAM_TILES_2 + ((idx + 0x80) % 0x100) * 0x10;
+
+			tile += 2 * py;
+
+			const uint8_t t1 = gb->vram[tile] >> px;
+			const uint8_t t2 = gb->vram[tile + 1] >> px;
+			const uint8_t c = (t1 & 0x1) | ((t2 & 0x1) << 1);
+
+			pixels[disp_x] = gb->display.bg_palette[c] | LCD_PALETTE_BG;
+		}
+	}
+
+	if(gb->gb_reg.LCDC & LCDC_OBJ_ENABLE)
+	{
+#if PEANUT_GB_HIGH_LCD_ACCURACY
+		uint8_t number_of_sprites = 0;
+		struct sprite_data sprites_to_render[NUM_SPRITES];
+
+		for(uint8_t sprite_number = 0; sprite_number < NUM_SPRITES;
+				sprite_number++)
+		{
+			const uint8_t OY = gb->oam[4 * sprite_number + 0];
+			const uint8_t OX = gb->oam[4 * sprite_number + 1];
+
+			if(gb->gb_reg.LY +
+					(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
+					gb->gb_reg.LY + 16 < OY)
+				continue;
+
+			sprites_to_render[number_of_sprites].sprite_number =
+				sprite_number;
+			sprites_to_render[number_of_sprites].x = OX;
+			number_of_sprites++;
+		}
+
+		qsort(&sprites_to_render[0], number_of_sprites,
+		      sizeof(sprites_to_render[0]), compare_sprites);
+
+		if(number_of_sprites > MAX_SPRITES_LINE)
+			number_of_sprites = MAX_SPRITES_LINE;
+
+		for(uint8_t sprite_number = number_of_sprites - 1;
+				sprite_number != 0xFF; sprite_number--)
+		{
+			const uint8_t s =
+				sprites_to_render[sprite_number].sprite_number;
+#else
+		uint8_t sprites_to_render[MAX_SPRITES_LINE];
+		uint8_t number_of_sprites = 0;
+
+		/* Only the first ten sprites on the line in OAM are drawn. */
+		for(uint8_t s = 0; s < NUM_SPRITES &&
+				number_of_sprites < MAX_SPRITES_LINE; s++)
+		{
+			const uint8_t OY = gb->oam[4 * s + 0];
+
+			if(gb->gb_reg.LY +
+					(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0 : 8) >= OY ||
+					gb->gb_reg.LY + 16 < OY)
+				continue;
+
+			sprites_to_render[number_of_sprites++] = s;
+		}
+
+		for(uint8_t sprite_number = number_of_sprites - 1;
+				sprite_number != 0xFF; sprite_number--)
+		{
+			const uint8_t s = sprites_to_render[sprite_number];
+#endif
+			const uint8_t OY = gb->oam[4 * s + 0];
+			const uint8_t OX = gb->oam[4 * s + 1];
+			const uint8_t OT = gb->oam[4 * s + 2] &
+				(gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 0xFE : 0xFF);
+			const uint8_t OF = gb->oam[4 * s + 3];
+
+			if(OX == 0 || OX >= 168)
+				continue;
+
+			uint8_t py = gb->gb_reg.LY - OY + 16;
+
+			if(OF & OBJ_FLIP_Y)
+				py = (gb->gb_reg.LCDC & LCDC_OBJ_SIZE ? 15 : 7) - py;
+
+			const uint8_t t1 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py];
+			const uint8_t t2 = gb->vram[VRAM_TILES_1 + OT * 0x10 + 2 * py + 1];
+
+			for(int x = 0; x < 8; x++)
+			{
+				const int disp_x = OX - 8 + x;
+				const uint8_t bit = (OF & OBJ_FLIP_X) ? x : 7 - x;
+				const uint8_t c = ((t1 >> bit) & 0x1) |
+						  (((t2 >> bit) & 0x1) << 1);
+
+				if(disp_x < 0 || disp_x >= LCD_WIDTH)
+					continue;
+
+				if(c && !(OF & OBJ_PRIORITY && pixels[disp_x] & 0x3))
+				{
+					pixel = (OF & OBJ_PALETTE) ?
+						gb->display.sp_palette[c + 4] :
+						gb->display.sp_palette[c];
+					pixel |= (OF & OBJ_PALETTE);
+					pixel &= ~LCD_PALETTE_BG;
+					pixels[disp_x] = pixel;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Fills VRAM, OAM, the palettes and the LCD registers with random values.
+ * Coordinates are biased towards the screen edges, where lines are clipped.
+ */
+static void randomise(struct gb_s *gb)
+{
+	static const uint8_t edges[] = { 0, 1, 6, 7, 8, 9, 159, 160, 161, 166, 167 };
+
+	for(uint_fast16_t addr = VRAM_ADDR; addr < VRAM_ADDR + VRAM_SIZE; addr++)
+		__gb_write(gb, addr, random_byte());
+
+	for(uint_fast16_t i = 0; i < OAM_SIZE; i++)
+		__gb_write(gb, OAM_ADDR + i, random_byte());
+
+	for(uint_fast16_t i = 0; i < NUM_SPRITES; i++)
+	{
+		if(random_byte() & 1)
+			__gb_write(gb, OAM_ADDR + 4 * i + 1,
+				   edges[random_byte() % sizeof(edges)]);
+	}
+
+	__gb_write(gb, 0xFF47, random_byte());
+	__gb_write(gb, 0xFF48, random_byte());
+	__gb_write(gb, 0xFF49, random_byte());
+
+	gb->gb_reg.LCDC = random_byte() | LCDC_ENABLE;
+	gb->gb_reg.SCX = random_byte();
+	gb->gb_reg.SCY = random_byte();
+	gb->gb_reg.WX = (random_byte() & 1) ?
+			edges[random_byte() % sizeof(edges)] : random_byte();
+	gb->display.WY = random_byte() % LCD_HEIGHT;
+	gb->display.window_clear = random_byte();
+	gb->gb_reg.LY = random_byte() % LCD_HEIGHT;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static struct gb_s gb;
+	static uint8_t reference[LCD_HEIGHT][LCD_WIDTH];
+	unsigned cases = DEFAULT_CASES;
+	unsigned frames = DEFAULT_FRAMES;
+	const uint8_t *line_pixels;
+	uint8_t x = 0;
+	double start, core_time, reference_time;
+
+	if(argc > 1)
+		cases = strtoul(argv[1], NULL, 10);
+
+	if(argc > 2)
+		frames = strtoul(argv[2], NULL, 10);
+
+	memcpy(rom + 0x134, "RENDERER", 8);
+
+	for(uint_fast16_t i = 0x134; i < ROM_HEADER_CHECKSUM_LOC; i++)
+		x = x - rom[i] - 1;
+
+	rom[ROM_HEADER_CHECKSUM_LOC] = x;
+
+	if(gb_init(&gb, &gb_rom_read, &gb_cart_ram_read, &gb_cart_ram_write,
+			&gb_error, NULL) != GB_INIT_NO_ERROR)
+	{
+		fprintf(stderr, "Unable to initialise the core\n");
+		return EXIT_FAILURE;
+	}
+
+	gb_init_lcd(&gb, NULL);
+#if !PEANUT_GB_FRAMEBUFFER
+	gb_set_lcd_draw_line(&gb, line_drawn);
+#endif
+
+	for(unsigned i = 0; i < cases; i++)
+	{
+		uint8_t window_line;
+
+		/* VRAM is only refilled now and then, as it is the slowest. */
+		if(i % 64 == 0)
+			randomise(&gb);
+		else
+		{
+			__gb_write(&gb, VRAM_ADDR + (random_byte() << 5 | random_byte() % 32),
+				   random_byte());
+			for(uint_fast16_t j = 0; j < 8; j++)
+				__gb_write(&gb, OAM_ADDR + random_byte() % OAM_SIZE,
+					   random_byte());
+
+			gb.gb_reg.LCDC = random_byte() | LCDC_ENABLE;
+			gb.gb_reg.SCX = random_byte();
+			gb.gb_reg.WX = random_byte() % 168;
+			gb.display.window_clear = random_byte();
+			gb.gb_reg.LY = random_byte() % LCD_HEIGHT;
+		}
+
+		window_line = gb.display.window_clear;
+#if PEANUT_GB_FRAMEBUFFER
+		/* Lines without the background keep what was drawn before. */
+		memset(reference[0], random_byte(), LCD_WIDTH);
+		memcpy(gb.display.front_fb[gb.gb_reg.LY], reference[0],
+		       LCD_WIDTH);
+		line_pixels = gb.display.front_fb[gb.gb_reg.LY];
+#else
+		/* Lines without the background start blank. */
+		memset(reference[0], 0, LCD_WIDTH);
+		memset(drawn, random_byte(), LCD_WIDTH);
+		line_pixels = drawn;
+#endif
+
+		__gb_draw_line(&gb);
+		reference_draw_line(&gb, reference[0], window_line);
+
+		if(memcmp(line_pixels, reference[0], LCD_WIDTH) != 0)
+		{
+			fprintf(stderr, "Case %u differs on line %u, LCDC %02X "
+				"SCX %02X WX %02X\n", i, gb.gb_reg.LY,
+				gb.gb_reg.LCDC, gb.gb_reg.SCX, gb.gb_reg.WX);
+
+			for(uint_fast16_t p = 0; p < LCD_WIDTH; p++)
+			{
+				if(line_pixels[p] != reference[0][p])
+					fprintf(stderr, "  x %3u: %02X, reference %02X\n",
+						(unsigned)p, line_pixels[p],
+						reference[0][p]);
+			}
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%u lines identical to the reference\n", cases);
+
+	/* Time whole frames of the last state. */
+	start = now();
+
+	for(unsigned frame = 0; frame < frames; frame++)
+	{
+		gb.display.window_clear = 0;
+
+		for(uint8_t line = 0; line < LCD_HEIGHT; line++)
+		{
+			gb.gb_reg.LY = line;
+			__gb_draw_line(&gb);
+		}
+	}
+
+	core_time = now() - start;
+	start = now();
+
+	for(unsigned frame = 0; frame < frames; frame++)
+	{
+		uint8_t window_line = 0;
+
+		for(uint8_t line = 0; line < LCD_HEIGHT; line++)
+		{
+			gb.gb_reg.LY = line;
+			reference_draw_line(&gb, reference[line], window_line++);
+		}
+	}
+
+	reference_time = now() - start;
+
+	printf("Core: %.1f ns per line\n",
+	       core_time * 1e9 / frames / LCD_HEIGHT);
+	printf("Reference: %.1f ns per line\n",
+	       reference_time * 1e9 / frames / LCD_HEIGHT);
+	return EXIT_SUCCESS;
+}
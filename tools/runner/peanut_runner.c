@@ -0,0 +1,1023 @@
+/**
+ * Headless command-line runner for the Peanut-GB core used by Gamekid, for
+ * regression and performance testing on Linux.
+ *
+ * Runs a ROM for a number of frames without input and prints the emulated
+ * frame rate and a hash of the final emulator state, so that runs of the same
+ * ROM can be compared across builds and core options. With -l, a second
+ * instance only interprets, and both are compared after every slice of the
+ * given number of clock cycles; the first difference is reported and the
+ * runner exits with a failure status.
+ *
+ * Core options that must not change behaviour, such as PEANUT_GB_LAZY_FLAGS,
+ * are checked against a build without them. With -t, the state hash and
+ * registers are printed after every slice of the given number of cycles, and
+ * with -c as well, compared with those printed by the other build given, run
+ * with the same options; the first slice that differs is reported. -g runs a
+ * generated ROM instead of a file, which stores the flags after every
+ * instruction that sets them for each pair of operands, e.g.:
+ *
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_LAZY_FLAGS=1 \
+ *      tools/runner/peanut_runner.c -o peanut_runner_lazy
+ *   ./peanut_runner_lazy -f 66000 -t 70224 -c ./peanut_runner -g
+ *
+ * With -d, OAM DMA from every source page, in each ROM and cart RAM bank of
+ * the ROM and with direct memory access and without, is compared against the
+ * bytes read one at a time through the slow path of __gb_read(), and the
+ * runner exits.
+ *
+ * Built with PEANUT_GB_BLOCK_TRANSLATOR_X86_64, hot blocks are compiled to
+ * native x86-64 code in memory mapped by the runner, e.g.:
+ *
+ *   cc -O2 -Iextension/emulator/gb tools/runner/peanut_runner.c \
+ *      -o peanut_runner
+ *   cc -O2 -Iextension/emulator/gb -DPEANUT_GB_BLOCK_CACHE_SIZE=1024 \
+ *      -DPEANUT_GB_BLOCK_TRANSLATOR=1 -DPEANUT_GB_BLOCK_TRANSLATOR_X86_64=1 \
+ *      tools/runner/peanut_runner.c -o peanut_runner_jit
+ *
+ *   ./peanut_runner_jit [-f frames] [-l cycles] [-t cycles [-c build]] [-i] \
+ *      [-p profile] [-d] game.gb|-g
+ *
+ * With -p and the block cache, the blocks saved in the profile file are
+ * decoded, and translated where they were before, ahead of the first frame,
+ * and the hottest blocks are saved back to it after the run.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ENABLE_SOUND 0
+#define ENABLE_LCD 1
+#define PEANUT_GB_HIGH_LCD_ACCURACY 0
+
+/* Sound is disabled at runtime, but the core still links against these. */
+uint8_t audio_read(const uint16_t addr)
+{
+	(void)addr;
+	return 0xFF;
+}
+
+void audio_write(const uint16_t addr, const uint8_t val)
+{
+	(void)addr;
+	(void)val;
+}
+
+#include "peanut_gb.h"
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+#	include <sys/mman.h>
+#	define CODE_SIZE	(1024 * 1024)
+#endif
+
+#define DEFAULT_FRAMES	3600
+#define FLAGS_ROM_SIZE	(2 * ROM_BANK_SIZE)
+
+/* Large enough for any supported cartridge. */
+#define CART_RAM_SIZE	0x20000
+
+struct priv_t
+{
+	uint8_t *rom;
+	uint8_t *cart_ram;
+	void *code;
+#if !PEANUT_GB_FRAMEBUFFER
+	/* Lines as last passed to lcd_draw_line. */
+	uint8_t screen[LCD_HEIGHT][LCD_WIDTH];
+#endif
+};
+
+static uint8_t gb_rom_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	return p->rom[addr];
+}
+
+static uint8_t gb_cart_ram_read(struct gb_s *gb, const uint_fast32_t addr)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	return p->cart_ram[addr];
+}
+
+static void gb_cart_ram_write(struct gb_s *gb, const uint_fast32_t addr,
+			      const uint8_t val)
+{
+	const struct priv_t * const p = gb->direct.priv;
+	p->cart_ram[addr] = val;
+}
+
+static void gb_error(struct gb_s *gb, const enum gb_error_e gb_err,
+		     const uint16_t val)
+{
+	if(gb_err == GB_INVALID_OPCODE)
+	{
+		fprintf(stderr, "Invalid opcode %#04x at PC: %#06x\n", val,
+			gb->cpu_reg.pc - 1);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static uint8_t *read_file(const char *path, long *size)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *buf = NULL;
+	long len;
+
+	if(f == NULL)
+		return NULL;
+
+	if(fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 &&
+			fseek(f, 0, SEEK_SET) == 0 &&
+			(buf = malloc(len)) != NULL &&
+			fread(buf, 1, len, f) != (size_t)len)
+	{
+		free(buf);
+		buf = NULL;
+	}
+
+	if(size != NULL && buf != NULL)
+		*size = len;
+
+	fclose(f);
+	return buf;
+}
+
+/* Appends the given bytes to the code generated at pc. */
+#define EMIT(...)							\
+	do {								\
+		const uint8_t emit_[] = { __VA_ARGS__ };		\
+		memcpy(rom + pc, emit_, sizeof(emit_));			\
+		pc += sizeof(emit_);					\
+	} while(0)
+
+/* Branches on Z and C, which moves the pointer to the ring of results in HL
+ * when taken, and stores AF at it. Only INC HL and RES 4, H follow, which
+ * leave the flags alone. */
+#define EMIT_STORE_AF()							\
+	EMIT(0x28, 0x01, 0x23,		/* JR Z, +1; INC HL */		\
+	     0x38, 0x01, 0x23,		/* JR C, +1; INC HL */		\
+	     0xF5, 0xD1,		/* PUSH AF; POP DE */		\
+	     0x72, 0x23, 0x73, 0x23,	/* LD (HL+), D; LD (HL+), E */	\
+	     0xCB, 0xA4)		/* RES 4, H */
+
+/* Sets A to B, and C to bit 0 of C. */
+#define EMIT_OPERANDS()							\
+	EMIT(0x79, 0x1F, 0x78)		/* LD A, C; RRA; LD A, B */
+
+/* Sets A to B and F to the top bits of C. */
+#define EMIT_AF_FROM_BC()						\
+	EMIT(0xC5, 0xF1)		/* PUSH BC; POP AF */
+
+/* Saves the pointer to the ring in HRAM, and sets SP to 0xDF00 + C after an
+ * instruction that sets the flags. */
+#define EMIT_SP_FROM_C()						\
+	EMIT(0x7D, 0xE0, 0x80,		/* LD A, L; LDH (0x80), A */	\
+	     0x7C, 0xE0, 0x81,		/* LD A, H; LDH (0x81), A */	\
+	     0x26, 0xDF, 0x69, 0xF9,	/* LD HL, 0xDF00 + C; LD SP, HL */ \
+	     0x78, 0x91)		/* LD A, B; SUB C */
+
+/* Restores SP and the pointer to the ring, leaving the flags alone. */
+#define EMIT_RESTORE_SP()						\
+	EMIT(0x31, 0xF0, 0xDF,		/* LD SP, 0xDFF0 */		\
+	     0xF0, 0x81, 0x67,		/* LDH A, (0x81); LD H, A */	\
+	     0xF0, 0x80, 0x6F)		/* LDH A, (0x80); LD L, A */
+
+/**
+ * Generates a 32 KiB ROM that runs every instruction that sets or reads the
+ * flags on the operands in BC, and stores AF after each in a ring at 0xC000,
+ * for each value of BC in turn. The stored results, and so the state hash,
+ * depend on every flag each instruction sets. Used to check options that
+ * change how the flags are worked out, such as PEANUT_GB_LAZY_FLAGS.
+ */
+static uint8_t *generate_flags_rom(void)
+{
+	/* INC A, DEC A, INC (HL) and DEC (HL). */
+	static const uint8_t inc_dec[] = { 0x3C, 0x3D, 0x34, 0x35 };
+	/* DAA, INC A, DEC A, RLCA, RRCA, RLA, RRA, CPL, SCF and CCF. */
+	static const uint8_t af_ops[] =
+	{
+		0x27, 0x3C, 0x3D, 0x07, 0x0F, 0x17, 0x1F, 0x2F, 0x37, 0x3F
+	};
+	static const uint8_t sp_offsets[] =
+	{
+		0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0xF0, 0xFF
+	};
+	uint8_t *rom = malloc(FLAGS_ROM_SIZE);
+	size_t pc = 0x150, loop;
+	uint8_t x = 0;
+
+	if(rom == NULL)
+		return NULL;
+
+	memset(rom, 0xFF, FLAGS_ROM_SIZE);
+
+	/* DI; LD SP, 0xDFF0; LD HL, 0xC000; LD BC, 0 */
+	EMIT(0xF3, 0x31, 0xF0, 0xDF, 0x21, 0x00, 0xC0, 0x01, 0x00, 0x00);
+	loop = pc;
+
+	/* ADD, ADC, SUB, SBC, AND, XOR, OR and CP with C, (HL) and an
+	 * immediate, and DAA after each of ADD, ADC, SUB and SBC. */
+	for(uint_fast8_t op = 0; op < 8; op++)
+	{
+		EMIT_OPERANDS();
+		EMIT(0x81 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_OPERANDS();
+		EMIT(0x86 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_OPERANDS();
+		EMIT(0xC6 | op << 3, 0x99);
+		EMIT_STORE_AF();
+
+		if(op < 4)
+		{
+			EMIT_OPERANDS();
+			EMIT(0x81 | op << 3, 0x27);
+			EMIT_STORE_AF();
+		}
+	}
+
+	/* INC and DEC of A and (HL), which keep C. */
+	for(uint_fast8_t i = 0; i < sizeof(inc_dec); i++)
+	{
+		EMIT_OPERANDS();
+		EMIT(inc_dec[i]);
+		EMIT_STORE_AF();
+	}
+
+	/* DAA, INC, DEC, rotates of A, CPL, SCF and CCF from every
+	 * combination of flags, and SCF and CCF after an addition. */
+	for(uint_fast8_t i = 0; i < sizeof(af_ops); i++)
+	{
+		EMIT_AF_FROM_BC();
+		EMIT(af_ops[i]);
+		EMIT_STORE_AF();
+	}
+
+	EMIT_OPERANDS();
+	EMIT(0x81, 0x37);
+	EMIT_STORE_AF();
+	EMIT_OPERANDS();
+	EMIT(0x91, 0x3F);
+	EMIT_STORE_AF();
+
+	/* CB rotates, shifts and SWAP of A, and BIT of A and (HL), from every
+	 * combination of flags. BIT, which keeps C, also follows an addition,
+	 * and SET and RES, which keep every flag, a subtraction. */
+	for(uint_fast8_t op = 0; op < 8; op++)
+	{
+		EMIT_AF_FROM_BC();
+		EMIT(0xCB, 0x07 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_AF_FROM_BC();
+		EMIT(0xCB, 0x47 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_AF_FROM_BC();
+		EMIT(0xCB, 0x46 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_OPERANDS();
+		EMIT(0x81, 0xCB, 0x47 | op << 3);
+		EMIT_STORE_AF();
+
+		EMIT_OPERANDS();
+		EMIT(0x91, 0xCB, (op & 1 ? 0xC7 : 0x87) | op << 3);
+		EMIT_STORE_AF();
+	}
+
+	/* ADD HL, BC/DE/HL/SP, which keep Z from a subtraction. A is set to
+	 * the top byte of the result. */
+	for(uint_fast8_t op = 0; op < 4; op++)
+	{
+		/* PUSH HL; LD H, B; LD L, C; LD D, C; LD E, B */
+		EMIT(0xE5, 0x60, 0x69, 0x51, 0x58);
+		EMIT_OPERANDS();
+		/* SUB C; ADD HL, rr; LD A, H; POP HL */
+		EMIT(0x91, 0x09 | op << 4, 0x7C, 0xE1);
+		EMIT_STORE_AF();
+	}
+
+	/* ADD SP, e and LD HL, SP + e from SP = 0xDF00 + C. The results are
+	 * stored in HRAM at 0x82 and 0x83. */
+	for(uint_fast8_t i = 0; i < sizeof(sp_offsets); i++)
+	{
+		EMIT_SP_FROM_C();
+		/* ADD SP, e; PUSH AF; POP DE; LD HL, 0; ADD HL, SP */
+		EMIT(0xE8, sp_offsets[i], 0xF5, 0xD1, 0x21, 0x00, 0x00, 0x39);
+		/* LD A, L; LDH (0x82), A; LD A, H; LDH (0x83), A */
+		EMIT(0x7D, 0xE0, 0x82, 0x7C, 0xE0, 0x83);
+		EMIT_RESTORE_SP();
+		/* PUSH DE; POP AF */
+		EMIT(0xD5, 0xF1);
+		EMIT_STORE_AF();
+
+		EMIT_SP_FROM_C();
+		/* LD HL, SP + e; LD A, L; LDH (0x82), A; LD A, H;
+		 * LDH (0x83), A */
+		EMIT(0xF8, sp_offsets[i], 0x7D, 0xE0, 0x82, 0x7C, 0xE0, 0x83);
+		EMIT_RESTORE_SP();
+		EMIT_STORE_AF();
+	}
+
+	/* INC C; JP NZ, loop; INC B; JP loop */
+	EMIT(0x0C, 0xC2, loop & 0xFF, loop >> 8,
+	     0x04, 0xC3, loop & 0xFF, loop >> 8);
+
+	/* Entry point: NOP; JP 0x0150. */
+	memcpy(rom + 0x100, "\x00\xC3\x50\x01", 4);
+	memset(rom + 0x134, 0, 0x14D - 0x134);
+	memcpy(rom + 0x134, "FLAGS", 5);
+	rom[0x147] = 0x00;	/* ROM only */
+	rom[0x148] = 0x00;	/* 2 banks */
+	rom[0x149] = 0x00;	/* No cart RAM */
+
+	for(uint_fast16_t i = 0x134; i < ROM_HEADER_CHECKSUM_LOC; i++)
+		x = x - rom[i] - 1;
+
+	rom[ROM_HEADER_CHECKSUM_LOC] = x;
+	return rom;
+}
+
+#undef EMIT_RESTORE_SP
+#undef EMIT_SP_FROM_C
+#undef EMIT_AF_FROM_BC
+#undef EMIT_OPERANDS
+#undef EMIT_STORE_AF
+#undef EMIT
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#if !PEANUT_GB_FRAMEBUFFER
+static void lcd_draw_line(struct gb_s *gb, const uint8_t *pixels,
+			  const uint_fast8_t line)
+{
+	struct priv_t * const p = gb->direct.priv;
+	memcpy(p->screen[line], pixels, LCD_WIDTH);
+}
+#endif
+
+/**
+ * Initialises an emulator instance with its own cart RAM and, if the core
+ * compiles blocks, its own code buffer. Returns 0 on failure.
+ */
+static int init_instance(struct gb_s *gb, struct priv_t *priv, uint8_t *rom,
+			 const int translate)
+{
+	enum gb_init_error_e err;
+
+	priv->rom = rom;
+	priv->cart_ram = calloc(1, CART_RAM_SIZE);
+	priv->code = NULL;
+
+	if(priv->cart_ram == NULL)
+		return 0;
+
+	err = gb_init(gb, &gb_rom_read, &gb_cart_ram_read, &gb_cart_ram_write,
+		      &gb_error, priv);
+
+	if(err != GB_INIT_NO_ERROR)
+	{
+		fprintf(stderr, "Unable to initialise the ROM: error %d\n", err);
+		return 0;
+	}
+
+	gb_set_direct_memory(gb, rom, priv->cart_ram);
+	gb_init_lcd(gb, NULL);
+#if !PEANUT_GB_FRAMEBUFFER
+	memset(priv->screen, 0, sizeof(priv->screen));
+	gb_set_lcd_draw_line(gb, &lcd_draw_line);
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	gb->direct.translate = translate;
+#else
+	(void)translate;
+#endif
+
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	if(translate)
+	{
+		priv->code = mmap(NULL, CODE_SIZE,
+				  PROT_READ | PROT_WRITE | PROT_EXEC,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if(priv->code == MAP_FAILED)
+		{
+			perror("Unable to map code buffer");
+			return 0;
+		}
+
+		gb_set_translator_code(gb, priv->code, CODE_SIZE);
+	}
+#endif
+
+	return 1;
+}
+
+static void free_instance(struct priv_t *priv)
+{
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	if(priv->code != NULL)
+		munmap(priv->code, CODE_SIZE);
+#endif
+	free(priv->cart_ram);
+}
+
+static uint_fast64_t fnv1a(uint_fast64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while(len--)
+	{
+		hash ^= *p++;
+		hash = (hash * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF;
+	}
+
+	return hash;
+}
+
+/**
+ * Hashes the CPU registers, memory, I/O registers and screen. Only the bits
+ * of F that exist are included.
+ */
+static uint_fast64_t hash_state(const struct gb_s *gb)
+{
+	const struct cpu_registers_s *r = &gb->cpu_reg;
+	const uint8_t f = r->f & 0xF0;
+	uint_fast64_t hash = 0xCBF29CE484222325;
+
+	hash = fnv1a(hash, &r->a, 1);
+	hash = fnv1a(hash, &f, 1);
+	hash = fnv1a(hash, &r->bc, 2);
+	hash = fnv1a(hash, &r->de, 2);
+	hash = fnv1a(hash, &r->hl, 2);
+	hash = fnv1a(hash, &r->sp, 2);
+	hash = fnv1a(hash, &r->pc, 2);
+	hash = fnv1a(hash, gb->wram, WRAM_SIZE);
+	hash = fnv1a(hash, gb->vram, VRAM_SIZE);
+	hash = fnv1a(hash, gb->oam, OAM_SIZE);
+	hash = fnv1a(hash, gb->hram, HRAM_SIZE);
+	hash = fnv1a(hash, &gb->gb_reg, sizeof(gb->gb_reg));
+#if PEANUT_GB_FRAMEBUFFER
+	hash = fnv1a(hash, gb->display.front_fb, sizeof(gb->display.front_fb));
+#else
+	const struct priv_t * const p = gb->direct.priv;
+	hash = fnv1a(hash, p->screen, sizeof(p->screen));
+#endif
+	return hash;
+}
+
+static void print_registers(const char *name, const struct gb_s *gb)
+{
+	const struct cpu_registers_s *r = &gb->cpu_reg;
+
+	fprintf(stderr, "%s: PC %04X SP %04X A %02X F %02X BC %04X DE %04X "
+		"HL %04X IME %d HALT %d\n", name, r->pc, r->sp, r->a,
+		r->f & 0xF0, r->bc, r->de, r->hl, gb->gb_ime, gb->gb_halt);
+}
+
+/* Reports the first byte that differs between two memory areas. */
+static int compare_memory(const char *name, const uint16_t addr,
+			  const uint8_t *a, const uint8_t *b, const size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		if(a[i] == b[i])
+			continue;
+
+		fprintf(stderr, "%s differs at %04zX: %02X, interpreter %02X\n",
+			name, addr + i, a[i], b[i]);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Compares an instance against one that only interprets. Returns 0 and reports
+ * the differences if they differ.
+ */
+static int compare_instances(const struct gb_s *gb, const struct gb_s *ref)
+{
+	const struct cpu_registers_s *a = &gb->cpu_reg, *b = &ref->cpu_reg;
+	int same = 1;
+
+	if(a->a != b->a || (a->f & 0xF0) != (b->f & 0xF0) ||
+			a->bc != b->bc || a->de != b->de || a->hl != b->hl ||
+			a->sp != b->sp || a->pc != b->pc ||
+			gb->gb_ime != ref->gb_ime || gb->gb_halt != ref->gb_halt)
+	{
+		fprintf(stderr, "CPU state differs\n");
+		same = 0;
+	}
+
+	same &= compare_memory("WRAM", WRAM_0_ADDR, gb->wram, ref->wram,
+			       WRAM_SIZE);
+	same &= compare_memory("VRAM", VRAM_ADDR, gb->vram, ref->vram,
+			       VRAM_SIZE);
+	same &= compare_memory("OAM", OAM_ADDR, gb->oam, ref->oam, OAM_SIZE);
+	same &= compare_memory("HRAM", HRAM_ADDR, gb->hram, ref->hram,
+			       HRAM_SIZE);
+
+	if(memcmp(&gb->gb_reg, &ref->gb_reg, sizeof(gb->gb_reg)) != 0)
+	{
+		fprintf(stderr, "I/O registers differ\n");
+		same = 0;
+	}
+
+	if(!same)
+	{
+		print_registers("Core", gb);
+		print_registers("Interpreter", ref);
+	}
+
+	return same;
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/**
+ * Starts an OAM DMA from the page of val and compares OAM with the bytes read
+ * one at a time by __gb_read() with every page unmapped, as the core did
+ * before the copy from mapped pages. The DMA is repeated with OAM already
+ * holding the source, which the core skips. Returns 0 and reports the first
+ * difference if they differ.
+ */
+static int check_dma(struct gb_s *gb, const uint8_t val, uint32_t *seed)
+{
+	const uint_fast16_t src = (val % 0xF1) << 8;
+	const uint8_t *map[MAP_PAGE_COUNT];
+	uint8_t expected[OAM_SIZE];
+
+	memcpy(map, gb->memory_map.read, sizeof(map));
+	memset(gb->memory_map.read, 0, sizeof(gb->memory_map.read));
+
+	for(uint_fast16_t i = 0; i < OAM_SIZE; i++)
+		expected[i] = __gb_read(gb, src + i);
+
+	memcpy(gb->memory_map.read, map, sizeof(map));
+
+	for(int pass = 0; pass < 2; pass++)
+	{
+		if(pass == 0)
+		{
+			for(uint_fast16_t i = 0; i < OAM_SIZE; i++)
+				gb->oam[i] = xorshift32(seed);
+		}
+
+		__gb_write(gb, 0xFF46, val);
+
+		for(uint_fast16_t i = 0; i < OAM_SIZE; i++)
+		{
+			if(gb->oam[i] == expected[i])
+				continue;
+
+			fprintf(stderr, "OAM DMA from %04X differs at %04X%s: "
+				"%02X, __gb_read %02X (%s memory, ROM bank "
+				"%u, cart RAM bank %u, cart RAM %s)\n",
+				(unsigned)src, (unsigned)(src + i),
+				pass ? " when repeated" : "", gb->oam[i],
+				expected[i],
+				map[0] != NULL ? "direct" : "callback",
+				(unsigned)gb->selected_rom_bank,
+				(unsigned)gb->cart_ram_bank,
+				gb->enable_cart_ram ? "enabled" : "disabled");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Checks OAM DMA from every source page against __gb_read(): ROM banks, VRAM,
+ * cart RAM banks with cart RAM enabled and disabled, WRAM, echo RAM and the
+ * unmapped page at 0xF000, with direct memory access and through the
+ * callbacks. Returns the number of transfers checked, or 0 on a difference.
+ */
+static unsigned long check_oam_dma(struct gb_s *gb)
+{
+	struct priv_t * const p = gb->direct.priv;
+	uint32_t seed = 0x2545F491;
+	unsigned long transfers = 0;
+
+	for(size_t i = 0; i < WRAM_SIZE; i++)
+		gb->wram[i] = xorshift32(&seed);
+
+	for(size_t i = 0; i < VRAM_SIZE; i++)
+		gb->vram[i] = xorshift32(&seed);
+
+	for(size_t i = 0; i < CART_RAM_SIZE; i++)
+		p->cart_ram[i] = xorshift32(&seed);
+
+	for(int direct = 1; direct >= 0; direct--)
+	{
+		gb_set_direct_memory(gb, direct ? p->rom : NULL,
+				     direct ? p->cart_ram : NULL);
+
+		/* The banks are selected as the MBC would after a write to
+		 * its registers, so that every bank is reached whatever the
+		 * MBC. */
+		for(int select = 0; select < 4; select++)
+		{
+			gb->cart_mode_select = select >> 1;
+			gb->enable_cart_ram = select & 1;
+			gb->selected_rom_bank = 1;
+			gb->cart_ram_bank = 0;
+			__gb_select_rom_bank(gb);
+			__gb_select_cart_ram_bank(gb);
+
+			for(uint_fast16_t val = 0; val <= 0xFF; val++)
+			{
+				if(!check_dma(gb, val, &seed))
+					return 0;
+			}
+
+			transfers += 0x100;
+
+			/* MBC3 maps the clock registers as banks 8-12. */
+			for(uint_fast8_t bank = 0; bank < 16; bank++)
+			{
+				gb->cart_ram_bank = bank;
+				__gb_select_cart_ram_bank(gb);
+
+				for(uint_fast16_t val = CART_RAM_ADDR >> 8;
+						val < WRAM_0_ADDR >> 8; val++)
+				{
+					if(!check_dma(gb, val, &seed))
+						return 0;
+				}
+
+				transfers += (WRAM_0_ADDR - CART_RAM_ADDR) >> 8;
+			}
+
+			for(uint_fast16_t bank = 0;
+					bank <= gb->num_rom_banks_mask; bank++)
+			{
+				gb->selected_rom_bank = bank;
+				__gb_select_rom_bank(gb);
+
+				for(uint_fast16_t val = ROM_N_ADDR >> 8;
+						val < VRAM_ADDR >> 8; val++)
+				{
+					if(!check_dma(gb, val, &seed))
+						return 0;
+				}
+
+				transfers += (VRAM_ADDR - ROM_N_ADDR) >> 8;
+			}
+		}
+	}
+
+	return transfers;
+}
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+/* Decodes the blocks saved in a profile, if it exists. */
+static void load_profile(struct gb_s *gb, const char *path)
+{
+	long len;
+	uint8_t *buf = read_file(path, &len);
+
+	if(buf == NULL)
+		return;
+
+	printf("Profile: %u blocks loaded\n",
+	       (unsigned)gb_load_profile(gb, buf, len));
+	free(buf);
+}
+
+static void save_profile(struct gb_s *gb, const char *path)
+{
+	uint8_t *buf = malloc(gb_get_profile_size(gb));
+	size_t len;
+	FILE *f;
+
+	if(buf == NULL)
+		return;
+
+	len = gb_save_profile(gb, buf);
+
+	if((f = fopen(path, "wb")) == NULL ||
+			fwrite(buf, 1, len, f) != len)
+		fprintf(stderr, "Unable to write %s\n", path);
+	else
+		printf("Profile: %u blocks saved\n",
+		       (unsigned)((len - PROFILE_HEADER_SIZE) /
+				  PROFILE_ENTRY_SIZE));
+
+	if(f != NULL)
+		fclose(f);
+
+	free(buf);
+}
+#endif
+
+/**
+ * Prints the cycles run, state hash and registers after a slice of a trace, or
+ * compares them with those printed for the same slice by another build, read
+ * from other. Returns 0 and reports both if they differ.
+ */
+static int trace_slice(const struct gb_s *gb, const unsigned long n,
+		       const uint_fast32_t cycles, FILE *other)
+{
+	const struct cpu_registers_s *r = &gb->cpu_reg;
+	char line[160], other_line[160];
+
+	snprintf(line, sizeof(line), "Slice %lu: %lu cycles, %016llx, PC %04X "
+		 "SP %04X A %02X F %02X BC %04X DE %04X HL %04X\n", n,
+		 (unsigned long)cycles, (unsigned long long)hash_state(gb),
+		 r->pc, r->sp, r->a, r->f & 0xF0, r->bc, r->de, r->hl);
+
+	if(other == NULL)
+	{
+		fputs(line, stdout);
+		return 1;
+	}
+
+	/* Skip anything else the other build prints. */
+	do
+	{
+		if(fgets(other_line, sizeof(other_line), other) == NULL)
+		{
+			fprintf(stderr, "The other build stopped before slice "
+				"%lu\n", n);
+			return 0;
+		}
+	} while(strncmp(other_line, "Slice ", 6) != 0);
+
+	if(strcmp(line, other_line) == 0)
+		return 1;
+
+	fprintf(stderr, "This build:  %sOther build: %s", line, other_line);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f frames] [-l cycles] [-t cycles "
+		"[-c build]] [-i] [-p profile] [-d] ROM|-g\n"
+		"  -f frames  frames to run (default %u)\n"
+		"  -l cycles  compare against the interpreter every slice of "
+		"cycles\n"
+		"  -t cycles  print the state hash every slice of cycles\n"
+		"  -c build   compare the state every slice of -t with another "
+		"build of the runner\n"
+		"  -g         run a generated ROM that tests the flags instead "
+		"of a ROM file\n"
+		"  -i         only interpret\n"
+		"  -p profile load hot blocks from and save them to profile\n"
+		"  -d         check OAM DMA from every page against __gb_read\n",
+		name, DEFAULT_FRAMES);
+}
+
+int main(int argc, char **argv)
+{
+	static struct gb_s gb, ref;
+	struct priv_t priv, ref_priv;
+	unsigned frames = DEFAULT_FRAMES, frame;
+	unsigned long slice = 0, slices = 0;
+	int translate = 1, dma = 0, lockstep = 0, trace = 0, flags_rom = 0;
+	const char *profile = NULL, *other = NULL, *rom_name;
+	FILE *other_trace = NULL;
+	uint8_t *rom;
+	double start, elapsed;
+	int opt, ret = EXIT_SUCCESS;
+
+	while((opt = getopt(argc, argv, "f:l:t:c:gip:d")) != -1)
+	{
+		switch(opt)
+		{
+		case 'f':
+			frames = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'l':
+			slice = strtoul(optarg, NULL, 10);
+			lockstep = 1;
+			break;
+
+		case 't':
+			slice = strtoul(optarg, NULL, 10);
+			trace = 1;
+			break;
+
+		case 'c':
+			other = optarg;
+			break;
+
+		case 'g':
+			flags_rom = 1;
+			break;
+
+		case 'i':
+			translate = 0;
+			break;
+
+		case 'p':
+			profile = optarg;
+			break;
+
+		case 'd':
+			dma = 1;
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(optind != argc - !flags_rom || (other != NULL && !trace))
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	rom_name = flags_rom ? "-g" : argv[optind];
+
+	if(flags_rom)
+		rom = generate_flags_rom();
+	else if((rom = read_file(rom_name, NULL)) == NULL)
+	{
+		fprintf(stderr, "Unable to read %s\n", rom_name);
+		return EXIT_FAILURE;
+	}
+
+	if(rom == NULL ||
+			!init_instance(&gb, &priv, rom, translate) ||
+			(lockstep && !init_instance(&ref, &ref_priv, rom, 0)))
+		return EXIT_FAILURE;
+
+	if(other != NULL)
+	{
+		char cmd[1024];
+
+		/* The other build traces the same slices of the same ROM. */
+		snprintf(cmd, sizeof(cmd), "'%s' -f %u -t %lu%s '%s'", other,
+			 frames, slice, translate ? "" : " -i", rom_name);
+
+		if((other_trace = popen(cmd, "r")) == NULL)
+		{
+			perror("Unable to run the other build");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(dma)
+	{
+		const unsigned long transfers = check_oam_dma(&gb);
+
+		if(transfers)
+			printf("OAM DMA: %lu transfers identical to __gb_read\n",
+			       transfers);
+		else
+			ret = EXIT_FAILURE;
+
+		free_instance(&priv);
+
+		if(lockstep)
+			free_instance(&ref_priv);
+
+		free(rom);
+		return ret;
+	}
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(profile != NULL)
+		load_profile(&gb, profile);
+#else
+	if(profile != NULL)
+		fprintf(stderr, "Profiles require the block cache\n");
+#endif
+
+	start = now();
+
+	for(frame = 0; frame < frames && ret == EXIT_SUCCESS; frame++)
+	{
+		if(!slice)
+		{
+			gb_run_frame(&gb);
+			continue;
+		}
+
+		/* Both instances complete the frame in the same slice unless
+		 * they differ. */
+		do
+		{
+			const uint_fast32_t cycles = gb_run_cycles(&gb, slice);
+
+			if(lockstep)
+			{
+				const uint_fast32_t ref_cycles =
+					gb_run_cycles(&ref, slice);
+
+				if(cycles != ref_cycles ||
+						gb.gb_frame != ref.gb_frame ||
+						!compare_instances(&gb, &ref))
+				{
+					fprintf(stderr, "Lockstep failed in "
+						"frame %u: %lu cycles run, "
+						"interpreter %lu\n", frame,
+						(unsigned long)cycles,
+						(unsigned long)ref_cycles);
+					ret = EXIT_FAILURE;
+					break;
+				}
+			}
+
+			if(trace && !trace_slice(&gb, slices++, cycles,
+						 other_trace))
+			{
+				fprintf(stderr, "Trace differs in frame %u\n",
+					frame);
+				ret = EXIT_FAILURE;
+				break;
+			}
+		} while(!gb.gb_frame);
+	}
+
+	elapsed = now() - start;
+
+	printf("%u frames in %.3f s, %.1f FPS\n", frame, elapsed,
+	       frame / elapsed);
+	printf("State hash: %016llx\n", (unsigned long long)hash_state(&gb));
+
+#if PEANUT_GB_BULK_LOOPS
+	printf("Bulk loop iterations: %lu\n",
+	       (unsigned long)gb.bulk_stats.total_iterations);
+#endif
+#if PEANUT_GB_LINE_SIGNATURES
+	printf("Lines drawn: %lu, skipped: %lu\n",
+	       (unsigned long)gb.display.lines_drawn,
+	       (unsigned long)gb.display.lines_skipped);
+#endif
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	printf("Block cache hits: %lu, misses: %lu\n",
+	       (unsigned long)gb.block_cache.hits,
+	       (unsigned long)gb.block_cache.misses);
+	printf("RAM code pages invalidated: %lu\n",
+	       (unsigned long)gb.block_cache.invalidations);
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR
+	printf("Translated blocks: %lu, runs: %lu, flushes: %lu\n",
+	       (unsigned long)gb.translator.blocks,
+	       (unsigned long)gb.translator.runs,
+	       (unsigned long)gb.translator.flushes);
+#endif
+#if PEANUT_GB_BLOCK_TRANSLATOR_X86_64
+	printf("Native blocks: %lu\n",
+	       (unsigned long)gb.translator.native_blocks);
+#endif
+
+	if(lockstep && ret == EXIT_SUCCESS)
+		printf("Lockstep: no differences\n");
+
+	/* If the traces differ, the other build is left to stop when it can
+	 * no longer write its trace, rather than waited for. */
+	if(other_trace != NULL && ret == EXIT_SUCCESS)
+	{
+		if(pclose(other_trace) != 0)
+		{
+			fprintf(stderr, "The other build failed\n");
+			ret = EXIT_FAILURE;
+		}
+		else
+			printf("Trace: %lu slices identical to %s\n", slices,
+			       other);
+	}
+
+#if PEANUT_GB_BLOCK_CACHE_SIZE
+	if(profile != NULL)
+		save_profile(&gb, profile);
+#endif
+
+	free_instance(&priv);
+
+	if(lockstep)
+		free_instance(&ref_priv);
+
+	free(rom);
+	return ret;
+}